@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bench.h"
+#include "util.h"
+
+/* Implementing synthetic Workloads and Latency histograms for the tester's benchmarks */
+
+// A workload generator: a xoshiro256** random stream, and what the pattern keeps between I/Os
+struct bench_gen {
+  bench_spec_t spec;
+  uint64_t s[4];	// random state
+  uint32_t volume_size;
+  uint32_t next_addr;	// sequential: start of the next I/O
+  uint64_t num_slots;	// random: addresses an I/O of any length may start at
+  double zipf_zetan;	// zipf: constants of the generator, for num_slots items
+  double zipf_alpha;
+  double zipf_eta;
+};
+
+// Declaring CONSTANTS
+static const char *pattern_names[BENCH_NUM_PATTERNS] = { "seq", "uniform", "zipf" };
+#define HIST_SUB (1 << BENCH_HIST_SUB_BITS)
+
+
+//// HELPER Functions ////
+
+// Helper function-1: hist_index() - bucket of a value
+static int hist_index(uint64_t value) {
+
+  if (value < HIST_SUB)
+      return (int) value;
+
+  int shift = 63 - __builtin_clzll(value) - BENCH_HIST_SUB_BITS + 1;
+  return (shift << (BENCH_HIST_SUB_BITS - 1)) + (int) (value >> shift);
+}
+
+// Helper function-2: hist_lowest() / hist_width() - the lowest value of a bucket, and how many it covers
+static uint64_t hist_lowest(int index) {
+
+  if (index < HIST_SUB)
+      return index;
+
+  int shift = (index >> (BENCH_HIST_SUB_BITS - 1)) - 1;
+  return (uint64_t) (index - (shift << (BENCH_HIST_SUB_BITS - 1))) << shift;
+}
+
+static uint64_t hist_width(int index) {
+  return (index < HIST_SUB) ? 1 : (uint64_t) 1 << ((index >> (BENCH_HIST_SUB_BITS - 1)) - 1);
+}
+
+// Helper function-3: splitmix64() - expands a seed into the random state
+static uint64_t splitmix64(uint64_t *x) {
+
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+// Helper function-4: next_rand() - the next 64 random bits (xoshiro256**)
+static uint64_t next_rand(bench_gen_t *g) {
+
+  uint64_t result = g->s[1] * 5;
+  result = ((result << 7) | (result >> 57)) * 9;
+
+  uint64_t t = g->s[1] << 17;
+  g->s[2] ^= g->s[0];
+  g->s[3] ^= g->s[1];
+  g->s[1] ^= g->s[2];
+  g->s[0] ^= g->s[3];
+  g->s[2] ^= t;
+  g->s[3] = (g->s[3] << 45) | (g->s[3] >> 19);
+
+  return result;
+}
+
+// Helper function-5: rand_below() - a random number from 0 to n - 1 (n > 0)
+static uint64_t rand_below(bench_gen_t *g, uint64_t n) {
+  return (uint64_t) (((unsigned __int128) next_rand(g) * n) >> 64);
+}
+
+// Helper function-6: zipf_rank() - a random rank from 0 (the hottest) to num_slots - 1 (Gray et al.)
+static uint64_t zipf_rank(bench_gen_t *g) {
+
+  double u = (next_rand(g) >> 11) * 0x1.0p-53;
+  double uz = u * g->zipf_zetan;
+
+  if (uz < 1.0)
+      return 0;
+  if (uz < 1.0 + pow(0.5, g->spec.theta))
+      return 1;
+
+  uint64_t rank = (uint64_t) (g->num_slots * pow(g->zipf_eta * u - g->zipf_eta + 1.0, g->zipf_alpha));
+  return (rank < g->num_slots) ? rank : g->num_slots - 1;
+}
+
+// Helper function-7: parse_option() - applies one "name=value" option to the spec; returns 1 on
+// success and -1 on failure
+static int parse_option(char *option, bench_spec_t *spec) {
+
+  char *value = strchr(option, '=');
+  char *end;
+
+  if (value == NULL)
+      return -1;
+  *value++ = '\0';
+
+  if (strcmp(option, "ops") == 0)
+      spec->num_ops = strtol(value, &end, 0);
+  else if (strcmp(option, "reads") == 0)
+      spec->read_percent = strtol(value, &end, 0);
+  else if (strcmp(option, "align") == 0)
+      spec->align = strtoul(value, &end, 0);
+  else if (strcmp(option, "theta") == 0)
+      spec->theta = strtod(value, &end);
+  else if (strcmp(option, "seed") == 0)
+      spec->seed = strtoull(value, &end, 0);
+  else if (strcmp(option, "size") == 0) {
+      spec->min_len = spec->max_len = strtoul(value, &end, 0);
+      if (*end == '-')
+          spec->max_len = strtoul(end + 1, &end, 0);
+  }
+  else
+      return -1;
+
+  return ((*value != '\0') && (*end == '\0')) ? 1 : -1;
+}
+
+
+//// Histogram Functions
+
+void bench_hist_init(bench_hist_t *hist) {
+  memset(hist, 0, sizeof(*hist));
+  hist->min = UINT64_MAX;
+}
+
+void bench_hist_record(bench_hist_t *hist, uint64_t value) {
+
+  hist->counts[hist_index(value)] += 1;
+  hist->total += 1;
+  hist->sum += value;
+
+  if (value < hist->min)
+      hist->min = value;
+  if (value > hist->max)
+      hist->max = value;
+}
+
+void bench_hist_merge(bench_hist_t *into, const bench_hist_t *from) {
+
+  for (int i = 0; i < BENCH_HIST_BUCKETS; i++)
+      into->counts[i] += from->counts[i];
+
+  into->total += from->total;
+  into->sum += from->sum;
+  if (from->min < into->min)
+      into->min = from->min;
+  if (from->max > into->max)
+      into->max = from->max;
+}
+
+uint64_t bench_hist_percentile(const bench_hist_t *hist, double percent) {
+
+  if (hist->total == 0)
+      return 0;
+
+  // The value of the rank-th smallest recorded value, rounding the rank up
+  uint64_t rank = (uint64_t) ceil(percent / 100.0 * hist->total);
+  uint64_t seen = 0;
+
+  if (rank < 1)
+      rank = 1;
+
+  for (int i = 0; i < BENCH_HIST_BUCKETS; i++) {
+      seen += hist->counts[i];
+      if (seen >= rank) {
+          uint64_t value = hist_lowest(i) + hist_width(i) / 2;
+          return (value < hist->max) ? value : hist->max;
+      }
+  }
+
+  return hist->max;
+}
+
+double bench_hist_mean(const bench_hist_t *hist) {
+  return (hist->total > 0) ? hist->sum / hist->total : 0.0;
+}
+
+
+//// Workload Functions
+
+int bench_parse_spec(const char *text, bench_spec_t *spec) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  char copy[256];
+  char *options, *option, *save;
+  int p;
+
+  if ((text == NULL) || (strlen(text) >= sizeof(copy)))
+      return -1;
+
+  *spec = (bench_spec_t) { .num_ops = 100000, .read_percent = 70, .min_len = 256, .max_len = 256,
+                           .align = 256, .theta = 0.99, .seed = 0 };
+
+  strcpy(copy, text);
+  options = strchr(copy, ':');
+  if (options != NULL)
+      *options++ = '\0';
+
+  for (p = 0; p < BENCH_NUM_PATTERNS; p++)
+      if (strcmp(copy, pattern_names[p]) == 0)
+          break;
+  if (p == BENCH_NUM_PATTERNS)
+      return -1;
+  spec->pattern = p;
+
+  for (option = (options != NULL) ? strtok_r(options, ",", &save) : NULL; option != NULL;
+       option = strtok_r(NULL, ",", &save)) {
+      if (parse_option(option, spec) == -1)
+          return -1;
+  }
+
+  if ((spec->num_ops < 1) || (spec->read_percent < 0) || (spec->read_percent > 100) || (spec->align < 1) ||
+      (spec->min_len < 1) || (spec->min_len > spec->max_len) || (spec->theta < 0) || (spec->theta >= 1))
+      return -1;
+
+  return 1;
+}
+
+const char *bench_pattern_name(bench_pattern_t pattern) {
+  return ((pattern >= 0) && (pattern < BENCH_NUM_PATTERNS)) ? pattern_names[pattern] : NULL;
+}
+
+bench_gen_t *bench_gen_new(bench_spec_t *spec, uint32_t volume_size) {
+
+  // An I/O has to end before the end of the volume
+  if (spec->max_len >= volume_size)
+      return NULL;
+
+  bench_gen_t *g = calloc(1, sizeof(bench_gen_t));
+  if (g == NULL)
+      return NULL;
+
+  if (spec->seed == 0)
+      spec->seed = get_rand(1, UINT32_MAX - 1);
+
+  uint64_t x = spec->seed;
+  for (int k = 0; k < 4; k++)
+      g->s[k] = splitmix64(&x);
+
+  g->spec = *spec;
+  g->volume_size = volume_size;
+  g->num_slots = (volume_size - spec->max_len - 1) / spec->align + 1;
+
+  // Zipf: the normalization constant over every slot, computed once
+  if (spec->pattern == BENCH_ZIPF) {
+
+      double zeta2 = 1.0 + pow(0.5, spec->theta);
+
+      for (uint64_t i = 1; i <= g->num_slots; i++)
+          g->zipf_zetan += 1.0 / pow((double) i, spec->theta);
+
+      g->zipf_alpha = 1.0 / (1.0 - spec->theta);
+      g->zipf_eta = (1.0 - pow(2.0 / g->num_slots, 1.0 - spec->theta)) / (1.0 - zeta2 / g->zipf_zetan);
+  }
+
+  return g;
+}
+
+void bench_gen_next(bench_gen_t *g, bench_cmd_t *cmd) {
+
+  uint64_t slot = 0;
+
+  cmd->len = g->spec.min_len + (uint32_t) rand_below(g, g->spec.max_len - g->spec.min_len + 1);
+  cmd->write = rand_below(g, 100) >= (uint64_t) g->spec.read_percent;
+  cmd->fill = (uint8_t) next_rand(g);
+
+  switch (g->spec.pattern) {
+
+    case BENCH_SEQUENTIAL:
+      // Back to the start once the next I/O would run off the volume
+      if (g->next_addr + cmd->len >= g->volume_size)
+          g->next_addr = 0;
+      cmd->addr = g->next_addr;
+      g->next_addr += cmd->len;
+      return;
+
+    case BENCH_UNIFORM:
+      slot = rand_below(g, g->num_slots);
+      break;
+
+    default:
+      // The hot slots are spread over the volume: multiplying by a prime larger than any
+      // number of slots maps the ranks to the slots one to one
+      slot = (zipf_rank(g) * 2654435761ull) % g->num_slots;
+      break;
+  }
+
+  cmd->addr = (uint32_t) (slot * g->spec.align);
+}
+
+void bench_gen_free(bench_gen_t *gen) {
+  free(gen);
+}
@@ -0,0 +1,88 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A READ or WRITE of a workload: replayed from a trace, or generated. */
+typedef struct {
+  bool write;
+  uint32_t addr;
+  uint32_t len;
+  uint8_t fill;      /* byte a WRITE fills its range with */
+} bench_cmd_t;
+
+/* Latency histogram, HDR style: values below 2^BENCH_HIST_SUB_BITS are
+ * counted exactly, larger ones in 2^(BENCH_HIST_SUB_BITS - 1) buckets per
+ * power of two, so that any value is recorded within 1/128 of itself. */
+#define BENCH_HIST_SUB_BITS 8
+#define BENCH_HIST_BUCKETS ((64 - BENCH_HIST_SUB_BITS + 2) << (BENCH_HIST_SUB_BITS - 1))
+
+typedef struct {
+  uint64_t counts[BENCH_HIST_BUCKETS];
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  double sum;
+} bench_hist_t;
+
+/* Empties |hist|. */
+void bench_hist_init(bench_hist_t *hist);
+
+/* Counts one |value| (a latency in nanoseconds, for instance). */
+void bench_hist_record(bench_hist_t *hist, uint64_t value);
+
+/* Adds the counts of |from| to |into|. */
+void bench_hist_merge(bench_hist_t *into, const bench_hist_t *from);
+
+/* Returns the value below which |percent| percent of the values lie (the
+ * middle of its bucket, capped by the largest value), or 0 if there is none. */
+uint64_t bench_hist_percentile(const bench_hist_t *hist, double percent);
+
+/* Returns the mean of the values, or 0 if there is none. */
+double bench_hist_mean(const bench_hist_t *hist);
+
+/* Access patterns of a generated workload. */
+typedef enum {
+  BENCH_SEQUENTIAL,  /* each I/O starts where the previous one ended */
+  BENCH_UNIFORM,     /* uniformly random addresses */
+  BENCH_ZIPF,        /* a few hot addresses, skewed by |theta| */
+  BENCH_NUM_PATTERNS,
+} bench_pattern_t;
+
+/* A generated workload. Random addresses are multiples of |align|, and
+ * lengths uniform between |min_len| and |max_len|. */
+typedef struct {
+  bench_pattern_t pattern;
+  long num_ops;
+  int read_percent;  /* share of reads, the others are writes */
+  uint32_t min_len;
+  uint32_t max_len;
+  uint32_t align;
+  double theta;      /* Zipf skew, from 0 (uniform) up to, not including, 1 */
+  uint64_t seed;     /* 0 for a random one */
+} bench_spec_t;
+
+/* Parses a workload given as "pattern[:option=value,...]": the pattern is
+ * seq, uniform or zipf, and the options ops, reads (percent), size (bytes,
+ * or a min-max range), align, theta and seed. Options not given keep their
+ * defaults: 100000 ops, 70% reads, 256 bytes aligned to 256, theta 0.99 and
+ * a random seed. Returns 1 on success and -1 on failure. */
+int bench_parse_spec(const char *text, bench_spec_t *spec);
+
+/* Returns the short name of |pattern| ("seq", "uniform", "zipf"), or NULL. */
+const char *bench_pattern_name(bench_pattern_t pattern);
+
+/* A workload generator, over a volume of |volume_size| bytes. */
+typedef struct bench_gen bench_gen_t;
+
+/* Returns a generator of |spec| (with its seed chosen if it was 0), or NULL
+ * if the I/O sizes do not fit the volume or on failure. */
+bench_gen_t *bench_gen_new(bench_spec_t *spec, uint32_t volume_size);
+
+/* Stores the next I/O of the workload in |cmd|. */
+void bench_gen_next(bench_gen_t *gen, bench_cmd_t *cmd);
+
+void bench_gen_free(bench_gen_t *gen);
+
+#endif
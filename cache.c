@@ -1,129 +1,1729 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "cache.h"
+#include "layout.h"
 
 /* Implementing a Block Cache for mdadm */
 
-// Global Variables declaration (given)
-static cache_entry_t *cache = NULL;
-static int cache_size = 0;
-static int clock = 0;
-static int num_queries = 0;
-static int num_hits = 0;
+// A doubly-linked list of entries (or of ghosts), most recent at the head
+typedef struct {
+  int head;
+  int tail;
+  int len;
+} cache_queue_t;
+
+// A block evicted recently, remembered by its key only (2Q and ARC), in a ghost queue
+typedef struct {
+  uint32_t key;		// linear block number
+  int prev, next;	// neighbours in its ghost queue
+  int hash_next;	// next ghost in the same hash bucket (or free list), -1 ends
+  uint8_t queue;
+} cache_ghost_t;
+
+// A group of index slots, one cache line: the keys, probed all at once, followed by the slot
+// bitmasks (so that the keys and bitmasks fill a 256-bit vector) and the entries of the slots
+#define GROUP_SLOTS 14
+
+typedef struct {
+  uint16_t keys[GROUP_SLOTS];
+  uint16_t used;	// bitmask of the occupied slots
+  uint16_t overflow;	// nonzero once a key was placed past this group while it was full
+  uint16_t entries[GROUP_SLOTS];
+} __attribute__((aligned(64))) cache_group_t;
+
+typedef struct cache_shard cache_shard_t;
+
+// An eviction policy. The shard calls miss() for a block about to be inserted, victim() for the
+// entry to evict when it is full, evict() as that entry leaves, insert() once the entry of the
+// missed block is filled, and hit() for every use of an entry.
+typedef struct {
+  const char *name;
+  void (*miss)(cache_shard_t *s, uint32_t key);
+  int (*victim)(cache_shard_t *s);
+  void (*evict)(cache_shard_t *s, int i);
+  void (*insert)(cache_shard_t *s, int i);
+  void (*hit)(cache_shard_t *s, int i);
+} cache_policy_ops_t;
+
+// A shard of a Block Cache: a slice of its entries and of its block pool, with an index, eviction
+// queues and a lock of its own. Every field is protected by 'lock'; the helpers expect it to be held. The statistics
+// are updated atomically, since lock-free lookups count too.
+struct cache_shard {
+  cache_t *cache;		// Cache the shard belongs to
+  cache_entry_t *entries;	// the slice of the Cache's entries held by this shard
+  uint64_t *valid;		// bitmap of the entries holding a block
+  int size;
+  int clock;
+  long num_queries;
+  long num_hits;
+  long num_inserts;		// entries filled with a new block
+  long num_evictions;
+  long num_writebacks;		// dirty blocks written back
+  long num_prefetched;		// blocks inserted by readahead
+  long num_prefetch_hits;	// prefetched blocks found by a later lookup
+  long num_prefetch_wasted;	// prefetched blocks evicted before any lookup
+  long num_restored;		// blocks taken in from the snapshot
+
+  // Index structures: an open-addressed hash table of packed keys, in groups of slots probed
+  // at once (see group_match), and the queues of the eviction policy, intrusive
+  // doubly-linked lists threaded through the cache entries.
+  cache_group_t *groups;
+  int group_mask;	// number of groups - 1 (group count is a power of 2)
+  cache_queue_t queues[2];	// see the policies for what each one holds
+  int free_head;	// unused entries, chained through 'lru_next'
+
+  // Block pool: the data of the entries whose block is not uniform, each distinct block stored
+  // once (a slice of the Cache's slab), with a chained hash table to find a block by its data
+  uint8_t (*blocks)[JBOD_BLOCK_SIZE];
+  int pool_size;
+  int pool_used;	// pool blocks held by at least one entry
+  uint32_t *pool_refs;	// entries holding each pool block, 0 if free
+  uint32_t *pool_hash;	// hash of the data of each pool block in use
+  int *pool_next;	// next pool block in the same hash bucket (or free list), -1 ends
+  int *pool_heads;
+  int pool_mask;	// number of pool hash buckets - 1
+  int pool_free;
+
+  // Ghosts of the evicted blocks (2Q, ARC), with a chained hash table of their own
+  cache_ghost_t *ghosts;
+  int *ghost_heads;
+  int ghost_mask;	// number of ghost hash buckets - 1
+  int ghost_free;
+  int num_ghosts;	// capacity
+  cache_queue_t ghost_queues[2];
+  int incoming;		// queue the block of the latest miss() goes to
+  bool from_b2;		// ARC: the latest miss was a ghost of T2
+  int target;		// ARC: target length of T1
+
+  // Sequence lock of the index and blocks: odd while a writer changes them (see read_entry)
+  unsigned seq;
+
+  pthread_mutex_t lock;
+} __attribute__((aligned(64)));
+
+// A Block Cache, split into shards by block. With a single shard, every lookup takes its lock
+// and tells the eviction policy at once. With several shards, lookups take no lock at all: they
+// read under the sequence lock and only mark the entry referenced, and the policy hears of the
+// use when the entry comes up for eviction.
+struct cache {
+  cache_entry_t *entries;
+  uint8_t (*blocks)[JBOD_BLOCK_SIZE];	// slab of the block pools, 64-byte aligned, apart from the entries
+  int size;
+  bool pooled;		// fewer pool blocks than entries may have been asked for
+  cache_shard_t *shards;
+  int num_shards;	// a power of 2
+  bool lockless;	// lookups without the shard lock (num_shards > 1)
+  const cache_policy_ops_t *policy;
+
+  // Write-back mode: written blocks stay dirty in the Cache until evicted or flushed. The
+  // write-back function is changed with every shard lock held.
+  bool write_back;
+  cache_writeback_fn writeback_fn;
+  void *writeback_arg;
+
+  // Snapshot the Cache was warmed from (see snapshot_open), mapped read-only. A record is claimed,
+  // under the lock of its block's shard, by the miss that takes the block in or by any change of
+  // the block, which makes the record stale.
+  char *snapshot;		// file saved to when the Cache is freed, or NULL
+  uint64_t generation;
+  uint8_t *snap_map;
+  size_t snap_len;
+  const uint16_t *snap_keys;
+  const uint64_t *snap_sums;
+  const uint8_t (*snap_blocks)[JBOD_BLOCK_SIZE];
+  int snap_num;
+  int32_t *snap_records;	// unclaimed record of each key, -1 if none
+};
+
+// Header of a snapshot file. The keys of its records follow, most recently used first (padded to
+// 8 bytes), then the checksum of each record's block, and the blocks from the next page on, so
+// that they can be mapped.
+typedef struct {
+  char magic[8];		// SNAPSHOT_MAGIC
+  uint32_t version;
+  uint32_t block_size;
+  uint64_t generation;		// of the volume the blocks were read from
+  uint32_t num_records;
+  uint32_t blocks_offset;
+  uint64_t checksum;		// of this header (with checksum 0), the keys and the block checksums
+} snapshot_header_t;
+
+// Global Variables declaration
+static cache_t *default_cache = NULL;	// the Cache of cache_create() and the other default functions
+static cache_writeback_fn default_writeback_fn = NULL;	// given to every default Cache created
+static void *default_writeback_arg = NULL;
+static cache_stats_t retired_stats;	// statistics of the default Caches destroyed so far, so that
+					// cache_print_hit_rate() and cache_get_stats() still report them
+static long retired_storage[3] = { -1 };	// storage_stats() of the latest default Cache destroyed with a pool
 
 // Declaring CONSTANTS
 const int MIN_NUM_ENTRIES = 2;		// Minimum number of cache entry
-const int MAX_NUM_ENTRIES = 4096;	// Maximum number of cache entries
+const int MAX_NUM_ENTRIES = 4096;	// Maximum number of cache entries (or pool blocks, with a pool)
+#define SNAPSHOT_MAGIC "MDCACHE"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN 4096		// alignment of the blocks in a snapshot file
 
 
-//// Cache CREATE Function - Allocates dynamic space in memory for the required no. of block entries
-int cache_create(int num_entries) {
+//// BLOCK POOL Functions - the data of the cached blocks, each distinct block stored once
+
+// uniform_byte() - the value of every byte of the block, or -1 if they differ
+static int uniform_byte(const uint8_t *buf) {
+
+  uint64_t first, word;
+
+  memcpy(&first, buf, sizeof(first));
+  if (first != (first & 0xFF) * 0x0101010101010101ull)
+      return -1;
+
+  for (int k = sizeof(first); k < JBOD_BLOCK_SIZE; k += sizeof(word)) {
+      memcpy(&word, buf + k, sizeof(word));
+      if (word != first)
+          return -1;
+  }
+
+  return buf[0];
+}
+
+// content_hash() - hashes the data of a block, a word at a time
+static uint32_t content_hash(const uint8_t *buf) {
+
+  uint64_t h = 0, word;
+
+  for (int k = 0; k < JBOD_BLOCK_SIZE; k += sizeof(word)) {
+      memcpy(&word, buf + k, sizeof(word));
+      h = (h ^ word) * 0x9E3779B97F4A7C15ull;
+      h ^= h >> 32;
+  }
+
+  return (uint32_t) h;
+}
+
+// pool_find() - the pool block holding the data in 'buf', or -1
+static int pool_find(cache_shard_t *s, const uint8_t *buf, uint32_t hash) {
+
+  int p;
+
+  for (p = s->pool_heads[hash & s->pool_mask]; p != -1; p = s->pool_next[p]) {
+      if ((s->pool_hash[p] == hash) && (memcmp(s->blocks[p], buf, JBOD_BLOCK_SIZE) == 0))
+          return p;
+  }
+
+  return -1;
+}
+
+// pool_link() / pool_unlink() - put a pool block into the hash bucket of its data, or take it out
+static void pool_link(cache_shard_t *s, int p, uint32_t hash) {
+
+  int *head = &s->pool_heads[hash & s->pool_mask];
+
+  s->pool_hash[p] = hash;
+  s->pool_next[p] = *head;
+  *head = p;
+}
+
+static void pool_unlink(cache_shard_t *s, int p) {
+
+  int *link = &s->pool_heads[s->pool_hash[p] & s->pool_mask];
+
+  while (*link != p)
+      link = &s->pool_next[*link];
+
+  *link = s->pool_next[p];
+}
+
+// pool_hold() - one more holder of the data in 'buf': shares the pool block already holding it,
+// or fills a free one (there has to be one). Returns the pool block.
+static int pool_hold(cache_shard_t *s, const uint8_t *buf, uint32_t hash) {
+
+  int p = pool_find(s, buf, hash);
+
+  if (p == -1) {
+      p = s->pool_free;
+      s->pool_free = s->pool_next[p];
+      memcpy(s->blocks[p], buf, JBOD_BLOCK_SIZE);
+      pool_link(s, p, hash);
+      s->pool_used += 1;
+  }
+
+  s->pool_refs[p] += 1;
+  return p;
+}
+
+// pool_release() - one holder less; the last one frees the pool block
+static void pool_release(cache_shard_t *s, int p) {
+
+  s->pool_refs[p] -= 1;
+  if (s->pool_refs[p] > 0)
+      return;
+
+  pool_unlink(s, p);
+  s->pool_next[p] = s->pool_free;
+  s->pool_free = p;
+  s->pool_used -= 1;
+}
+
+
+//// HELPER Functions ////
+
+// Helper function-1: block_key() - the packed key of disk_num and block_num, i.e. its linear
+// block number (a volume has at most 256 disks of 256 blocks)
+static uint16_t block_key(int disk_num, int block_num) {
+  return (uint16_t) (disk_num * JBOD_NUM_BLOCKS_PER_DISK + block_num);
+}
+
+// Helper function-2: block_hash() - spreads a key (Fibonacci hashing)
+static uint32_t block_hash(uint16_t key) {
+  return key * 2654435761u;
+}
+
+// Helper function-3: shard_of() - the shard holding the block of a key
+static cache_shard_t *shard_of(cache_t *c, uint16_t key) {
+  return &c->shards[(block_hash(key) >> 8) & (c->num_shards - 1)];
+}
+
+// Helper function-4: group_match() - bitmask of the slots of a group holding 'key', comparing
+// the whole group at once. The bits past GROUP_SLOTS compare the bitmasks, and are meaningless.
+static uint32_t group_match(const cache_group_t *g, uint16_t key) {
+#if defined(__AVX2__)
+  __m256i eq = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i *) g->keys), _mm256_set1_epi16((short) key));
+  // Narrow the lanes to bytes; the pack works within each 128-bit half
+  uint32_t bytes = (uint32_t) _mm256_movemask_epi8(_mm256_packs_epi16(eq, _mm256_setzero_si256()));
+  return (bytes & 0xFF) | ((bytes >> 8) & 0xFF00);
+#elif defined(__SSE2__)
+  __m128i k = _mm_set1_epi16((short) key);
+  __m128i lo = _mm_cmpeq_epi16(_mm_load_si128((const __m128i *) g->keys), k);
+  __m128i hi = _mm_cmpeq_epi16(_mm_load_si128((const __m128i *) g->keys + 1), k);
+  return (uint32_t) _mm_movemask_epi8(_mm_packs_epi16(lo, hi));
+#else
+  uint32_t match = 0;
+  for (int j = 0; j < GROUP_SLOTS; j++)
+      match |= (uint32_t) (g->keys[j] == key) << j;
+  return match;
+#endif
+}
+
+// Helper function-5: find_slot() - slot holding 'key', numbered group * 16 + slot in group, or
+// -1. The probe goes on to the next group only past a group that overflowed, and at most once
+// around the table, since lock-free readers may see it half changed (see read_entry).
+static int find_slot(cache_shard_t *s, uint16_t key) {
+
+  int k = (int) (block_hash(key) >> 16) & s->group_mask;
+
+  for (int n = 0; n <= s->group_mask; n++) {
+
+      cache_group_t *g = &s->groups[k];
+      uint32_t match = group_match(g, key) & __atomic_load_n(&g->used, __ATOMIC_RELAXED);
+
+      if (match != 0)
+          return (k << 4) | __builtin_ctz(match);
+
+      if (__atomic_load_n(&g->overflow, __ATOMIC_RELAXED) == 0)
+          break;
+      k = (k + 1) & s->group_mask;
+  }
+
+  return -1;
+}
+
+// Helper function-6: find_entry() - index of the valid entry holding the block of 'key', or -1
+static int find_entry(cache_shard_t *s, uint16_t key) {
+
+  int slot = find_slot(s, key);
+
+  return (slot == -1) ? -1 : __atomic_load_n(&s->groups[slot >> 4].entries[slot & 15], __ATOMIC_RELAXED);
+}
+
+// Helper function-7: index_add() / index_remove() - put an entry's key into the index, or take
+// it out. A key goes to the first group from its own with a free slot.
+static void index_add(cache_shard_t *s, uint16_t key, int i) {
+
+  const uint16_t full = (1 << GROUP_SLOTS) - 1;
+  cache_group_t *g = &s->groups[(block_hash(key) >> 16) & s->group_mask];
+
+  while (g->used == full) {
+      __atomic_store_n(&g->overflow, 1, __ATOMIC_RELAXED);
+      g = &s->groups[(g - s->groups + 1) & s->group_mask];
+  }
+
+  int j = __builtin_ctz(~g->used & full);
+
+  g->keys[j] = key;
+  __atomic_store_n(&g->entries[j], i, __ATOMIC_RELAXED);
+  __atomic_store_n(&g->used, g->used | (1 << j), __ATOMIC_RELAXED);
+}
+
+static void index_remove(cache_shard_t *s, uint16_t key) {
+
+  int slot = find_slot(s, key);
+  cache_group_t *g = &s->groups[slot >> 4];
+
+  __atomic_store_n(&g->used, g->used & ~(1 << (slot & 15)), __ATOMIC_RELAXED);
+}
+
+// Helper function-8: write_begin() / write_end() - bracket a change of the index or of a block,
+// so that lock-free readers retry across it
+static void write_begin(cache_shard_t *s) {
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(cache_shard_t *s) {
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Helper function-9: has_flag() / set_flag() / clear_flag() - the flags of an entry. Lock-free
+// lookups change some of them, so they are all changed atomically, and only when they change.
+static bool has_flag(cache_shard_t *s, int i, uint8_t flag) {
+  return (__atomic_load_n(&s->entries[i].flags, __ATOMIC_RELAXED) & flag) != 0;
+}
+
+static void set_flag(cache_shard_t *s, int i, uint8_t flag) {
+  if (has_flag(s, i, flag) == false)
+      __atomic_fetch_or(&s->entries[i].flags, flag, __ATOMIC_RELAXED);
+}
+
+// Returns whether the flag was set
+static bool clear_flag(cache_shard_t *s, int i, uint8_t flag) {
+  return (has_flag(s, i, flag) == true) &&
+         ((__atomic_fetch_and(&s->entries[i].flags, (uint8_t) ~flag, __ATOMIC_RELAXED) & flag) != 0);
+}
+
+// Helper function-10: copy_block() - copies the block of an entry into 'buf'
+static void copy_block(cache_shard_t *s, int i, uint8_t *buf) {
+
+  uint16_t block = __atomic_load_n(&s->entries[i].block, __ATOMIC_RELAXED);
+
+  if (has_flag(s, i, CACHE_ENTRY_UNIFORM) == true)
+      memset(buf, block, JBOD_BLOCK_SIZE);
+  else if (block < s->pool_size)	// bounded, as lock-free readers may see a change half done
+      memcpy(buf, s->blocks[block], JBOD_BLOCK_SIZE);
+}
+
+// Helper function-11: read_entry() - find_entry() without the lock, copying the block into 'buf'
+// when not NULL. Reads until no writer changed the shard in the meantime.
+static int read_entry(cache_shard_t *s, uint16_t key, uint8_t *buf) {
+
+  while (true) {
+
+      unsigned seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+      if (seq & 1)
+          continue;
+
+      int found = find_entry(s, key);
+
+      if (found >= s->size)
+          found = -1;
+      else if ((found != -1) && (buf != NULL))
+          copy_block(s, found, buf);
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+          return found;
+  }
+}
+
+// Helper function-12: queue_unlink() - takes the entry out of its queue
+static void queue_unlink(cache_shard_t *s, int i) {
+
+  cache_entry_t *e = &s->entries[i];
+  cache_queue_t *q = &s->queues[e->queue];
+
+  if (e->lru_prev != -1)
+      s->entries[e->lru_prev].lru_next = e->lru_next;
+  else
+      q->head = e->lru_next;
+
+  if (e->lru_next != -1)
+      s->entries[e->lru_next].lru_prev = e->lru_prev;
+  else
+      q->tail = e->lru_prev;
+
+  q->len -= 1;
+}
+
+// Helper function-13: queue_push() - puts the entry at the head (most recent end) of a queue
+static void queue_push(cache_shard_t *s, int queue, int i) {
+
+  cache_queue_t *q = &s->queues[queue];
+
+  s->entries[i].queue = queue;
+  s->entries[i].lru_prev = -1;
+  s->entries[i].lru_next = q->head;
+
+  if (q->head != -1)
+      s->entries[q->head].lru_prev = i;
+  else
+      q->tail = i;
+
+  q->head = i;
+  q->len += 1;
+}
+
+// Helper function-14: touch_entry() - records a use of the entry
+static void touch_entry(cache_shard_t *s, int i) {
+
+  s->clock += 1;			// Increment the 'clock' of the shard
+  s->entries[i].access_time = s->clock;	// set access_time field to indicate recent use of entry
+  clear_flag(s, i, CACHE_ENTRY_REFERENCED);
+
+  s->cache->policy->hit(s, i);
+}
+
+// Helper function-15: write_back_entry() - writes a dirty entry back, and marks it clean
+static int write_back_entry(cache_shard_t *s, int i) {
+
+  uint16_t key = s->entries[i].key;
+  uint8_t block[JBOD_BLOCK_SIZE];
+  cache_t *c = s->cache;
+
+  if (has_flag(s, i, CACHE_ENTRY_DIRTY) == false)
+      return 1;
+
+  copy_block(s, i, block);
+
+  if ((c->writeback_fn == NULL) ||
+      (c->writeback_fn(c->writeback_arg, key / JBOD_NUM_BLOCKS_PER_DISK, key % JBOD_NUM_BLOCKS_PER_DISK,
+                       block) != 1))
+      return -1;
+
+  clear_flag(s, i, CACHE_ENTRY_DIRTY);
+  __atomic_add_fetch(&s->num_writebacks, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// Helper function-16: set_block() - makes the entry hold the data in 'buf', whose uniform byte
+// (or -1) and hash are given, releasing the pool block it held before if 'replace'. Expects a free
+// pool block, unless the data is uniform or pooled already, and the write bracket to be open.
+static void set_block(cache_shard_t *s, int i, const uint8_t *buf, int byte, uint32_t hash, bool replace) {
+
+  cache_entry_t *e = &s->entries[i];
+  int old = (replace == true) && (has_flag(s, i, CACHE_ENTRY_UNIFORM) == false) ? e->block : -1;
+
+  if (byte != -1) {
+      set_flag(s, i, CACHE_ENTRY_UNIFORM);
+      __atomic_store_n(&e->block, byte, __ATOMIC_RELAXED);
+  }
+  else {
+      // Taken before the old block is released, which may be the same one
+      __atomic_store_n(&e->block, pool_hold(s, buf, hash), __ATOMIC_RELAXED);
+      clear_flag(s, i, CACHE_ENTRY_UNIFORM);
+  }
+
+  if (old != -1)
+      pool_release(s, old);
+}
+
+// Helper function-17: evict_entry() - evicts the entry chosen by the policy (once the policy has
+// heard of the uses of the entries looked up without the lock), onto the free list.
+// Returns 1 on success and -1 on failure.
+static int evict_entry(cache_shard_t *s) {
+
+  const cache_policy_ops_t *policy = s->cache->policy;
+  int i = policy->victim(s);
+
+  // Each referenced entry is cleared on the way, so this ends
+  while ((i != -1) && (has_flag(s, i, CACHE_ENTRY_REFERENCED) == true)) {
+      touch_entry(s, i);
+      i = policy->victim(s);
+  }
+
+  if (i == -1)
+      return -1;
+
+  // A dirty victim has to reach JBOD before its entry can be reused
+  if (write_back_entry(s, i) == -1)
+      return -1;
+
+  write_begin(s);
+
+  policy->evict(s, i);
+  index_remove(s, s->entries[i].key);
+  if (has_flag(s, i, CACHE_ENTRY_UNIFORM) == false)
+      pool_release(s, s->entries[i].block);
+
+  write_end(s);
+
+  __atomic_add_fetch(&s->num_evictions, 1, __ATOMIC_RELAXED);
+  if (has_flag(s, i, CACHE_ENTRY_PREFETCHED) == true)
+      __atomic_add_fetch(&s->num_prefetch_wasted, 1, __ATOMIC_RELAXED);
+
+  s->valid[i / 64] &= ~(1ull << (i % 64));
+  s->entries[i].lru_next = s->free_head;
+  s->free_head = i;
+
+  return 1;
+}
+
+// Helper function-18: make_room() - evicts entries until there is a free one (if 'entry') and
+// the data in 'buf' fits into the pool, without evicting entry 'keep' (-1 for none).
+// Returns 1 on success and -1 on failure.
+static int make_room(cache_shard_t *s, int keep, bool entry, const uint8_t *buf, int byte, uint32_t hash) {
+
+  int queue = -1, rc = 1;
+
+  while (((entry == true) && (s->free_head == -1)) ||
+         ((byte == -1) && (s->pool_free == -1) && (pool_find(s, buf, hash) == -1))) {
+
+      // The entry kept is out of the policy's sight until the room is made
+      if ((keep != -1) && (queue == -1)) {
+          queue = s->entries[keep].queue;
+          queue_unlink(s, keep);
+      }
+
+      if (evict_entry(s) == -1) {
+          rc = -1;
+          break;
+      }
+  }
+
+  if (queue != -1)
+      queue_push(s, queue, keep);
+
+  return rc;
+}
+
+// Helper function-19: new_entry() - fills an unused entry with the block of 'key'; when the shard
+// is FULL, or its pool is, evicts the entries chosen by the policy to make room.
+// Returns the entry index on success and -1 on failure.
+static int new_entry(cache_shard_t *s, uint16_t key, const uint8_t *buf) {
+
+  const cache_policy_ops_t *policy = s->cache->policy;
+  int byte = uniform_byte(buf);
+  uint32_t hash = (byte == -1) ? content_hash(buf) : 0;
+
+  policy->miss(s, key);
+
+  if (make_room(s, -1, true, buf, byte, hash) == -1)
+      return -1;
+
+  int i = s->free_head;
+  cache_entry_t *e = &s->entries[i];
+
+  s->free_head = e->lru_next;
+
+  write_begin(s);
+
+  __atomic_store_n(&e->key, key, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->flags, 0, __ATOMIC_RELAXED);
+
+  //// "Insert the block" into the Cache
+  set_block(s, i, buf, byte, hash, false);
+
+  index_add(s, key, i);
+
+  write_end(s);
+
+  s->clock += 1;		// Increment the 'clock' of the shard
+  e->access_time = s->clock;	// set access_time field to indicate recent use of entry
+  s->valid[i / 64] |= 1ull << (i % 64);	// mark the cache entry as valid
+  policy->insert(s, i);
+  __atomic_add_fetch(&s->num_inserts, 1, __ATOMIC_RELAXED);
+
+  return i;
+}
+
+// Helper function-20: compare_keys() - orders (linear block, shard, entry) triples by block (for qsort)
+static int compare_keys(const void *a, const void *b) {
+
+  const uint32_t *x = a;
+  const uint32_t *y = b;
+
+  return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+// Helper function-21: valid_block() - whether disk_num and block_num lie on a linear volume.
+// A volume striped across several JBODs has JBOD_NUM_DISKS disks for each of them.
+static bool valid_block(int disk_num, int block_num) {
+
+  // disk number between 0 and 15 per JBOD, block number between 0 and 255 (blocks of a disk,
+  // which happen to be as many as the bytes of a block)
+  return (disk_num >= 0) && (disk_num < JBOD_NUM_DISKS * LAYOUT_MAX_MEMBERS) &&
+         (block_num >= 0) && (block_num < JBOD_NUM_BLOCKS_PER_DISK);
+}
+
+// Helper function-22: update_entry() - updates the block of the entry with the data in 'buf'.
+// Returns 1 on success and -1 on failure.
+static int update_entry(cache_shard_t *s, int i, const uint8_t *buf) {
+
+  cache_entry_t *e = &s->entries[i];
+  int byte = uniform_byte(buf);
+  uint32_t hash = (byte == -1) ? content_hash(buf) : 0;
+
+  // Cache entry found ! An entry alone in holding its pool block rewrites it in place, unless
+  // the new data is pooled already
+  if ((byte == -1) && (has_flag(s, i, CACHE_ENTRY_UNIFORM) == false) && (s->pool_refs[e->block] == 1) &&
+      (pool_find(s, buf, hash) == -1)) {
+      write_begin(s);
+      pool_unlink(s, e->block);
+      memcpy(s->blocks[e->block], buf, JBOD_BLOCK_SIZE);
+      pool_link(s, e->block, hash);
+      write_end(s);
+  }
+  else {
+      if (make_room(s, i, false, buf, byte, hash) == -1)
+          return -1;
+
+      write_begin(s);
+      set_block(s, i, buf, byte, hash, true);
+      write_end(s);
+  }
+
+  touch_entry(s, i);		// Move the entry to the Most Recently Used end
+
+  return 1;
+}
+
+// Helper function-23: lock_all() / unlock_all() - take every shard lock, in shard order
+static void lock_all(cache_t *c) {
+  for (int k = 0; k < c->num_shards; k++)
+      pthread_mutex_lock(&c->shards[k].lock);
+}
+
+static void unlock_all(cache_t *c) {
+  for (int k = c->num_shards - 1; k >= 0; k--)
+      pthread_mutex_unlock(&c->shards[k].lock);
+}
+
+// Helper function-24: flush_entries() - writes all the dirty entries back; expects every shard lock
+// to be held
+static int flush_entries(cache_t *c) {
+
+  uint32_t (*dirty)[3] = malloc(c->size * sizeof(*dirty));
+  int num_dirty = 0;
+  int i, k, rc = 1;
+
+  if (dirty == NULL)
+      return -1;
+
+  for (k = 0; k < c->num_shards; k++) {
+      cache_shard_t *s = &c->shards[k];
+      for (i = 0; i < s->size; i++) {
+          if (((s->valid[i / 64] >> (i % 64)) & 1) && (has_flag(s, i, CACHE_ENTRY_DIRTY) == true)) {
+              dirty[num_dirty][0] = s->entries[i].key;
+              dirty[num_dirty][1] = k;
+              dirty[num_dirty][2] = i;
+              num_dirty++;
+          }
+      }
+  }
+
+  // Write back in disk & block order, so that consecutive blocks need no seek in between
+  qsort(dirty, num_dirty, sizeof(*dirty), compare_keys);
+
+  for (i = 0; i < num_dirty; i++) {
+      if (write_back_entry(&c->shards[dirty[i][1]], dirty[i][2]) == -1)
+          rc = -1;
+  }
+
+  free(dirty);
+  return rc;
+}
+
+// Helper function-25: sum_stat() - a statistic summed over the shards
+static long sum_stat(cache_t *c, size_t field) {
+
+  long sum = 0;
+
+  for (int k = 0; k < c->num_shards; k++)
+      sum += __atomic_load_n((long *) ((char *) &c->shards[k] + field), __ATOMIC_RELAXED);
+
+  return sum;
+}
+
+
+// Helper function-26: storage_stats() - number of blocks cached, of uniform ones, and of pool
+// blocks in use
+static void storage_stats(cache_t *c, long stats[3]) {
+
+  stats[0] = stats[1] = stats[2] = 0;
+
+  lock_all(c);
+
+  for (int k = 0; k < c->num_shards; k++) {
+      cache_shard_t *s = &c->shards[k];
+      for (int i = 0; i < s->size; i++) {
+          if ((s->valid[i / 64] >> (i % 64)) & 1) {
+              stats[0] += 1;
+              stats[1] += has_flag(s, i, CACHE_ENTRY_UNIFORM);
+          }
+      }
+      stats[2] += s->pool_used;
+  }
+
+  unlock_all(c);
+}
+
+// Helper function-27: add_stats() - adds the statistics of 'from' to 'into'
+static void add_stats(cache_stats_t *into, const cache_stats_t *from) {
+
+  into->lookups += from->lookups;
+  into->hits += from->hits;
+  into->misses += from->misses;
+  into->inserts += from->inserts;
+  into->evictions += from->evictions;
+  into->writebacks += from->writebacks;
+  into->prefetched += from->prefetched;
+  into->prefetch_hits += from->prefetch_hits;
+  into->prefetch_wasted += from->prefetch_wasted;
+  into->restored += from->restored;
+}
+
+
+//// GHOST Functions - keys of recently evicted blocks (2Q, ARC)
+
+// ghost_find() - the ghost of the block 'key', or -1
+static int ghost_find(cache_shard_t *s, uint32_t key) {
+
+  int g;
+
+  for (g = s->ghost_heads[(int) ((key * 2654435761u) >> 16) & s->ghost_mask]; g != -1; g = s->ghosts[g].hash_next) {
+      if (s->ghosts[g].key == key)
+          return g;
+  }
+
+  return -1;
+}
+
+// ghost_remove() - forgets a ghost
+static void ghost_remove(cache_shard_t *s, int g) {
+
+  cache_ghost_t *h = &s->ghosts[g];
+  cache_queue_t *q = &s->ghost_queues[h->queue];
+
+  if (h->prev != -1)
+      s->ghosts[h->prev].next = h->next;
+  else
+      q->head = h->next;
+
+  if (h->next != -1)
+      s->ghosts[h->next].prev = h->prev;
+  else
+      q->tail = h->prev;
+
+  q->len -= 1;
+
+  int *link = &s->ghost_heads[(int) ((h->key * 2654435761u) >> 16) & s->ghost_mask];
+  while (*link != g)
+      link = &s->ghosts[*link].hash_next;
+  *link = h->hash_next;
+
+  h->hash_next = s->ghost_free;
+  s->ghost_free = g;
+}
+
+// ghost_add() - remembers the block 'key' at the head of a ghost queue
+static void ghost_add(cache_shard_t *s, int queue, uint32_t key) {
+
+  // Out of ghosts: the oldest one of the longest queue goes
+  if (s->ghost_free == -1) {
+      int longest = (s->ghost_queues[0].len >= s->ghost_queues[1].len) ? 0 : 1;
+      ghost_remove(s, s->ghost_queues[longest].tail);
+  }
+
+  int g = s->ghost_free;
+  cache_ghost_t *h = &s->ghosts[g];
+  cache_queue_t *q = &s->ghost_queues[queue];
+
+  s->ghost_free = h->hash_next;
+
+  int *head = &s->ghost_heads[(int) ((key * 2654435761u) >> 16) & s->ghost_mask];
+  h->key = key;
+  h->hash_next = *head;
+  *head = g;
+
+  h->queue = queue;
+  h->prev = -1;
+  h->next = q->head;
+  if (q->head != -1)
+      s->ghosts[q->head].prev = g;
+  else
+      q->tail = g;
+  q->head = g;
+  q->len += 1;
+}
+
+// ghost_trim() - forgets the oldest ghosts of a queue beyond 'max_len'
+static void ghost_trim(cache_shard_t *s, int queue, int max_len) {
+  while (s->ghost_queues[queue].len > max_len)
+      ghost_remove(s, s->ghost_queues[queue].tail);
+}
+
+// entry_key() - linear block number held by an entry
+static uint32_t entry_key(cache_shard_t *s, int i) {
+  return s->entries[i].key;
+}
+
+
+//// EVICTION POLICIES - each one behind cache_policy_ops_t
+
+// Shared by the policies: an evicted entry leaves its queue, a new one joins the 'incoming' queue,
+// and a used entry moves to the head of its queue
+static void queue_evict(cache_shard_t *s, int i) {
+  queue_unlink(s, i);
+}
+
+static void queue_insert(cache_shard_t *s, int i) {
+  queue_push(s, s->incoming, i);
+}
+
+static void queue_hit(cache_shard_t *s, int i) {
+  if (s->queues[s->entries[i].queue].head != i) {
+      int queue = s->entries[i].queue;
+      queue_unlink(s, i);
+      queue_push(s, queue, i);
+  }
+}
+
+// LRU: one queue in recency order; the Least Recently Used entry at the tail goes
+static void lru_miss(cache_shard_t *s, uint32_t key) {
+  (void) key;
+  s->incoming = 0;
+}
+
+static int lru_victim(cache_shard_t *s) {
+  return s->queues[0].tail;
+}
+
+// CLOCK: one queue in insertion order with the hand at the tail. A used entry is only flagged;
+// the hand moves flagged entries to the head, clearing the flag, until it finds one to evict.
+static int clock_victim(cache_shard_t *s) {
+
+  int i = s->queues[0].tail;
+
+  while (clear_flag(s, i, CACHE_ENTRY_SECOND_CHANCE) == true) {
+      queue_unlink(s, i);
+      queue_push(s, 0, i);
+      i = s->queues[0].tail;
+  }
+
+  return i;
+}
+
+static void clock_hit(cache_shard_t *s, int i) {
+  set_flag(s, i, CACHE_ENTRY_SECOND_CHANCE);
+}
+
+// 2Q: a block enters A1in (queue 1, FIFO); only a block seen again after falling out of A1in,
+// while its ghost is still in A1out (ghost queue 0), enters Am (queue 0, LRU). A scan flows
+// through A1in and never pushes the hot blocks out of Am.
+#define TWOQ_AM 0
+#define TWOQ_A1IN 1
+#define TWOQ_A1OUT 0
+
+static void twoq_miss(cache_shard_t *s, uint32_t key) {
+
+  int g = ghost_find(s, key);
+
+  if (g != -1) {
+      ghost_remove(s, g);
+      s->incoming = TWOQ_AM;
+  }
+  else
+      s->incoming = TWOQ_A1IN;
+}
+
+static int twoq_victim(cache_shard_t *s) {
+
+  // A1in keeps a quarter of the entries
+  int kin = (s->size / 4 > 1) ? s->size / 4 : 1;
+
+  if ((s->queues[TWOQ_A1IN].len > kin) || (s->queues[TWOQ_AM].len == 0))
+      return s->queues[TWOQ_A1IN].tail;
+
+  return s->queues[TWOQ_AM].tail;
+}
+
+static void twoq_evict(cache_shard_t *s, int i) {
+
+  // A1out remembers half as many blocks as there are entries
+  if (s->entries[i].queue == TWOQ_A1IN) {
+      ghost_add(s, TWOQ_A1OUT, entry_key(s, i));
+      ghost_trim(s, TWOQ_A1OUT, (s->size / 2 > 1) ? s->size / 2 : 1);
+  }
+
+  queue_unlink(s, i);
+}
+
+static void twoq_hit(cache_shard_t *s, int i) {
+  // Blocks in A1in stay in FIFO order
+  if (s->entries[i].queue == TWOQ_AM)
+      queue_hit(s, i);
+}
+
+// ARC: T1 (queue 1) holds blocks seen once, T2 (queue 0) blocks seen again; B1 and B2 (ghost
+// queues 0 and 1) remember what each of them evicted. A miss found in B1 grows the target length
+// of T1, one found in B2 shrinks it, so the split follows whichever would have hit.
+#define ARC_T2 0
+#define ARC_T1 1
+#define ARC_B1 0
+#define ARC_B2 1
+
+static void arc_miss(cache_shard_t *s, uint32_t key) {
+
+  int g = ghost_find(s, key);
+  int b1 = s->ghost_queues[ARC_B1].len;
+  int b2 = s->ghost_queues[ARC_B2].len;
+
+  s->incoming = ARC_T1;
+  s->from_b2 = false;
+
+  if (g == -1)
+      return;
+
+  if (s->ghosts[g].queue == ARC_B1) {
+      int step = (b2 / b1 > 1) ? b2 / b1 : 1;
+      s->target = (s->target + step < s->size) ? s->target + step : s->size;
+  }
+  else {
+      int step = (b1 / b2 > 1) ? b1 / b2 : 1;
+      s->target = (s->target - step > 0) ? s->target - step : 0;
+      s->from_b2 = true;
+  }
+
+  ghost_remove(s, g);
+  s->incoming = ARC_T2;
+}
+
+static int arc_victim(cache_shard_t *s) {
+
+  int t1 = s->queues[ARC_T1].len;
+
+  if ((t1 > 0) && ((t1 > s->target) || ((s->from_b2 == true) && (t1 == s->target)) ||
+                   (s->queues[ARC_T2].len == 0)))
+      return s->queues[ARC_T1].tail;
+
+  return s->queues[ARC_T2].tail;
+}
+
+static void arc_evict(cache_shard_t *s, int i) {
+  ghost_add(s, (s->entries[i].queue == ARC_T1) ? ARC_B1 : ARC_B2, entry_key(s, i));
+  queue_unlink(s, i);
+}
+
+static void arc_insert(cache_shard_t *s, int i) {
+
+  queue_push(s, s->incoming, i);
+
+  // T1 and B1 together hold at most as many blocks as there are entries; all four lists twice that
+  ghost_trim(s, ARC_B1, (s->size - s->queues[ARC_T1].len > 0) ? s->size - s->queues[ARC_T1].len : 0);
+
+  while (s->queues[ARC_T1].len + s->queues[ARC_T2].len +
+         s->ghost_queues[ARC_B1].len + s->ghost_queues[ARC_B2].len > 2 * s->size)
+      ghost_remove(s, s->ghost_queues[(s->ghost_queues[ARC_B2].len > 0) ? ARC_B2 : ARC_B1].tail);
+}
+
+static void arc_hit(cache_shard_t *s, int i) {
+  // A block seen again belongs to T2
+  if (s->queues[ARC_T2].head != i) {
+      queue_unlink(s, i);
+      queue_push(s, ARC_T2, i);
+  }
+}
+
+static const cache_policy_ops_t policies[CACHE_NUM_POLICIES] = {
+  [CACHE_LRU] = { "lru", lru_miss, lru_victim, queue_evict, queue_insert, queue_hit },
+  [CACHE_CLOCK] = { "clock", lru_miss, clock_victim, queue_evict, queue_insert, clock_hit },
+  [CACHE_2Q] = { "2q", twoq_miss, twoq_victim, twoq_evict, queue_insert, twoq_hit },
+  [CACHE_ARC] = { "arc", arc_miss, arc_victim, arc_evict, arc_insert, arc_hit },
+};
+
+
+//// SNAPSHOT Functions - the cached blocks saved to a file, and taken in again lazily
+
+// snapshot_sum() - checksum of 'len' bytes, carried on from 'sum'
+static uint64_t snapshot_sum(uint64_t sum, const void *data, size_t len) {
+
+  const uint8_t *p = data;
+  uint64_t word;
+  size_t k;
+
+  for (k = 0; k + sizeof(word) <= len; k += sizeof(word)) {
+      memcpy(&word, p + k, sizeof(word));
+      sum = (sum ^ word) * 0x9E3779B97F4A7C15ull;
+      sum ^= sum >> 29;
+  }
+
+  for (; k < len; k++)
+      sum = (sum ^ p[k]) * 0x100000001B3ull;
+
+  return sum;
+}
+
+// snapshot_keys_size() / snapshot_blocks_offset() - where the parts of a file of 'num' records lie
+static size_t snapshot_keys_size(uint32_t num) {
+  return (num * sizeof(uint16_t) + 7) & ~(size_t) 7;
+}
+
+static size_t snapshot_blocks_offset(uint32_t num) {
+  size_t end = sizeof(snapshot_header_t) + snapshot_keys_size(num) + num * sizeof(uint64_t);
+  return (end + SNAPSHOT_ALIGN - 1) & ~(size_t) (SNAPSHOT_ALIGN - 1);
+}
+
+// snapshot_header_sum() - checksum of a header, and of the keys and block checksums after it
+static uint64_t snapshot_header_sum(const snapshot_header_t *h, const uint16_t *keys, const uint64_t *sums) {
+
+  snapshot_header_t copy = *h;
+  copy.checksum = 0;
+
+  uint64_t sum = snapshot_sum(0, &copy, sizeof(copy));
+  sum = snapshot_sum(sum, keys, snapshot_keys_size(h->num_records));
+  return snapshot_sum(sum, sums, h->num_records * sizeof(uint64_t));
+}
+
+// snapshot_open() - maps the file 'path', if it is a valid snapshot of the Cache's volume
+// generation, and admits its records, most recent first, while their shards have room for them.
+// A missing or stale file leaves the Cache cold.
+static void snapshot_open(cache_t *c, const char *path) {
+
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  if (fd == -1)
+      return;
+
+  if ((fstat(fd, &st) == -1) || (st.st_size < (off_t) sizeof(snapshot_header_t))) {
+      close(fd);
+      return;
+  }
+
+  uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+      return;
+
+  const snapshot_header_t *h = (const snapshot_header_t *) map;
+  const uint16_t *keys = (const uint16_t *) (map + sizeof(*h));
+  const uint64_t *sums = (const uint64_t *) (map + sizeof(*h) + snapshot_keys_size(h->num_records));
+
+  // Another format or volume generation, or a file cut short or damaged (the sizes are checked
+  // before the checksum reads past the header). Generation 0 is a volume nobody keeps track of,
+  // which matches no snapshot, not even one saved at 0.
+  bool valid = (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) == 0) && (h->version == SNAPSHOT_VERSION) &&
+               (h->block_size == JBOD_BLOCK_SIZE) && (c->generation != 0) && (h->generation == c->generation) &&
+               (h->num_records <= CACHE_MAX_POOLED_ENTRIES) &&
+               (h->blocks_offset == snapshot_blocks_offset(h->num_records)) &&
+               ((size_t) st.st_size == h->blocks_offset + (size_t) h->num_records * JBOD_BLOCK_SIZE) &&
+               (snapshot_header_sum(h, keys, sums) == h->checksum);
+
+  int *room = calloc(c->num_shards, sizeof(int));
+  c->snap_records = malloc(CACHE_MAX_POOLED_ENTRIES * sizeof(int32_t));
+
+  if ((valid == false) || (room == NULL) || (c->snap_records == NULL)) {
+      free(room);
+      free(c->snap_records);
+      c->snap_records = NULL;
+      munmap(map, st.st_size);
+      return;
+  }
+
+  int k, r;
+
+  for (r = 0; r < CACHE_MAX_POOLED_ENTRIES; r++)
+      c->snap_records[r] = -1;
+  for (k = 0; k < c->num_shards; k++)
+      room[k] = c->shards[k].size;
+
+  // The blocks a smaller Cache has no room for are left out, as the least recent of their shard
+  for (r = 0; r < (int) h->num_records; r++) {
+      k = shard_of(c, keys[r]) - c->shards;
+      if ((c->snap_records[keys[r]] == -1) && (room[k] > 0)) {
+          c->snap_records[keys[r]] = r;
+          room[k] -= 1;
+      }
+  }
+
+  free(room);
+
+  c->snap_map = map;
+  c->snap_len = st.st_size;
+  c->snap_keys = keys;
+  c->snap_sums = sums;
+  c->snap_blocks = (const uint8_t (*)[JBOD_BLOCK_SIZE]) (map + h->blocks_offset);
+  c->snap_num = h->num_records;
+}
+
+// snapshot_claim() - claims the record of the block 'key', if it has one; when 'buf' is not NULL,
+// copies the block of the record there, unless its checksum fails. Expects the lock of the block's
+// shard to be held. Returns 1 when the block was copied, and -1 otherwise.
+static int snapshot_claim(cache_t *c, uint16_t key, uint8_t *buf) {
+
+  if (c->snap_records == NULL)
+      return -1;
+
+  // Lock-free lookups peek at the records, so the claim is atomic
+  int r = __atomic_exchange_n(&c->snap_records[key], -1, __ATOMIC_RELAXED);
+
+  if ((r == -1) || (buf == NULL))
+      return -1;
+
+  if (snapshot_sum(0, c->snap_blocks[r], JBOD_BLOCK_SIZE) != c->snap_sums[r])
+      return -1;
+
+  memcpy(buf, c->snap_blocks[r], JBOD_BLOCK_SIZE);
+  return 1;
+}
+
+// snapshot_restore() - takes the block 'key' in from the snapshot into 'buf' and the shard, on a
+// miss; counts it as a hit. Expects the shard lock to be held. Returns 1 on success, -1 otherwise.
+static int snapshot_restore(cache_shard_t *s, uint16_t key, uint8_t *buf) {
+
+  if (snapshot_claim(s->cache, key, buf) == -1)
+      return -1;
+
+  // The block was read already; a shard that cannot take it in still serves the lookup
+  new_entry(s, key, buf);
+
+  __atomic_add_fetch(&s->num_restored, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&s->num_hits, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// snapshot_write() - writes the cached blocks, most recently used first, and the unclaimed records
+// of the Cache's own snapshot to 'path'; expects every shard lock to be held. Returns 1 on success
+// and -1 on failure.
+static int snapshot_write(cache_t *c, const char *path, uint64_t generation) {
+
+  // The records, as (order, shard, entry) triples; records of the old snapshot have the shard
+  // num_shards, and come after the cached blocks
+  uint32_t (*order)[3] = malloc((c->size + c->snap_num) * sizeof(*order));
+  uint16_t *keys = calloc(c->size + c->snap_num + 4, sizeof(uint16_t));
+  uint64_t *sums = malloc((c->size + c->snap_num) * sizeof(uint64_t));
+  uint8_t block[JBOD_BLOCK_SIZE];
+  char tmp[4096];
+  int num = 0, i, k;
+
+  if ((order == NULL) || (keys == NULL) || (sums == NULL) ||
+      (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp))) {
+      free(order);
+      free(keys);
+      free(sums);
+      return -1;
+  }
+
+  for (k = 0; k < c->num_shards; k++) {
+      cache_shard_t *s = &c->shards[k];
+      for (i = 0; i < s->size; i++) {
+          if ((s->valid[i / 64] >> (i % 64)) & 1) {
+              order[num][0] = UINT32_MAX - (uint32_t) s->entries[i].access_time;
+              order[num][1] = k;
+              order[num][2] = i;
+              num++;
+          }
+      }
+  }
+
+  qsort(order, num, sizeof(*order), compare_keys);
+
+  // A record is unclaimed as long as its block is not cached, and still holds what the volume does
+  for (i = 0; i < c->snap_num; i++) {
+      if ((c->snap_records != NULL) && (c->snap_records[c->snap_keys[i]] == i) &&
+          (snapshot_sum(0, c->snap_blocks[i], JBOD_BLOCK_SIZE) == c->snap_sums[i])) {
+          order[num][1] = c->num_shards;
+          order[num][2] = i;
+          num++;
+      }
+  }
+
+  // First pass: the keys and the checksums of the blocks, which the header checksum covers
+  for (i = 0; i < num; i++) {
+      if (order[i][1] == (uint32_t) c->num_shards) {
+          keys[i] = c->snap_keys[order[i][2]];
+          sums[i] = c->snap_sums[order[i][2]];
+      }
+      else {
+          cache_shard_t *s = &c->shards[order[i][1]];
+          keys[i] = s->entries[order[i][2]].key;
+          copy_block(s, order[i][2], block);
+          sums[i] = snapshot_sum(0, block, JBOD_BLOCK_SIZE);
+      }
+  }
+
+  snapshot_header_t h = {
+      .magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION, .block_size = JBOD_BLOCK_SIZE,
+      .generation = generation, .num_records = num, .blocks_offset = snapshot_blocks_offset(num),
+  };
+  h.checksum = snapshot_header_sum(&h, keys, sums);
+
+  // Second pass: the file, written aside and renamed over the old one, so that a crash leaves
+  // either of them whole
+  FILE *f = fopen(tmp, "wb");
+  bool ok = (f != NULL) && (fwrite(&h, sizeof(h), 1, f) == 1) &&
+            ((num == 0) || ((fwrite(keys, snapshot_keys_size(num), 1, f) == 1) &&
+                            (fwrite(sums, num * sizeof(uint64_t), 1, f) == 1)));
+
+  memset(block, 0, sizeof(block));
+  for (size_t pos = sizeof(h) + snapshot_keys_size(num) + num * sizeof(uint64_t); ok && (pos < h.blocks_offset);
+       pos += JBOD_BLOCK_SIZE) {
+      size_t len = (h.blocks_offset - pos < JBOD_BLOCK_SIZE) ? h.blocks_offset - pos : JBOD_BLOCK_SIZE;
+      ok = (fwrite(block, len, 1, f) == 1);
+  }
+
+  for (i = 0; ok && (i < num); i++) {
+      if (order[i][1] == (uint32_t) c->num_shards)
+          memcpy(block, c->snap_blocks[order[i][2]], JBOD_BLOCK_SIZE);
+      else
+          copy_block(&c->shards[order[i][1]], order[i][2], block);
+      ok = (fwrite(block, JBOD_BLOCK_SIZE, 1, f) == 1);
+  }
+
+  if ((f != NULL) && (fclose(f) != 0))
+      ok = false;
+  if ((ok == true) && (rename(tmp, path) == -1))
+      ok = false;
+  if ((ok == false) && (f != NULL))
+      unlink(tmp);
+
+  free(order);
+  free(keys);
+  free(sums);
+  return (ok == true) ? 1 : -1;
+}
+
+
+//// SHARD Functions
+
+// shard_init() - sets up a shard over 'size' entries and a pool of 'pool_size' blocks; returns 0
+// on success and -1 on failure
+static int shard_init(cache_shard_t *s, cache_t *c, cache_entry_t *entries, int size,
+                      uint8_t (*blocks)[JBOD_BLOCK_SIZE], int pool_size) {
+
+  int i;
+
+  s->cache = c;
+  s->entries = entries;
+  s->size = size;
+  s->blocks = blocks;
+  s->pool_size = pool_size;
+
+  // Size the index to at least twice as many slots as entries, so that groups rarely fill up,
+  // and the ghost and pool hash tables to twice as many buckets as entries and blocks
+  int num_groups = 1, num_buckets = 1, num_pool_buckets = 1;
+  while (num_groups * GROUP_SLOTS < 2 * s->size)
+      num_groups <<= 1;
+  while (num_buckets < 2 * s->size)
+      num_buckets <<= 1;
+  while (num_pool_buckets < 2 * s->pool_size)
+      num_pool_buckets <<= 1;
+
+  // One ghost more than the entries covers what ARC remembers on top of a full shard
+  s->num_ghosts = s->size + 1;
+  s->valid = calloc((s->size + 63) / 64, sizeof(uint64_t));
+  s->groups = aligned_alloc(64, num_groups * sizeof(cache_group_t));
+  s->ghost_heads = malloc(num_buckets * sizeof(int));
+  s->ghosts = calloc(s->num_ghosts, sizeof(cache_ghost_t));
+  s->pool_refs = calloc(s->pool_size, sizeof(uint32_t));
+  s->pool_hash = calloc(s->pool_size, sizeof(uint32_t));
+  s->pool_next = malloc(s->pool_size * sizeof(int));
+  s->pool_heads = malloc(num_pool_buckets * sizeof(int));
+
+  if ((s->valid == NULL) || (s->groups == NULL) || (s->ghost_heads == NULL) || (s->ghosts == NULL) ||
+      (s->pool_refs == NULL) || (s->pool_hash == NULL) || (s->pool_next == NULL) || (s->pool_heads == NULL)) {
+      free(s->valid);
+      free(s->groups);
+      free(s->ghost_heads);
+      free(s->ghosts);
+      free(s->pool_refs);
+      free(s->pool_hash);
+      free(s->pool_next);
+      free(s->pool_heads);
+      return -1;
+  }
+
+  s->group_mask = num_groups - 1;
+  s->ghost_mask = num_buckets - 1;
+  s->pool_mask = num_pool_buckets - 1;
+
+  // The index starts out empty, and so do the ghost hash buckets
+  memset(s->groups, 0, num_groups * sizeof(cache_group_t));
+  for (i = 0; i < num_buckets; i++)
+      s->ghost_heads[i] = -1;
+
+  // Chain all the cache entries on the free list
+  for (i = 0; i < s->size; i++) {
+      s->entries[i].lru_prev = -1;
+      s->entries[i].lru_next = (i + 1 < s->size) ? i + 1 : -1;
+  }
+
+  for (i = 0; i < s->num_ghosts; i++)
+      s->ghosts[i].hash_next = (i + 1 < s->num_ghosts) ? i + 1 : -1;
+
+  // All the pool blocks start out free
+  for (i = 0; i < num_pool_buckets; i++)
+      s->pool_heads[i] = -1;
+  for (i = 0; i < s->pool_size; i++)
+      s->pool_next[i] = (i + 1 < s->pool_size) ? i + 1 : -1;
+
+  s->free_head = 0;
+  s->ghost_free = 0;
+  s->pool_free = 0;
+  for (i = 0; i < 2; i++) {
+      s->queues[i] = (cache_queue_t) { .head = -1, .tail = -1, .len = 0 };
+      s->ghost_queues[i] = (cache_queue_t) { .head = -1, .tail = -1, .len = 0 };
+  }
+
+  pthread_mutex_init(&s->lock, NULL);
+  return 0;
+}
+
+// shard_free() - frees what shard_init() allocated
+static void shard_free(cache_shard_t *s) {
+  pthread_mutex_destroy(&s->lock);
+  free(s->valid);
+  free(s->groups);
+  free(s->ghost_heads);
+  free(s->ghosts);
+  free(s->pool_refs);
+  free(s->pool_hash);
+  free(s->pool_next);
+  free(s->pool_heads);
+}
+
+
+//// Cache NEW Function - Creates a Cache with the options in 'config'; returns NULL on Failure
+cache_t *cache_new(const cache_config_t *config) {
+
+  if (config == NULL)
+      return NULL;
+
+  int num_entries = config->num_entries;
+  int num_shards = (config->num_shards > 0) ? config->num_shards : 1;
+  int num_blocks = (config->num_blocks > 0) ? config->num_blocks : num_entries;
+
+  // Return NULL, if number of Cache entries to be created is Less than the Minimum entries required.
+  if (num_entries < MIN_NUM_ENTRIES)
+      return NULL;
+
+  // Return NULL, if number of Cache entries to be created is More than the Maximum possible entries.
+  // Entries sharing a pool are only bounded by the blocks there are.
+  if (num_entries > ((config->num_blocks > 0) ? CACHE_MAX_POOLED_ENTRIES : MAX_NUM_ENTRIES))
+      return NULL;
+
+  if ((num_blocks < MIN_NUM_ENTRIES) || (num_blocks > MAX_NUM_ENTRIES))
+      return NULL;
+
+  if ((config->policy < 0) || (config->policy >= CACHE_NUM_POLICIES))
+      return NULL;
+
+  // A power of 2 of shards, each with at least the Minimum entries and pool blocks
+  if ((num_shards > CACHE_MAX_SHARDS) || ((num_shards & (num_shards - 1)) != 0) ||
+      (num_entries / num_shards < MIN_NUM_ENTRIES) || (num_blocks / num_shards < MIN_NUM_ENTRIES))
+      return NULL;
+
+  // Dynamically allocate space for the Cache, its entries, their block pools, and its shards. The
+  // pools are a slab of their own, so that the entries stay dense.
+  cache_t *c = calloc(1, sizeof(cache_t));
+  if (c == NULL)
+      return NULL;
+
+  c->entries = calloc(num_entries, sizeof(cache_entry_t));
+  c->blocks = aligned_alloc(64, num_blocks * JBOD_BLOCK_SIZE);
+  c->shards = aligned_alloc(64, num_shards * sizeof(cache_shard_t));
+
+  if ((c->entries == NULL) || (c->blocks == NULL) || (c->shards == NULL)) {
+      free(c->entries);
+      free(c->blocks);
+      free(c->shards);
+      free(c);
+      return NULL;
+  }
+
+  // set the size of the Cache to the number of cache entries
+  c->size = num_entries;
+  c->num_shards = num_shards;
+  c->lockless = (num_shards > 1);
+  c->pooled = (config->num_blocks > 0);
+  c->write_back = config->write_back;
+  c->policy = &policies[config->policy];
+  memset(c->shards, 0, num_shards * sizeof(cache_shard_t));
+
+  int k, first = 0, first_block = 0;
+
+  for (k = 0; k < num_shards; k++) {
+
+      // The entries and pool blocks are split as evenly as possible
+      int size = num_entries / num_shards + ((k < num_entries % num_shards) ? 1 : 0);
+      int pool_size = num_blocks / num_shards + ((k < num_blocks % num_shards) ? 1 : 0);
+
+      if (shard_init(&c->shards[k], c, &c->entries[first], size, &c->blocks[first_block], pool_size) == -1) {
+          while (--k >= 0)
+              shard_free(&c->shards[k]);
+          free(c->entries);
+          free(c->blocks);
+          free(c->shards);
+          free(c);
+          return NULL;
+      }
+
+      first += size;
+      first_block += pool_size;
+  }
+
+  // Warm the Cache from its snapshot, which it is saved to again when freed
+  if (config->snapshot != NULL) {
+      c->snapshot = strdup(config->snapshot);
+      c->generation = config->generation;
+      if (c->snapshot == NULL) {
+          cache_free(c);
+          return NULL;
+      }
+      snapshot_open(c, c->snapshot);
+  }
+
+  return c;
+}
+
+
+//// Cache FREE Function - Flushes the dirty entries and frees the Cache
+int cache_free(cache_t *c) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  if (c == NULL)
+      return -1;
+
+  // Write the dirty entries back, so that no written data is lost, and save the snapshot
+  lock_all(c);
+  flush_entries(c);
+  if (c->snapshot != NULL)
+      snapshot_write(c, c->snapshot, c->generation);
+  unlock_all(c);
+
+  for (int k = 0; k < c->num_shards; k++)
+      shard_free(&c->shards[k]);
+
+  if (c->snap_map != NULL)
+      munmap(c->snap_map, c->snap_len);
+
+  free(c->snap_records);
+  free(c->snapshot);
+  free(c->entries);
+  free(c->blocks);
+  free(c->shards);
+  free(c);
+
+  return 1;
+}
+
+
+//// Cache LOOKUP Function - Looks up the Block identified by disk_num and block_num in the Cache.
+int cache_lookup_in(cache_t *c, int disk_num, int block_num, uint8_t *buf) {
 
   // This function to return 1 on Success and -1 on Failure
 
-  // Return -1, if Cache is already created
-  if ((cache != NULL) || (cache_size != 0))
-       return -1;
+  //// Validate Input parameters
 
-  // Return -1, if number of Cache entries to be created is Less than the Minimum entries required.
-  if (num_entries < MIN_NUM_ENTRIES)
+  // Return -1, if no Cache exist
+  if (c == NULL)
       return -1;
 
-  // Return -1, if number of Cache entries to be created is More than the Maximum possible entries.
-  if (num_entries > MAX_NUM_ENTRIES)
+  if (buf == NULL)
       return -1;
 
-  // Dynamically allocate space for the required number of entries in cache
-  cache = calloc(num_entries, sizeof(cache_entry_t));
+  // A block off the volume has no key, and is never cached
+  if (valid_block(disk_num, block_num) == false)
+      return -1;
 
-  // set the size of the Cache i.e. 'cache_size' to the number of cache entries
-  cache_size = num_entries;
+  uint16_t key = block_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(c, key);
 
-  int i;
+  __atomic_add_fetch(&s->num_queries, 1, __ATOMIC_RELAXED); 	// On every Lookup call, increment 'num_queries'
 
-  // Initialize the validity of the created cache entries
-  for (i = 0; i < cache_size; i++)
-      cache[i].valid = false;
-  
-  // return 1 on Success
+  // Lock-free lookup: readers never wait for each other; the entry is only marked referenced
+  if (c->lockless == true) {
+
+      int i = read_entry(s, key, buf);
+
+      // A miss of a block the snapshot still holds takes it in, under the shard lock
+      if ((i == -1) && (c->snap_records != NULL) && (__atomic_load_n(&c->snap_records[key], __ATOMIC_RELAXED) != -1)) {
+          pthread_mutex_lock(&s->lock);
+          int rc = snapshot_restore(s, key, buf);
+          pthread_mutex_unlock(&s->lock);
+          return rc;
+      }
+
+      if (i == -1)
+          return -1;
+
+      __atomic_add_fetch(&s->num_hits, 1, __ATOMIC_RELAXED);
+      set_flag(s, i, CACHE_ENTRY_REFERENCED);
+      if (clear_flag(s, i, CACHE_ENTRY_PREFETCHED) == true)
+          __atomic_add_fetch(&s->num_prefetch_hits, 1, __ATOMIC_RELAXED);
+
+      return 1;
+  }
+
+  pthread_mutex_lock(&s->lock);
+
+  // Lookup the Block identified by disk_num and block_num through the index
+  int i = find_entry(s, key);
+
+  // When the Lookup is Unsuccessful, return -1, unless the block comes from the snapshot
+  if (i == -1) {
+      int rc = snapshot_restore(s, key, buf);
+      pthread_mutex_unlock(&s->lock);
+      return rc;
+  }
+
+  // Lookup Success! Found a valid Cache ! Identified by keys: disk_num and block_num
+  copy_block(s, i, buf);	// Copy data from block to buffer 'buf'
+
+  touch_entry(s, i);		// Move the entry to the Most Recently Used end
+
+  __atomic_add_fetch(&s->num_hits, 1, __ATOMIC_RELAXED);	// On success, increment 'num_hits'
+
+  // The first lookup of a prefetched block is what readahead was for
+  if (clear_flag(s, i, CACHE_ENTRY_PREFETCHED) == true)
+      __atomic_add_fetch(&s->num_prefetch_hits, 1, __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock(&s->lock);
+
+  // On success, return 1
   return 1;
-  
+
 }
 
 
-//// Cache DESTROY Function - Frees the dynamic space allocated for Cache
-int cache_destroy(void) {
+//// Cache CONTAINS Function - Checks for the Block without touching the statistics or recency
+bool cache_contains_in(cache_t *c, int disk_num, int block_num) {
+
+  // Return false, if no Cache exist
+  if ((c == NULL) || (valid_block(disk_num, block_num) == false))
+      return false;
+
+  uint16_t key = block_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(c, key);
+
+  if (c->lockless == true)
+      return read_entry(s, key, NULL) != -1;
+
+  pthread_mutex_lock(&s->lock);
+  bool found = find_entry(s, key) != -1;
+  pthread_mutex_unlock(&s->lock);
+
+  return found;
+}
+
+
+//// Cache PEEK Function - Copies the Block out without touching the statistics or recency
+int cache_peek_in(cache_t *c, int disk_num, int block_num, uint8_t *buf) {
 
   // This function to return 1 on Success and -1 on Failure
 
-  // Return -1, if no Cache exist
-  if ((cache == NULL) || (cache_size == 0))
+  if ((c == NULL) || (buf == NULL) || (valid_block(disk_num, block_num) == false))
       return -1;
-  
-  // Free the dynamically allocated space
-  free(cache);
-  
-  // set size of Cache to zero, and set the cache to NULL
-  cache_size = 0;
-  cache = NULL;
 
-  // return 1 on Success
-  return 1;
-  
+  uint16_t key = block_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(c, key);
+
+  if (c->lockless == true)
+      return (read_entry(s, key, buf) != -1) ? 1 : -1;
+
+  pthread_mutex_lock(&s->lock);
+  int i = find_entry(s, key);
+  if (i != -1)
+      copy_block(s, i, buf);
+  pthread_mutex_unlock(&s->lock);
+
+  return (i != -1) ? 1 : -1;
 }
 
 
-//// Cache LOOKUP Function - Looks up the Block identified by disk_num and block_num in the Cache.
-int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
+//// Cache INSERT Function
+//// Insert the block identified by disk_num and block_num into the Cache
+int cache_insert_in(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
 
   // This function to return 1 on Success and -1 on Failure
 
   //// Validate Input parameters
 
+  if (buf == NULL)
+      return -1;
+
   // Return -1, if no Cache exist
-  if ((cache == NULL) || (cache_size == 0))
+  if (c == NULL)
       return -1;
 
-  if (buf == NULL)
+  // Return -1, if disk number or block number is out of range
+  if (valid_block(disk_num, block_num) == false)
       return -1;
 
-  num_queries += 1; 	// On every Lookup call, increment the global variable 'num_queries'
-  
-  int i;
+  int rc = 1;
+  uint16_t key = block_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(c, key);
 
-  for (i = 0; i < cache_size; i++) {
+  pthread_mutex_lock(&s->lock);
 
-      // Lookup the Block identified by disk_num and block_num, & check the validity of cache entry
-      if ((cache[i].disk_num == disk_num) && (cache[i].block_num == block_num) && (cache[i].valid == true)) {
+  // The snapshot's copy of a block changed or read again is stale from now on
+  snapshot_claim(c, key, NULL);
 
-    	  // Lookup Success! Found a valid Cache ! Identified by keys: disk_num and block_num
-    	  if (cache[i].block != NULL )
-    	      memcpy(buf, cache[i].block, JBOD_BLOCK_SIZE); // Copy data from block to buffer 'buf'
+  // When there is a cache entry, "Update the block" identified by disk_num and block_num
+  int i = find_entry(s, key);
 
-	  clock += 1;			// On success, increment the global variable 'clock'
-	  cache[i].access_time = clock; // set access_time field to indicate recent use of entry
-	  cache[i].valid = true;	// set 'valid' field to indicate the cache entry as valid
+  if (i != -1) {
 
-	  num_hits += 1;		// On success, increment the global variable 'num_hits'
+      uint8_t block[JBOD_BLOCK_SIZE];
+      copy_block(s, i, block);
 
-	  // On success, return 1
-	  return 1;
-      }
+      // Return -1, if this same cache block data is already existing in the Cache
+      if (memcmp(block, buf, JBOD_BLOCK_SIZE) == 0)
+          rc = -1;
+      else
+          rc = update_entry(s, i, buf);
+  }
 
-  } // end-of For Loop
+  // When there is no entry identified by disk_num and block_num in the Cache,
+  // then, "Insert the block" into the Cache
+  else if (new_entry(s, key, buf) == -1)
+      rc = -1;
+
+  pthread_mutex_unlock(&s->lock);
+
+  return rc;
 
-  // When the Lookup is Unsuccessful, return -1
-  return -1;
-  
 }
 
 
-//// Cache INSERT Function
-//// Insert the block identified by disk_num and block_num into the Cache
-int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
-  
+//// Cache UPDATE Function
+//// When the entry exist in Cache, Update its block content with the new data in 'buf'
+void cache_update_in(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+
+  //// Validate Input parameters
+
+  if ((buf == NULL) || (c == NULL) || (valid_block(disk_num, block_num) == false))
+      return;
+
+  uint16_t key = block_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(c, key);
+
+  pthread_mutex_lock(&s->lock);
+
+  snapshot_claim(c, key, NULL);
+
+  int i = find_entry(s, key);
+  if (i != -1)
+      update_entry(s, i, buf);
+
+  pthread_mutex_unlock(&s->lock);
+
+}
+
+
+//// Cache WRITE Function (write-back mode)
+//// Insert or Update the block identified by disk_num and block_num, and mark it dirty
+int cache_write_in(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+
   // This function to return 1 on Success and -1 on Failure
 
   //// Validate Input parameters
@@ -131,164 +1731,416 @@ int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
   if (buf == NULL)
       return -1;
 
-  if (sizeof(buf) <= 0)
+  // Return -1, if no Cache exist
+  if (c == NULL)
+      return -1;
+
+  // Return -1, if disk number or block number is out of range
+  if (valid_block(disk_num, block_num) == false)
+      return -1;
+
+  uint16_t key = block_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(c, key);
+
+  pthread_mutex_lock(&s->lock);
+
+  snapshot_claim(c, key, NULL);
+
+  int i = find_entry(s, key);
+
+  if (i == -1)
+      i = new_entry(s, key, buf);
+  else if (update_entry(s, i, buf) == -1)
+      i = -1;
+
+  // In write-through mode the caller writes JBOD itself, so the entry stays clean
+  if ((i != -1) && (c->write_back == true))
+      set_flag(s, i, CACHE_ENTRY_DIRTY);
+
+  pthread_mutex_unlock(&s->lock);
+
+  return (i == -1) ? -1 : 1;
+
+}
+
+
+//// Cache PREFETCH Function (readahead)
+//// Insert the block identified by disk_num and block_num, unless it is already in the Cache
+int cache_prefetch_in(cache_t *c, int disk_num, int block_num, const uint8_t *buf) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  if (buf == NULL)
       return -1;
-  
-  // Return -1, if disk number is not between 0 and 15
-  if ( (disk_num < 0) || (disk_num > (JBOD_NUM_DISKS - 1)) ) 	// JBOD_NUM_DISKS = 16
+
+  // Return -1, if no Cache exist
+  if (c == NULL)
       return -1;
 
-  // Return -1, if block number is not between 0 and 255
-  if ( (block_num < 0) || (block_num > (JBOD_BLOCK_SIZE - 1)) )	// JBOD_BLOCK_SIZE = 256
+  if (valid_block(disk_num, block_num) == false)
       return -1;
-  
-  int i, j;
-
-  // Check the Cache and appropriately Update or Insert the entry block
-  for (i = 0; i < cache_size; i++) {
-
-      // When there is a cache entry, "Update the block" identified by disk_num and block_num
-      if ( (cache[i].disk_num == disk_num) && (cache[i].block_num == block_num) ) {
-
-          // Cache entry found !
-
-   	  // Compare the data found in cache entry with that in buffer 'buf'
-    	  if (memcmp(cache[i].block, buf, JBOD_BLOCK_SIZE) == 0) {
-              // Return -1, if this same cache block data is already existing in the Cache
-    	      return -1;
-    	  } 
-	  else {
-	    
-	      // "Update the block" identified by disk_num and block_num in the Cache
-	      cache_update(disk_num, block_num, buf);
-	      
-	      return 1; // Return 1, on success
-	  }
-      }
 
-      // When there is no entry identified by disk_num and block_num in the Cache,
-      // then, "Insert the block" into the Cache
-      if (cache[i].valid == false) {
+  int rc = 1;
+  uint16_t key = block_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(c, key);
+
+  pthread_mutex_lock(&s->lock);
 
-    	  cache[i].disk_num = disk_num;
-          cache[i].block_num = block_num;
+  snapshot_claim(c, key, NULL);
 
-          //// "Insert the block" into the Cache
-          if (buf != NULL) {
-              // Copy data in buffer 'buf' to the corresponding cache entry
-              memcpy(cache[i].block, buf, JBOD_BLOCK_SIZE);
-	  }
+  // A cached block may be newer than the prefetched copy (write-back mode), so it is kept
+  if (find_entry(s, key) == -1) {
 
-	  clock += 1;			// Increment the global variable 'clock'
-	  cache[i].access_time = clock;	// set access_time field to indicate recent use of entry
-	  cache[i].valid = true;	// set 'valid' field to indicate the cache entry as valid
+      int i = new_entry(s, key, buf);
 
-	  return 1; // Return 1, on success
+      if (i == -1)
+          rc = -1;
+      else {
+          set_flag(s, i, CACHE_ENTRY_PREFETCHED);
+          __atomic_add_fetch(&s->num_prefetched, 1, __ATOMIC_RELAXED);
       }
+  }
 
-  } // end-of For Loop
+  pthread_mutex_unlock(&s->lock);
 
+  return rc;
 
-  //// When the Cache is FULL
-  //// Evict the 'Least Recently Used' entry, then Insert the New entry.
+}
 
-  int min_indx = -1;
-  int indx = 0;
-  
-  // Fetch the 'Least Recently Used' entry
-  for (j = 1; j < cache_size; j++) {
-    
-      if (cache[j].access_time < cache[indx].access_time) {
-          min_indx = j;
-          indx = min_indx;
-      }
-      else
-          min_indx = indx;
 
-  } // end-of For Loop
+//// Cache PREFETCH STATS Function
+void cache_prefetch_stats_in(cache_t *c, long *prefetched, long *hits, long *wasted) {
 
-  // Insert the data from buffer 'buf' to the identified LRU entry block of the Cache
-  if (min_indx >= 0) {
+  if (c == NULL) {
+      *prefetched = *hits = *wasted = 0;
+      return;
+  }
 
-      cache[min_indx].disk_num = disk_num;
-      cache[min_indx].block_num = block_num;
+  *prefetched = sum_stat(c, offsetof(cache_shard_t, num_prefetched));
+  *hits = sum_stat(c, offsetof(cache_shard_t, num_prefetch_hits));
+  *wasted = sum_stat(c, offsetof(cache_shard_t, num_prefetch_wasted));
+}
 
-      // Copy data in buffer 'buf' to the corresponding cache entry block
-      if (buf != NULL)
-          memcpy(cache[min_indx].block, buf, JBOD_BLOCK_SIZE);
 
-      clock += 1;				// Increment the global variable 'clock'
-      cache[min_indx].access_time = clock;	// set access_time field to indicate recent use of entry
-      cache[min_indx].valid = true;		// set 'valid' field to indicate the cache entry as valid
+//// Cache QUERY STATS Function
+void cache_query_stats_in(cache_t *c, long *queries, long *hits) {
 
-      // On success, return 1
-      return 1;
-      
+  if (c == NULL) {
+      *queries = *hits = 0;
+      return;
   }
 
-  // On failure, return -1
-  return -1;
-  
+  *queries = sum_stat(c, offsetof(cache_shard_t, num_queries));
+  *hits = sum_stat(c, offsetof(cache_shard_t, num_hits));
 }
 
 
-//// Cache UPDATE Function
-//// When the entry exist in Cache, Update its block content with the new data in 'buf'
-void cache_update(int disk_num, int block_num, const uint8_t *buf) {
+//// Cache GET STATS Function
+void cache_get_stats_in(cache_t *c, cache_stats_t *stats) {
 
-  //// Validate Input parameters
+  memset(stats, 0, sizeof(*stats));
 
-  if (sizeof(buf) <= 0)
+  if (c == NULL)
       return;
 
-  if (buf == NULL)
+  stats->lookups = sum_stat(c, offsetof(cache_shard_t, num_queries));
+  stats->hits = sum_stat(c, offsetof(cache_shard_t, num_hits));
+  stats->misses = stats->lookups - stats->hits;
+  stats->inserts = sum_stat(c, offsetof(cache_shard_t, num_inserts));
+  stats->evictions = sum_stat(c, offsetof(cache_shard_t, num_evictions));
+  stats->writebacks = sum_stat(c, offsetof(cache_shard_t, num_writebacks));
+  stats->prefetched = sum_stat(c, offsetof(cache_shard_t, num_prefetched));
+  stats->prefetch_hits = sum_stat(c, offsetof(cache_shard_t, num_prefetch_hits));
+  stats->prefetch_wasted = sum_stat(c, offsetof(cache_shard_t, num_prefetch_wasted));
+  stats->restored = sum_stat(c, offsetof(cache_shard_t, num_restored));
+}
+
+
+//// Cache RESET STATS Function
+void cache_reset_stats_in(cache_t *c) {
+
+  if (c == NULL)
       return;
 
+  // Counts racing with the reset may land on either side of it
+  for (int k = 0; k < c->num_shards; k++) {
+      cache_shard_t *s = &c->shards[k];
+      long *counters[] = { &s->num_queries, &s->num_hits, &s->num_inserts, &s->num_evictions,
+                           &s->num_writebacks, &s->num_prefetched, &s->num_prefetch_hits,
+                           &s->num_prefetch_wasted, &s->num_restored };
+
+      for (size_t n = 0; n < sizeof(counters) / sizeof(counters[0]); n++)
+          __atomic_store_n(counters[n], 0, __ATOMIC_RELAXED);
+  }
+}
+
+
+//// Cache POLICY NAME Function
+const char *cache_policy_name(cache_policy_t policy) {
+  return ((policy >= 0) && (policy < CACHE_NUM_POLICIES)) ? policies[policy].name : NULL;
+}
+
+
+//// Cache FLUSH Function - Writes all the dirty entries back
+int cache_flush_in(cache_t *c) {
+
+  // This function to return 1 on Success and -1 on Failure
+
   // Return -1, if no Cache exist
-  if ((cache == NULL) || (cache_size == 0))
-      return;
-	  
-  int i;
-	  
-  // Check the Cache and appropriately Update the block entry
-  for (i = 0; i < cache_size; i++) {
+  if (c == NULL)
+      return -1;
+
+  lock_all(c);
+  int rc = flush_entries(c);
+  unlock_all(c);
+
+  return rc;
+
+}
+
+
+//// Cache SAVE Function - Saves the cached blocks to a snapshot file, for a warm restart
+int cache_save_in(cache_t *c, const char *path, uint64_t generation) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  if ((c == NULL) || (path == NULL))
+      return -1;
+
+  lock_all(c);
+
+  // Dirty blocks are written back first: a snapshot only holds what the volume does
+  int rc = flush_entries(c);
+  if (rc == 1)
+      rc = snapshot_write(c, path, generation);
+
+  unlock_all(c);
+
+  return rc;
+}
+
+
+//// Cache SET WRITEBACK Function - Sets the function that writes dirty entries back
+int cache_set_writeback_in(cache_t *c, cache_writeback_fn fn, void *arg) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  if (c == NULL)
+      return -1;
 
-      // When there is a cache entry, "Update the block" identified by disk_num and block_num
-      if ((cache[i].disk_num == disk_num) && (cache[i].block_num == block_num)) {
+  int rc = 1;
 
-    	  // Cache entry found !
+  lock_all(c);
 
-    	  if (buf != NULL) {
-              // Copy data from buffer 'buf' to the corresponding cache entry
-  	      memcpy(cache[i].block, buf, JBOD_BLOCK_SIZE);
-    	  }
+  // Dirty entries of a write-back Cache go out through one owner; another one cannot take over
+  if ((fn != NULL) && (c->write_back == true) && (c->writeback_arg != NULL) && (c->writeback_arg != arg))
+      rc = -1;
+  else {
+      c->writeback_fn = fn;
+      c->writeback_arg = arg;
+  }
+
+  unlock_all(c);
+
+  return rc;
+}
+
+
+//// Cache WRITE BACK ENABLED Function
+bool cache_write_back_enabled_in(cache_t *c) {
+  // This function returns 'true' if the Cache holds written blocks dirty
+  return (c != NULL) && c->write_back;
+}
+
+
+//// Cache PRINT HIT RATE Function
+void cache_print_hit_rate_in(cache_t *c) {
+
+  cache_stats_t stats;
+
+  cache_get_stats_in(c, &stats);
+
+  // The default Cache also reports the ones destroyed before it
+  if ((c == NULL) || (c == default_cache))
+      add_stats(&stats, &retired_stats);
+
+  fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) stats.hits / stats.lookups);
+
+  if (stats.prefetched > 0)
+      fprintf(stderr, "Prefetched: %ld blocks, %ld hits, %ld wasted\n", stats.prefetched, stats.prefetch_hits,
+              stats.prefetch_wasted);
+
+  if (stats.restored > 0)
+      fprintf(stderr, "Restored: %ld blocks from the snapshot\n", stats.restored);
+
+  // A Cache with a block pool reports how many blocks it holds, and what they take there (the
+  // default Cache, as it was when destroyed)
+  long storage[3] = { -1 };
 
-	  clock += 1;			// Increment the global variable 'clock'
-	  cache[i].access_time = clock;	// set access_time field to indicate recent use of entry
-	  cache[i].valid = true;	// set 'valid' field to indicate the cache entry as valid
+  if ((c != NULL) && (c->pooled == true))
+      storage_stats(c, storage);
+  else if (c == NULL)
+      memcpy(storage, retired_storage, sizeof(storage));
 
-	  break;
+  if (storage[0] >= 0)
+      fprintf(stderr, "Blocks: %ld cached, %ld uniform, the others in %ld pool blocks\n", storage[0], storage[1],
+              storage[2]);
+
+  // A sharded Cache also reports each shard, to show how evenly the blocks spread
+  if ((c != NULL) && (c->num_shards > 1)) {
+
+      fprintf(stderr, "Evictions: %ld\n", sum_stat(c, offsetof(cache_shard_t, num_evictions)));
+
+      for (int k = 0; k < c->num_shards; k++) {
+          cache_shard_t *s = &c->shards[k];
+          long q = __atomic_load_n(&s->num_queries, __ATOMIC_RELAXED);
+          long h = __atomic_load_n(&s->num_hits, __ATOMIC_RELAXED);
+          fprintf(stderr, "  shard %2d: %8ld queries, hit rate %5.1f%%, %6ld evictions\n", k, q,
+                  (q > 0) ? 100 * (float) h / q : 0.0, __atomic_load_n(&s->num_evictions, __ATOMIC_RELAXED));
       }
+  }
+}
+
+
+//// Default Cache Functions - the Cache used by mdadm's default context
+
+//// Cache CREATE Function - Allocates dynamic space in memory for the required no. of block entries
+int cache_create(int num_entries) {
+
+  cache_config_t config = { .num_entries = num_entries, .write_back = false };
+
+  return cache_create_config(&config);
+}
+
+
+//// Cache CREATE Function with options - see cache_config_t
+int cache_create_config(const cache_config_t *config) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  // Return -1, if Cache is already created
+  if (default_cache != NULL)
+       return -1;
+
+  cache_t *c = cache_new(config);
+  if (c == NULL)
+      return -1;
+
+  cache_set_writeback_in(c, default_writeback_fn, default_writeback_arg);
+  default_cache = c;
+
+  // return 1 on Success
+  return 1;
+
+}
+
+
+//// Cache DESTROY Function - Frees the dynamic space allocated for Cache
+int cache_destroy(void) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  // Return -1, if no Cache exist
+  if (default_cache == NULL)
+      return -1;
+
+  cache_t *c = default_cache;
+  default_cache = NULL;
+
+  // Keep the statistics for cache_print_hit_rate, once the dirty entries are written back
+  cache_stats_t stats;
+
+  cache_flush_in(c);
+  cache_get_stats_in(c, &stats);
+  add_stats(&retired_stats, &stats);
+  if (c->pooled == true)
+      storage_stats(c, retired_storage);
+  else
+      retired_storage[0] = -1;
+
+  cache_free(c);
+
+  // return 1 on Success
+  return 1;
+
+}
+
+cache_t *cache_default(void) {
+  return default_cache;
+}
 
-  } // end-of For Loop
-	  
+int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
+  return cache_lookup_in(default_cache, disk_num, block_num, buf);
+}
+
+bool cache_contains(int disk_num, int block_num) {
+  return cache_contains_in(default_cache, disk_num, block_num);
+}
+
+int cache_peek(int disk_num, int block_num, uint8_t *buf) {
+  return cache_peek_in(default_cache, disk_num, block_num, buf);
+}
+
+int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
+  return cache_insert_in(default_cache, disk_num, block_num, buf);
+}
+
+void cache_update(int disk_num, int block_num, const uint8_t *buf) {
+  cache_update_in(default_cache, disk_num, block_num, buf);
+}
+
+int cache_write(int disk_num, int block_num, const uint8_t *buf) {
+  return cache_write_in(default_cache, disk_num, block_num, buf);
+}
+
+int cache_prefetch(int disk_num, int block_num, const uint8_t *buf) {
+  return cache_prefetch_in(default_cache, disk_num, block_num, buf);
+}
+
+void cache_get_stats(cache_stats_t *stats) {
+  cache_get_stats_in(default_cache, stats);
+  add_stats(stats, &retired_stats);
+}
+
+void cache_reset_stats(void) {
+  cache_reset_stats_in(default_cache);
+  memset(&retired_stats, 0, sizeof(retired_stats));
+}
+
+void cache_prefetch_stats(long *prefetched, long *hits, long *wasted) {
+  cache_prefetch_stats_in(default_cache, prefetched, hits, wasted);
+}
+
+int cache_flush(void) {
+  return cache_flush_in(default_cache);
+}
+
+int cache_save(const char *path, uint64_t generation) {
+  return cache_save_in(default_cache, path, generation);
+}
+
+//// Cache SET WRITEBACK Function - applies to the default Cache, and to the ones created later
+void cache_set_writeback(cache_writeback_fn fn, void *arg) {
+
+  default_writeback_fn = fn;
+  default_writeback_arg = arg;
+
+  if (default_cache != NULL)
+      cache_set_writeback_in(default_cache, fn, arg);
 }
 
 
 //// Cache ENABLED Function
 bool cache_enabled(void) {
   // This function returns 'true' if cache is enabled and 'false' if not enabled
-
-  // Return true, if Cache exist
-  if ((cache != NULL) || (cache_size != 0))
-      return true;
-  
-  return false; // Return false, if no Cache exist
+  return default_cache != NULL;
 }
 
+bool cache_write_back_enabled(void) {
+  return cache_write_back_enabled_in(default_cache);
+}
 
 // Function cache_print_hit_rate (given)
 void cache_print_hit_rate(void) {
-  fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) num_hits / num_queries);
+  cache_print_hit_rate_in(default_cache);
 }
-
@@ -7,21 +7,152 @@
 #include "jbod.h"
 #include "util.h"
 
+/* Metadata of a cache entry. A block filled with a single byte value is held
+ * as that byte; any other lives in the block pool of the entry's shard, shared
+ * by all the entries holding the same data. The key is also held in the dense
+ * key index of the shard. */
 typedef struct {
-  bool valid;
-  int disk_num;
-  int block_num;
-  uint8_t block[JBOD_BLOCK_SIZE];
+  uint16_t key;    /* disk_num << 8 | block_num */
+  uint16_t block;  /* pool block holding the data, or the byte of a uniform block */
+  uint8_t queue;   /* eviction policy queue holding the entry */
+  uint8_t flags;   /* CACHE_ENTRY_* */
   int access_time;
+  int lru_prev;    /* neighbour towards the head of its queue, -1 at head */
+  int lru_next;    /* neighbour towards the tail of its queue (or next free entry), -1 at tail */
 } cache_entry_t;
 
+/* Flags of a cache entry. */
+#define CACHE_ENTRY_DIRTY 0x01         /* write-back mode: block is newer than its copy on the JBOD */
+#define CACHE_ENTRY_PREFETCHED 0x02    /* inserted by readahead and not looked up since */
+#define CACHE_ENTRY_REFERENCED 0x04    /* looked up without the lock since it was last made recent */
+#define CACHE_ENTRY_SECOND_CHANCE 0x08 /* CLOCK: used since the hand last passed it */
+#define CACHE_ENTRY_UNIFORM 0x10       /* every byte of the block is 'block' */
+
+/* Eviction policies. */
+typedef enum {
+  CACHE_LRU,       /* least recently used (the default) */
+  CACHE_CLOCK,     /* second chance: used entries are passed over once */
+  CACHE_2Q,        /* blocks seen once and blocks seen again in separate queues */
+  CACHE_ARC,       /* adaptive replacement: like 2Q, balanced by what was evicted */
+  CACHE_NUM_POLICIES,
+} cache_policy_t;
+
+/* Options chosen when the cache is created. */
+typedef struct {
+  int num_entries;   /* number of cache entries */
+  bool write_back;   /* hold written blocks dirty instead of writing through */
+  int num_shards;    /* shards, each with its own lock; 0 or 1 for a single one */
+  cache_policy_t policy; /* eviction policy, applied within each shard */
+  int num_blocks;    /* pool blocks storing the data; 0 for one per entry. With
+                      * fewer blocks than entries, identical and uniform blocks
+                      * let up to CACHE_MAX_POOLED_ENTRIES entries share them,
+                      * and entries are evicted when the pool runs out. */
+  const char *snapshot; /* snapshot file the cache is warmed from, and saved to
+                         * when freed (see cache_save_in); NULL for none */
+  uint64_t generation;  /* generation of the volume: a snapshot saved at
+                         * another generation is stale, and ignored; with
+                         * 0 (unknown), none is ever taken in */
+} cache_config_t;
+
+/* Maximum number of entries of a cache with a block pool, one per block of
+ * the largest volume (the limit is 4096 otherwise, as for the pool itself). */
+#define CACHE_MAX_POOLED_ENTRIES 65536
+
+/* Maximum number of shards of a cache. A single shard keeps exact LRU order
+ * and locks every lookup; with several, blocks are spread over the shards by
+ * hash, lookups take no lock, and each shard approximates LRU (entries looked
+ * up since they were last made recent get a second chance on eviction). */
+#define CACHE_MAX_SHARDS 64
+
+/* Writes a dirty block back to the JBOD; |arg| is the one given along with the
+ * function. Returns 1 on success and -1 on failure. */
+typedef int (*cache_writeback_fn)(void *arg, int disk_num, int block_num, const uint8_t *buf);
+
+/* A block cache. Every function below is safe to call from several threads on
+ * the same cache; the cache_*_in functions work on the cache given to them,
+ * and the others on the default cache, made by cache_create. */
+typedef struct cache cache_t;
+
+/* Returns a new cache with the options in |config|, or NULL on failure. */
+cache_t *cache_new(const cache_config_t *config);
+
+/* Returns 1 on success and -1 on failure. Writes the dirty entries back and
+ * frees |cache|, which no other thread may be using any more. */
+int cache_free(cache_t *cache);
+
+int cache_lookup_in(cache_t *cache, int disk_num, int block_num, uint8_t *buf);
+bool cache_contains_in(cache_t *cache, int disk_num, int block_num);
+int cache_peek_in(cache_t *cache, int disk_num, int block_num, uint8_t *buf);
+int cache_insert_in(cache_t *cache, int disk_num, int block_num, const uint8_t *buf);
+void cache_update_in(cache_t *cache, int disk_num, int block_num, const uint8_t *buf);
+int cache_write_in(cache_t *cache, int disk_num, int block_num, const uint8_t *buf);
+int cache_prefetch_in(cache_t *cache, int disk_num, int block_num, const uint8_t *buf);
+void cache_prefetch_stats_in(cache_t *cache, long *prefetched, long *hits, long *wasted);
+int cache_flush_in(cache_t *cache);
+bool cache_write_back_enabled_in(cache_t *cache);
+void cache_print_hit_rate_in(cache_t *cache);
+
+/* Returns 1 on success and -1 on failure. Writes the dirty entries back, then
+ * saves the cached blocks, most recently used first, to the snapshot file
+ * |path| (replacing it atomically), tagged with the volume |generation|. The
+ * blocks of the cache's own snapshot not used since it was loaded follow.
+ *
+ * A cache created with a snapshot maps the file, and takes each of its blocks
+ * in on the first lookup that misses it, as long as the block was not written
+ * in the meantime. Owners move the generation on whenever the volume may have
+ * changed without the cache seeing it (another writer, a new volume, a mount
+ * of jbod_server, which starts every mount on blank disks). A snapshot saved
+ * at generation 0 is never taken in. */
+int cache_save_in(cache_t *cache, const char *path, uint64_t generation);
+
+/* Reports the number of lookups and of lookups that hit. */
+void cache_query_stats_in(cache_t *cache, long *queries, long *hits);
+
+/* Counters of a cache, since it was created or its counters were reset. */
+typedef struct {
+  long lookups;
+  long hits;
+  long misses;
+  long inserts;         /* entries filled with a new block */
+  long evictions;
+  long writebacks;      /* dirty blocks written back (write-back mode) */
+  long prefetched;      /* blocks inserted by readahead */
+  long prefetch_hits;   /* of those, blocks found by a later lookup */
+  long prefetch_wasted; /* and blocks evicted before any lookup */
+  long restored;        /* blocks taken in from the snapshot */
+} cache_stats_t;
+
+/* Stores the counters of |cache| in |stats| (all 0 for a NULL cache). They
+ * are updated with relaxed atomics: a snapshot taken while other threads use
+ * the cache is not exactly consistent across counters. */
+void cache_get_stats_in(cache_t *cache, cache_stats_t *stats);
+
+/* Sets the counters of |cache| back to 0. */
+void cache_reset_stats_in(cache_t *cache);
+
+/* Returns the short name of |policy| ("lru", "clock", "2q", "arc"), or NULL. */
+const char *cache_policy_name(cache_policy_t policy);
+
+/* Sets the function used to write dirty entries back, called with the cache
+ * lock held. A write-back cache has a single owner: it fails (returns -1) when
+ * another |arg| already set one, until that owner clears it by passing a NULL
+ * |fn|. Returns 1 on success. */
+int cache_set_writeback_in(cache_t *cache, cache_writeback_fn fn, void *arg);
+
+/* Returns the default cache, or NULL if there is none. */
+cache_t *cache_default(void);
+
 /* Returns 1 on success and -1 on failure. Should allocate a space for
- * |num_entries| cache entries, each of type cache_entry_t. Calling it again
- * without first calling cache_destroy (see below) should fail. */
+ * |num_entries| cache entries, each of type cache_entry_t, and their blocks.
+ * Calling it again without first calling cache_destroy (see below) should
+ * fail. */
 int cache_create(int num_entries);
 
+/* Same as cache_create, with the options in |config|. */
+int cache_create_config(const cache_config_t *config);
+
 /* Returns 1 on success and -1 on failure. Frees the space allocated by
- * cache_create function above. */
+ * cache_create function above. Dirty entries are flushed first. */
 int cache_destroy(void);
 
 /* Returns 1 on success and -1 on failure. Looks up the block located at
@@ -35,14 +166,62 @@ int cache_lookup(int disk_num, int block_num, uint8_t *buf);
  * recently used entry and insert the new entry. */
 int cache_insert(int disk_num, int block_num, const uint8_t *buf);
 
+/* Returns true if the block at |disk_num| and |block_num| is cached. Unlike
+ * cache_lookup, it does not count as a query nor make the entry recent. */
+bool cache_contains(int disk_num, int block_num);
+
+/* Returns 1 on success and -1 on failure. Copies the block at |disk_num| and
+ * |block_num| to |buf| if it is cached; like cache_contains, it does not
+ * count as a query nor make the entry recent. */
+int cache_peek(int disk_num, int block_num, uint8_t *buf);
+
 /* If the entry with |disk_num| and |block_num| exists, updates the
  * corresponding block with data from |buf| */
 void cache_update(int disk_num, int block_num, const uint8_t *buf);
 
+/* Write-back mode: inserts or updates the entry for |disk_num| and
+ * |block_num| with |buf| and marks it dirty. A dirty entry that gets evicted
+ * is written back first. Returns 1 on success and -1 on failure. */
+int cache_write(int disk_num, int block_num, const uint8_t *buf);
+
+/* Readahead: inserts the entry for |disk_num| and |block_num| unless it is
+ * already cached, and counts it as prefetched. Returns 1 on success and -1 on
+ * failure. */
+int cache_prefetch(int disk_num, int block_num, const uint8_t *buf);
+
+/* Reports how many blocks were prefetched, how many of them were later found
+ * by cache_lookup, and how many were evicted without ever being looked up. */
+void cache_prefetch_stats(long *prefetched, long *hits, long *wasted);
+
+/* Writes every dirty entry back and marks it clean. Returns 1 on success and
+ * -1 on failure. */
+int cache_flush(void);
+
+/* Same as cache_save_in, on the default cache. */
+int cache_save(const char *path, uint64_t generation);
+
+/* Same as cache_get_stats_in, on the default cache, including the default
+ * caches destroyed since the counters were last reset. */
+void cache_get_stats(cache_stats_t *stats);
+
+/* Sets the counters of the default cache back to 0, and forgets those of the
+ * default caches destroyed. */
+void cache_reset_stats(void);
+
+/* Sets the function used to write dirty entries of the default cache back,
+ * including those of default caches created later. */
+void cache_set_writeback(cache_writeback_fn fn, void *arg);
+
 /* Returns true if cache is enabled and false if not. */
 bool cache_enabled(void);
 
-/* Prints the hit rate of the cache. */
+/* Returns true if the cache was created in write-back mode. */
+bool cache_write_back_enabled(void);
+
+/* Prints the hit rate of the cache, and the prefetch counts when readahead
+ * has been used. A sharded cache also prints its evictions, and the counts of
+ * each shard; a cache with a block pool, how the cached blocks are stored; a
+ * cache created with a snapshot, how many blocks it brought back. */
 void cache_print_hit_rate(void);
 
 #endif
@@ -0,0 +1,135 @@
+#include <string.h>
+
+#include "combine.h"
+
+/* Implementing the Write-combining buffer of mdadm: partially written blocks, with a byte mask */
+
+// Declaring CONSTANTS
+#define MASK_WORDS (JBOD_BLOCK_SIZE / 64)	// 64-bit words of a byte mask
+
+
+//// HELPER Functions ////
+
+// Helper function-1: set_range() - marks bytes 'offset' to 'offset + len - 1' of the mask as written
+static void set_range(uint64_t *mask, int offset, int len) {
+
+  while (len > 0) {
+
+      int word = offset / 64, bit = offset % 64;
+      int n = (64 - bit < len) ? 64 - bit : len;
+
+      mask[word] |= (n == 64) ? ~(uint64_t) 0 : ((((uint64_t) 1 << n) - 1) << bit);
+      offset += n;
+      len -= n;
+  }
+}
+
+
+//// Write-combining Functions
+
+int combine_init(combine_t *combine, int capacity) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  if ((capacity < 0) || (capacity > COMBINE_MAX_BLOCKS))
+      return -1;
+
+  memset(combine->blocks, 0, sizeof(combine->blocks));
+  combine->capacity = capacity;
+  combine->clock = 0;
+  __atomic_store_n(&combine->num_used, 0, __ATOMIC_RELAXED);
+
+  return 1;
+}
+
+combine_block_t *combine_find(combine_t *combine, uint32_t block) {
+
+  if (combine->num_used == 0)
+      return NULL;
+
+  for (int i = 0; i < combine->capacity; i++)
+      if ((combine->blocks[i].used == true) && (combine->blocks[i].block == block))
+          return &combine->blocks[i];
+
+  return NULL;
+}
+
+bool combine_holds(const combine_t *combine, uint32_t first, uint32_t last) {
+
+  if (combine->num_used == 0)
+      return false;
+
+  for (int i = 0; i < combine->capacity; i++)
+      if ((combine->blocks[i].used == true) && (combine->blocks[i].block >= first) && (combine->blocks[i].block <= last))
+          return true;
+
+  return false;
+}
+
+combine_block_t *combine_add(combine_t *combine, uint32_t block) {
+
+  for (int i = 0; i < combine->capacity; i++) {
+
+      combine_block_t *b = &combine->blocks[i];
+      if (b->used == true)
+          continue;
+
+      memset(b->dirty, 0, sizeof(b->dirty));
+      b->used = true;
+      b->block = block;
+      b->last_use = ++combine->clock;
+      __atomic_add_fetch(&combine->num_used, 1, __ATOMIC_RELAXED);
+      return b;
+  }
+
+  return NULL;
+}
+
+combine_block_t *combine_victim(combine_t *combine) {
+
+  combine_block_t *victim = NULL;
+
+  for (int i = 0; i < combine->capacity; i++)
+      if ((combine->blocks[i].used == true) && ((victim == NULL) || (combine->blocks[i].last_use < victim->last_use)))
+          victim = &combine->blocks[i];
+
+  return victim;
+}
+
+void combine_merge(combine_t *combine, combine_block_t *b, int offset, int len, const uint8_t *data) {
+
+  memcpy(b->data + offset, data, len);
+  set_range(b->dirty, offset, len);
+  b->last_use = ++combine->clock;
+}
+
+bool combine_complete(const combine_block_t *b) {
+
+  for (int w = 0; w < MASK_WORDS; w++)
+      if (b->dirty[w] != ~(uint64_t) 0)
+          return false;
+
+  return true;
+}
+
+void combine_apply(const combine_block_t *b, uint8_t *block) {
+
+  for (int w = 0; w < MASK_WORDS; w++) {
+
+      uint64_t mask = b->dirty[w];
+
+      // Whole words first; the runs of a partly written word byte by byte
+      if (mask == ~(uint64_t) 0)
+          memcpy(block + w * 64, b->data + w * 64, 64);
+      else
+          for (int k = 0; mask != 0; k++, mask >>= 1)
+              if (mask & 1)
+                  block[w * 64 + k] = b->data[w * 64 + k];
+  }
+}
+
+void combine_release(combine_t *combine, combine_block_t *b) {
+
+  b->used = false;
+  __atomic_sub_fetch(&combine->num_used, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,66 @@
+#ifndef COMBINE_H_
+#define COMBINE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jbod.h"
+
+/* Most blocks a write-combining buffer holds. */
+#define COMBINE_MAX_BLOCKS 64
+
+/* A block written in part: the bytes written so far, and which ones they are.
+ * Bit i of |dirty| (64 bytes to a word) is set once byte i was written. */
+typedef struct {
+  bool used;
+  uint32_t block;       /* linear block number */
+  uint64_t last_use;    /* buffer clock of the latest write, for choosing a victim */
+  uint64_t dirty[JBOD_BLOCK_SIZE / 64];
+  uint8_t data[JBOD_BLOCK_SIZE];
+} combine_block_t;
+
+/* A write-combining buffer: small writes falling into the same block are
+ * merged here, and the block goes to the JBOD once, when it is complete or
+ * has to leave the buffer. Not thread-safe; |num_used| may be read without
+ * the owner's lock (atomically) to tell whether anything is held. */
+typedef struct {
+  int capacity;         /* blocks it may hold, 0 when disabled */
+  int num_used;
+  uint64_t clock;
+  combine_block_t blocks[COMBINE_MAX_BLOCKS];
+} combine_t;
+
+/* Empties |combine| and sets its capacity to |capacity| blocks (0 disables
+ * it). Returns 1 on success and -1 on failure. */
+int combine_init(combine_t *combine, int capacity);
+
+/* Returns the block of linear block |block| held by |combine|, or NULL. */
+combine_block_t *combine_find(combine_t *combine, uint32_t block);
+
+/* Returns true when |combine| holds any of the linear blocks |first| to
+ * |last|. */
+bool combine_holds(const combine_t *combine, uint32_t first, uint32_t last);
+
+/* Returns an empty block for linear block |block|, or NULL when the buffer is
+ * full (see combine_victim). */
+combine_block_t *combine_add(combine_t *combine, uint32_t block);
+
+/* Returns the least recently written block, to be flushed to make room, or
+ * NULL if the buffer is empty. */
+combine_block_t *combine_victim(combine_t *combine);
+
+/* Merges the |len| bytes of |data| into |b| at |offset|, over any bytes
+ * written there before. */
+void combine_merge(combine_t *combine, combine_block_t *b, int offset, int len, const uint8_t *data);
+
+/* Returns true when every byte of |b| was written. */
+bool combine_complete(const combine_block_t *b);
+
+/* Copies the bytes written into |b| over the current contents of the block,
+ * in |block|. */
+void combine_apply(const combine_block_t *b, uint8_t *block);
+
+/* Drops |b| from the buffer. */
+void combine_release(combine_t *combine, combine_block_t *b);
+
+#endif
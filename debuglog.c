@@ -0,0 +1,649 @@
+#include <err.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "debuglog.h"
+
+/* Implementing the asynchronous binary Debug log: per-thread rings of events, drained by a thread */
+
+// A message as recorded: it is only formatted when printed
+typedef struct {
+  uint64_t time;		// CLOCK_MONOTONIC, in nanoseconds
+  uint16_t format;		// id of the format
+  uint16_t thread;		// ring the event was recorded in
+  uint32_t unused;
+  uint64_t args[DEBUG_LOG_MAX_ARGS];	// integers, pointers and doubles as 64 bits; strings inline
+} log_event_t;
+
+// What a conversion of a format takes
+typedef enum {
+  ARG_NONE,		// "%%"
+  ARG_INT,		// int or smaller
+  ARG_LONG,		// long, long long, size_t...
+  ARG_PTR,
+  ARG_DOUBLE,
+  ARG_STR,
+  ARG_BAD,		// not supported: the arguments from there on are not recorded
+} arg_kind_t;
+
+// Declaring CONSTANTS
+#define MAX_FORMATS 1024		// Distinct formats of a log
+#define FORMAT_SLOTS 2048		// Slots of the hash table of format addresses
+#define MAX_CONVS 32			// Conversions of a format whose arguments are recorded
+#define RING_EVENTS 16384		// Events of a ring (a power of 2)
+#define MAX_RINGS 256			// Threads recording at the same time
+#define DRAIN_INTERVAL_NS 1000000	// The rings are drained every millisecond
+static const char LOG_MAGIC[8] = { 'M', 'D', 'A', 'D', 'M', 'L', 'O', 'G' };
+
+// Records of the log file, after its header (the magic and the start time), each tagged
+#define RECORD_FORMAT 'F'		// id (16 bits), length (16 bits), text
+#define RECORD_EVENTS 'E'		// number of events (32 bits), then as many log_event_t
+#define RECORD_DROPPED 'D'		// thread (16 bits), events dropped (64 bits)
+
+// A format, with the kinds of the conversions whose arguments are recorded
+typedef struct {
+  const char *fmt;
+  int num_convs;
+  uint8_t kinds[MAX_CONVS];
+} log_format_t;
+
+// The ring of a thread. Only the owner thread moves 'head', and only the draining thread 'tail',
+// each on a cache line of its own.
+typedef struct {
+  uint64_t head;		// next event recorded
+  uint8_t pad1[56];
+  uint64_t tail;		// next event drained
+  uint8_t pad2[56];
+  uint64_t dropped;		// events dropped on a full ring
+  uint64_t dropped_drained;	// of those, the ones the draining thread reported
+  bool free;			// the owner exited: a new thread takes the ring over once it is drained
+  uint16_t id;
+  log_event_t events[RING_EVENTS];
+} log_ring_t;
+
+// Global Variables declaration
+static int debug_log_enabled = 0;
+static uint64_t log_start = 0;		// time the log started, the origin of the decoded times
+
+static log_format_t formats[MAX_FORMATS];
+static int num_formats = 0;		// published with release, after the format is filled
+static uint16_t format_index[FORMAT_SLOTS];	// id + 1 of the format at an address, 0 if none
+static pthread_mutex_t format_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static log_ring_t *rings[MAX_RINGS];
+static int num_rings = 0;		// published with release, after the ring is set up
+static __thread log_ring_t *thread_ring = NULL;
+static pthread_key_t ring_key;		// frees the ring of a thread when it exits
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FILE *log_file = NULL;		// binary log, NULL to format the messages to stderr
+static int formats_written = 0;		// formats already in the log file
+static bool running = false;
+static bool stopping = false;
+static bool stop_at_exit = false;	// stop_debug_log() is registered with atexit()
+static pthread_t drainer;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;	// the draining side, and 'log_file'
+static pthread_cond_t stop_cond;
+
+
+//// HELPER Functions ////
+
+// Helper function-1: now_ns() - the time, in nanoseconds
+static uint64_t now_ns(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Helper function-2: next_conversion() - finds the next conversion of a format, from 'p'. Sets
+// 'start' to where it begins and 'kind' to what it takes; returns where it ends, or NULL if none
+static const char *next_conversion(const char *p, const char **start, arg_kind_t *kind) {
+
+  bool is_long = false;
+
+  p = strchr(p, '%');
+  if (p == NULL)
+      return NULL;
+
+  *start = p++;
+  if (*p == '%') {
+      *kind = ARG_NONE;
+      return p + 1;
+  }
+
+  p += strspn(p, "-+ #0'");
+  p += strspn(p, "0123456789.");
+
+  // Length modifiers; 'L' (long double) is not supported
+  while ((*p != '\0') && (strchr("hlzjtqL", *p) != NULL)) {
+      if (*p == 'L') {
+          *kind = ARG_BAD;
+          return p + 1;
+      }
+      is_long |= (*p != 'h');
+      p++;
+  }
+
+  if (*p == '\0') {
+      *kind = ARG_BAD;
+      return p;
+  }
+
+  if (strchr("diouxXc", *p) != NULL)
+      *kind = is_long ? ARG_LONG : ARG_INT;
+  else if (*p == 'p')
+      *kind = ARG_PTR;
+  else if (strchr("fFeEgGaA", *p) != NULL)
+      *kind = ARG_DOUBLE;
+  else if (*p == 's')
+      *kind = ARG_STR;
+  else
+      *kind = ARG_BAD;	// '*' widths, %n...
+
+  return p + 1;
+}
+
+// Helper function-3: arg_slots() - argument slots of an event taken by a conversion
+static int arg_slots(arg_kind_t kind) {
+  return (kind == ARG_NONE) ? 0 : (kind == ARG_STR) ? DEBUG_LOG_MAX_STR / 8 : 1;
+}
+
+// Helper function-4: parse_format() - the conversions of 'fmt' whose arguments fit in an event
+static void parse_format(const char *fmt, log_format_t *f) {
+
+  const char *p = fmt, *start;
+  arg_kind_t kind;
+  int slots = 0;
+
+  f->fmt = fmt;
+  f->num_convs = 0;
+
+  while ((f->num_convs < MAX_CONVS) && ((p = next_conversion(p, &start, &kind)) != NULL)) {
+      if ((kind == ARG_BAD) || (slots + arg_slots(kind) > DEBUG_LOG_MAX_ARGS))
+          break;
+      slots += arg_slots(kind);
+      f->kinds[f->num_convs++] = kind;
+  }
+}
+
+// Helper function-5: format_id() - the id of the format at 'fmt', registered on first use; -1
+// when the table is full
+static int format_id(const char *fmt) {
+
+  uint32_t h = (uint32_t) (((uintptr_t) fmt >> 3) * 2654435761u) & (FORMAT_SLOTS - 1);
+  int id = -1;
+
+  // Lock-free lookup: a slot is only ever filled once
+  for (uint32_t n = 0; n < FORMAT_SLOTS; n++, h = (h + 1) & (FORMAT_SLOTS - 1)) {
+      int v = __atomic_load_n(&format_index[h], __ATOMIC_ACQUIRE);
+      if (v == 0)
+          break;
+      if (formats[v - 1].fmt == fmt)
+          return v - 1;
+  }
+
+  pthread_mutex_lock(&format_lock);
+
+  // Another thread may have registered it in the meantime; the slot found empty is still the
+  // first empty one of the probe sequence, or holds the format now
+  while (format_index[h] != 0 && formats[format_index[h] - 1].fmt != fmt)
+      h = (h + 1) & (FORMAT_SLOTS - 1);
+
+  if (format_index[h] != 0)
+      id = format_index[h] - 1;
+  else if (num_formats < MAX_FORMATS) {
+      id = num_formats;
+      parse_format(fmt, &formats[id]);
+      __atomic_store_n(&num_formats, id + 1, __ATOMIC_RELEASE);
+      __atomic_store_n(&format_index[h], id + 1, __ATOMIC_RELEASE);
+  }
+
+  pthread_mutex_unlock(&format_lock);
+  return id;
+}
+
+// Helper function-6: release_ring() - called as a thread exits, hands its ring over
+static void release_ring(void *ring) {
+  __atomic_store_n(&((log_ring_t *) ring)->free, true, __ATOMIC_RELEASE);
+}
+
+// Helper function-7: log_init() - sets the log up, once
+static void log_init(void) {
+
+  pthread_condattr_t attr;
+
+  pthread_key_create(&ring_key, release_ring);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&stop_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  log_start = now_ns();
+}
+
+// Helper function-8: get_ring() - the ring of the calling thread: a drained ring of a thread that
+// exited, or a new one. NULL when there are MAX_RINGS threads recording already.
+static log_ring_t *get_ring(void) {
+
+  log_ring_t *r = NULL;
+
+  pthread_mutex_lock(&ring_lock);
+
+  for (int i = 0; (i < num_rings) && (r == NULL); i++) {
+      if (__atomic_load_n(&rings[i]->free, __ATOMIC_ACQUIRE) &&
+          (__atomic_load_n(&rings[i]->tail, __ATOMIC_ACQUIRE) == rings[i]->head)) {
+          r = rings[i];
+          r->free = false;
+      }
+  }
+
+  if ((r == NULL) && (num_rings < MAX_RINGS) && (posix_memalign((void **) &r, 64, sizeof(log_ring_t)) == 0)) {
+      memset(r, 0, offsetof(log_ring_t, events));
+      r->id = num_rings;
+      rings[num_rings] = r;
+      __atomic_store_n(&num_rings, num_rings + 1, __ATOMIC_RELEASE);
+  }
+
+  pthread_mutex_unlock(&ring_lock);
+
+  if (r != NULL) {
+      pthread_setspecific(ring_key, r);
+      thread_ring = r;
+  }
+  return r;
+}
+
+// Helper function-9: format_message() - prints an event into 'out' as text, with what its format
+// takes; arguments that were not recorded print empty
+static void format_message(char *out, size_t size, const log_format_t *f, const log_event_t *e) {
+
+  const char *p = f->fmt, *start, *end;
+  arg_kind_t kind;
+  size_t len = 0;
+  int k = 0, slot = 0;
+
+  out[0] = '\0';
+
+  while (len < size) {
+
+      end = next_conversion(p, &start, &kind);
+      if (end == NULL) {
+          snprintf(out + len, size - len, "%s", p);
+          return;
+      }
+
+      // The text before the conversion, then the conversion itself
+      len += snprintf(out + len, size - len, "%.*s", (int) (start - p), p);
+      p = end;
+      if (len >= size)
+          return;
+
+      char spec[32];
+      snprintf(spec, sizeof(spec), "%.*s", (int) (end - start), start);
+
+      bool recorded = (k++ < f->num_convs);
+
+      if (kind == ARG_NONE)
+          len += snprintf(out + len, size - len, "%%");
+      else if (recorded == true) {
+
+          uint64_t v = e->args[slot];
+          double d;
+
+          switch (kind) {
+            case ARG_INT:
+              len += snprintf(out + len, size - len, spec, (int) v);
+              break;
+            case ARG_LONG:
+              len += snprintf(out + len, size - len, spec, (long long) v);
+              break;
+            case ARG_PTR:
+              len += snprintf(out + len, size - len, spec, (void *) (uintptr_t) v);
+              break;
+            case ARG_DOUBLE:
+              memcpy(&d, &v, sizeof(d));
+              len += snprintf(out + len, size - len, spec, d);
+              break;
+            default:
+              len += snprintf(out + len, size - len, spec, (const char *) &e->args[slot]);
+              break;
+          }
+          slot += arg_slots(kind);
+      }
+  }
+}
+
+// Helper function-10: drain_rings() - writes out what the rings hold, and the formats first
+// registered since the last time. Expects the drain lock to be held.
+static void drain_rings(void) {
+
+  int n = __atomic_load_n(&num_formats, __ATOMIC_ACQUIRE);
+
+  if (log_file != NULL) {
+      for (; formats_written < n; formats_written++) {
+          uint16_t id = formats_written;
+          uint16_t len = strnlen(formats[id].fmt, UINT16_MAX);
+          fputc(RECORD_FORMAT, log_file);
+          fwrite(&id, sizeof(id), 1, log_file);
+          fwrite(&len, sizeof(len), 1, log_file);
+          fwrite(formats[id].fmt, 1, len, log_file);
+      }
+  }
+
+  int count = __atomic_load_n(&num_rings, __ATOMIC_ACQUIRE);
+
+  for (int i = 0; i < count; i++) {
+
+      log_ring_t *r = rings[i];
+      uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      uint64_t tail = r->tail;
+
+      // The events up to the end of the ring in one record, then those from its start
+      while (tail < head) {
+
+          uint32_t first = tail & (RING_EVENTS - 1);
+          uint32_t count = (head - tail < RING_EVENTS - first) ? head - tail : RING_EVENTS - first;
+
+          if (log_file != NULL) {
+              fputc(RECORD_EVENTS, log_file);
+              fwrite(&count, sizeof(count), 1, log_file);
+              fwrite(&r->events[first], sizeof(log_event_t), count, log_file);
+          }
+          else {
+              for (uint32_t k = 0; k < count; k++) {
+                  char text[512];
+                  log_event_t *e = &r->events[first + k];
+                  format_message(text, sizeof(text), &formats[e->format], e);
+                  fprintf(stderr, "%s\n", text);
+              }
+          }
+          tail += count;
+      }
+      __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+      uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+      if (dropped > r->dropped_drained) {
+          uint64_t delta = dropped - r->dropped_drained;
+          if (log_file != NULL) {
+              fputc(RECORD_DROPPED, log_file);
+              fwrite(&r->id, sizeof(r->id), 1, log_file);
+              fwrite(&delta, sizeof(delta), 1, log_file);
+          }
+          else
+              fprintf(stderr, "debug log: %lu events dropped by thread %u\n", (unsigned long) delta, r->id);
+          r->dropped_drained = dropped;
+      }
+  }
+
+  fflush((log_file != NULL) ? log_file : stderr);
+}
+
+// Helper function-11: log_drainer() - background thread, drains the rings every DRAIN_INTERVAL_NS
+static void *log_drainer(void *arg) {
+
+  struct timespec next;
+
+  (void) arg;
+
+  pthread_mutex_lock(&drain_lock);
+
+  while (stopping == false) {
+
+      clock_gettime(CLOCK_MONOTONIC, &next);
+      next.tv_nsec += DRAIN_INTERVAL_NS;
+      if (next.tv_nsec >= 1000000000L) {
+          next.tv_sec += 1;
+          next.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&stop_cond, &drain_lock, &next);
+
+      drain_rings();
+  }
+
+  pthread_mutex_unlock(&drain_lock);
+  return NULL;
+}
+
+// Helper function-12: compare_events() - orders events by time, then by thread (for qsort)
+static int compare_events(const void *a, const void *b) {
+
+  const log_event_t *x = a;
+  const log_event_t *y = b;
+
+  if (x->time != y->time)
+      return (x->time > y->time) - (x->time < y->time);
+  return (x->thread > y->thread) - (x->thread < y->thread);
+}
+
+
+//// LOG Functions
+
+void enable_debug_log(void) {
+
+  pthread_once(&log_once, log_init);
+
+  pthread_mutex_lock(&drain_lock);
+
+  if (running == false) {
+      stopping = false;
+      if (pthread_create(&drainer, NULL, log_drainer, NULL) != 0)
+          errx(1, "failed to start the debug log thread");
+      if (stop_at_exit == false)
+          stop_at_exit = (atexit(stop_debug_log) == 0);
+      running = true;
+  }
+
+  __atomic_store_n(&debug_log_enabled, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&drain_lock);
+}
+
+void set_debug_logfile(const char *filename) {
+
+  pthread_once(&log_once, log_init);
+
+  pthread_mutex_lock(&drain_lock);
+
+  // What is recorded so far goes where it was headed
+  drain_rings();
+  if (log_file != NULL)
+      fclose(log_file);
+
+  log_file = fopen(filename, "w");
+  if (log_file == NULL)
+      err(1, "failed to open log file %s", filename);
+
+  fwrite(LOG_MAGIC, sizeof(LOG_MAGIC), 1, log_file);
+  fwrite(&log_start, sizeof(log_start), 1, log_file);
+  formats_written = 0;
+
+  pthread_mutex_unlock(&drain_lock);
+}
+
+void debug_log(const char *fmt, ...) {
+
+  if (__atomic_load_n(&debug_log_enabled, __ATOMIC_RELAXED) == 0)
+      return;
+
+  int id = format_id(fmt);
+  log_ring_t *r = (thread_ring != NULL) ? thread_ring : get_ring();
+
+  if ((id == -1) || (r == NULL))
+      return;
+
+  uint64_t head = r->head;
+
+  if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= RING_EVENTS) {
+      __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+      return;
+  }
+
+  log_event_t *e = &r->events[head & (RING_EVENTS - 1)];
+  const log_format_t *f = &formats[id];
+  int slot = 0;
+  va_list args;
+
+  e->time = now_ns();
+  e->format = id;
+  e->thread = r->id;
+
+  va_start(args, fmt);
+  for (int k = 0; k < f->num_convs; k++) {
+
+      double d;
+
+      switch (f->kinds[k]) {
+        case ARG_INT:
+          e->args[slot] = (unsigned int) va_arg(args, int);
+          break;
+        case ARG_LONG:
+          e->args[slot] = va_arg(args, long long);
+          break;
+        case ARG_PTR:
+          e->args[slot] = (uintptr_t) va_arg(args, void *);
+          break;
+        case ARG_DOUBLE:
+          d = va_arg(args, double);
+          memcpy(&e->args[slot], &d, sizeof(d));
+          break;
+        case ARG_STR: {
+          const char *s = va_arg(args, const char *);
+          char *to = (char *) &e->args[slot];
+          size_t n = (s != NULL) ? strnlen(s, DEBUG_LOG_MAX_STR - 1) : 0;
+          memcpy(to, s, n);
+          to[n] = '\0';
+          break;
+        }
+        default:
+          break;
+      }
+      slot += arg_slots(f->kinds[k]);
+  }
+  va_end(args);
+
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void stop_debug_log(void) {
+
+  pthread_mutex_lock(&drain_lock);
+
+  __atomic_store_n(&debug_log_enabled, 0, __ATOMIC_RELAXED);
+  bool was_running = running;
+  stopping = true;
+  running = false;
+  if (was_running == true)
+      pthread_cond_signal(&stop_cond);
+
+  pthread_mutex_unlock(&drain_lock);
+
+  if (was_running == true)
+      pthread_join(drainer, NULL);
+
+  // The events recorded while the thread was finishing
+  pthread_mutex_lock(&drain_lock);
+  drain_rings();
+  if (log_file != NULL)
+      fclose(log_file);
+  log_file = NULL;
+  pthread_mutex_unlock(&drain_lock);
+}
+
+
+//// DECODE Function - Prints a binary log file as text, in time order
+int decode_debug_log(const char *filename, FILE *out) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  char magic[sizeof(LOG_MAGIC)];
+  uint64_t start;
+  uint64_t dropped = 0;
+  log_event_t *events = NULL;
+  size_t num_events = 0, max_events = 0;
+  char *texts[MAX_FORMATS] = { NULL };
+  int rc = 1, tag;
+
+  FILE *f = fopen(filename, "r");
+  if (f == NULL)
+      return -1;
+
+  if ((fread(magic, sizeof(magic), 1, f) != 1) || (memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0) ||
+      (fread(&start, sizeof(start), 1, f) != 1)) {
+      fclose(f);
+      return -1;
+  }
+
+  // Formats may come after the first events using them, so every record is read first
+  while ((rc == 1) && ((tag = fgetc(f)) != EOF)) {
+
+      uint16_t id, len, thread;
+      uint32_t num;
+      uint64_t count = 0;
+
+      if (tag == RECORD_FORMAT) {
+          if ((fread(&id, sizeof(id), 1, f) != 1) || (fread(&len, sizeof(len), 1, f) != 1) ||
+              (id >= MAX_FORMATS) || ((texts[id] = calloc(len + 1, 1)) == NULL) ||
+              (fread(texts[id], 1, len, f) != len))
+              rc = -1;
+      }
+      else if (tag == RECORD_EVENTS) {
+          if ((fread(&num, sizeof(num), 1, f) != 1) || (num > RING_EVENTS)) {
+              rc = -1;
+              break;
+          }
+          while (num_events + num > max_events) {
+              max_events = max_events ? 2 * max_events : 4096;
+              log_event_t *more = realloc(events, max_events * sizeof(log_event_t));
+              if (more == NULL) {
+                  rc = -1;
+                  break;
+              }
+              events = more;
+          }
+          if ((rc == 1) && (fread(&events[num_events], sizeof(log_event_t), num, f) != num))
+              rc = -1;
+          num_events += (rc == 1) ? num : 0;
+      }
+      else if (tag == RECORD_DROPPED) {
+          if ((fread(&thread, sizeof(thread), 1, f) != 1) || (fread(&count, sizeof(count), 1, f) != 1))
+              rc = -1;
+          dropped += count;
+      }
+      else
+          rc = -1;
+  }
+  fclose(f);
+
+  if (num_events > 0)
+      qsort(events, num_events, sizeof(log_event_t), compare_events);
+
+  for (size_t i = 0; (rc == 1) && (i < num_events); i++) {
+
+      log_event_t *e = &events[i];
+      char text[512];
+
+      if ((e->format < MAX_FORMATS) && (texts[e->format] != NULL)) {
+          log_format_t format;
+          parse_format(texts[e->format], &format);
+          format_message(text, sizeof(text), &format, e);
+      }
+      else
+          snprintf(text, sizeof(text), "<unknown format %u>", e->format);
+
+      fprintf(out, "[%12.6f] %3u: %s\n", (e->time - start) / 1e9, e->thread, text);
+  }
+
+  if ((rc == 1) && (dropped > 0))
+      fprintf(out, "%lu events dropped\n", (unsigned long) dropped);
+
+  for (int i = 0; i < MAX_FORMATS; i++)
+      free(texts[i]);
+  free(events);
+  return rc;
+}
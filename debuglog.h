@@ -0,0 +1,45 @@
+#ifndef DEBUGLOG_H_
+#define DEBUGLOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* The debug log records each message as a compact binary event (timestamp,
+ * format id and arguments) into a lock-free ring buffer of the calling
+ * thread; a background thread drains the rings into the log file, or formats
+ * them to stderr when no file is set. A message costs tens of nanoseconds,
+ * so tracing can stay on under load. Events are dropped, and counted, when a
+ * ring is full.
+ *
+ * The format of a message must be a string that outlives the log (a literal,
+ * typically), since it is recorded by address. Its conversions may be
+ * integers of any size (d, i, u, o, x, X, c), pointers (p), doubles (f, e, g,
+ * a), and strings (s), which are copied up to DEBUG_LOG_MAX_STR - 1 bytes;
+ * '*' widths and precisions are not supported. Each integer, pointer or
+ * double takes one of the DEBUG_LOG_MAX_ARGS argument slots of an event, and
+ * a string three (enough for the command names of the JBOD's own messages);
+ * conversions past the last slot print empty. */
+#define DEBUG_LOG_MAX_ARGS 6
+#define DEBUG_LOG_MAX_STR 24
+
+/* Starts recording messages, and the thread draining them. */
+void enable_debug_log(void);
+
+/* Sends the log to the binary log file |filename|, read back with
+ * decode_debug_log, instead of stderr. */
+void set_debug_logfile(const char *filename);
+
+/* Records a message (printf-style, see above). A line break is added when it
+ * is printed. Does nothing unless the log is enabled. */
+void debug_log(const char *fmt, ...);
+
+/* Drains what is left in the rings, stops the draining thread and closes the
+ * log file. Called at exit once the log was enabled. */
+void stop_debug_log(void);
+
+/* Prints the messages of the binary log file |filename| to |out|, in time
+ * order, each with its time in seconds since the log started and the number
+ * of the thread that recorded it. Returns 1 on success and -1 on failure. */
+int decode_debug_log(const char *filename, FILE *out);
+
+#endif
@@ -0,0 +1,55 @@
+#include "geometry.h"
+
+/* Implementing the Geometry of a linear volume: address translation, with shifts where it can */
+
+
+//// HELPER Functions ////
+
+// Helper function-1: is_pow2() - whether 'n' is a power of two
+static bool is_pow2(uint32_t n) {
+  return (n != 0) && ((n & (n - 1)) == 0);
+}
+
+
+//// Geometry Functions
+
+int geometry_init(geometry_t *geometry, uint32_t num_disks, uint32_t blocks_per_disk, uint32_t block_size) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  if ((num_disks == 0) || (blocks_per_disk == 0) || (block_size == 0))
+      return -1;
+
+  // Linear addresses are 32-bit
+  if ((uint64_t) num_disks * blocks_per_disk * block_size > UINT32_MAX)
+      return -1;
+
+  geometry->num_disks = num_disks;
+  geometry->blocks_per_disk = blocks_per_disk;
+  geometry->block_size = block_size;
+  geometry->jbod = (blocks_per_disk == JBOD_NUM_BLOCKS_PER_DISK) && (block_size == JBOD_BLOCK_SIZE);
+  geometry->pow2 = is_pow2(blocks_per_disk) && is_pow2(block_size);
+  geometry->block_shift = geometry->pow2 ? __builtin_ctz(block_size) : 0;
+  geometry->disk_shift = geometry->pow2 ? __builtin_ctz(blocks_per_disk) + geometry->block_shift : 0;
+
+  return 1;
+}
+
+uint32_t geometry_size(const geometry_t *geometry) {
+  return geometry->num_disks * geometry->blocks_per_disk * geometry->block_size;
+}
+
+uint32_t geometry_num_blocks(const geometry_t *geometry) {
+  return geometry->num_disks * geometry->blocks_per_disk;
+}
+
+void geometry_translate_generic(const geometry_t *geometry, uint32_t addr, int *disk_num, int *block_num,
+                                int *offset) {
+
+  uint32_t disk_size = geometry->blocks_per_disk * geometry->block_size;
+  uint32_t disk_offset = addr % disk_size;
+
+  *disk_num = addr / disk_size;
+  *block_num = disk_offset / geometry->block_size;
+  *offset = disk_offset % geometry->block_size;
+}
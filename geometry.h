@@ -0,0 +1,102 @@
+#ifndef GEOMETRY_H_
+#define GEOMETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jbod.h"
+
+/* The geometry of a linear volume: |num_disks| disks of |blocks_per_disk|
+ * blocks of |block_size| bytes, addressed as one run of bytes, disk after
+ * disk. Translating an address takes shifts and masks when the block size
+ * and the blocks of a disk are powers of two, with the constants of the JBOD
+ * (jbod.h) when the geometry has its blocks and disks, and a division
+ * otherwise. The number of disks is free (a volume striped across several
+ * JBODs has JBOD_NUM_DISKS disks for each of them). */
+typedef struct {
+  uint32_t num_disks;
+  uint32_t blocks_per_disk;
+  uint32_t block_size;
+  bool jbod;        /* blocks per disk and block size are the JBOD's */
+  bool pow2;        /* blocks per disk and block size are powers of two */
+  int block_shift;  /* log2(block_size), when pow2 */
+  int disk_shift;   /* log2(blocks_per_disk * block_size), when pow2 */
+} geometry_t;
+
+/* The JBOD geometry is specialized at compile time when it is made of powers
+ * of two, as it is by default. */
+#if ((JBOD_BLOCK_SIZE & (JBOD_BLOCK_SIZE - 1)) == 0) && \
+    ((JBOD_NUM_BLOCKS_PER_DISK & (JBOD_NUM_BLOCKS_PER_DISK - 1)) == 0)
+#define GEOMETRY_JBOD_POW2 1
+#define GEOMETRY_JBOD_BLOCK_SHIFT __builtin_ctz(JBOD_BLOCK_SIZE)
+#define GEOMETRY_JBOD_DISK_SHIFT __builtin_ctz(JBOD_DISK_SIZE)
+#else
+#define GEOMETRY_JBOD_POW2 0
+#endif
+
+/* A static initializer for a geometry of |disks| JBOD disks. */
+#define GEOMETRY_JBOD(disks)                                            \
+  { .num_disks = (disks), .blocks_per_disk = JBOD_NUM_BLOCKS_PER_DISK,  \
+    .block_size = JBOD_BLOCK_SIZE, .jbod = true, .pow2 = GEOMETRY_JBOD_POW2, \
+    .block_shift = __builtin_ctz(JBOD_BLOCK_SIZE),                     \
+    .disk_shift = __builtin_ctz(JBOD_DISK_SIZE) }
+
+/* Sets up |geometry| for |num_disks| disks of |blocks_per_disk| blocks of
+ * |block_size| bytes, none of them 0, and a volume of less than 4 GiB.
+ * Returns 1 on success and -1 on failure. */
+int geometry_init(geometry_t *geometry, uint32_t num_disks, uint32_t blocks_per_disk, uint32_t block_size);
+
+/* Returns the size of the volume, in bytes. */
+uint32_t geometry_size(const geometry_t *geometry);
+
+/* Returns the number of blocks of the volume. */
+uint32_t geometry_num_blocks(const geometry_t *geometry);
+
+/* The generic path of geometry_translate, with divisions. */
+void geometry_translate_generic(const geometry_t *geometry, uint32_t addr, int *disk_num, int *block_num,
+                                int *offset);
+
+/* Translates the linear address |addr| to its disk, block of the disk, and
+ * offset in the block. */
+static inline void geometry_translate(const geometry_t *geometry, uint32_t addr, int *disk_num, int *block_num,
+                                      int *offset) {
+#if GEOMETRY_JBOD_POW2
+  if (geometry->jbod) {
+    *disk_num = addr >> GEOMETRY_JBOD_DISK_SHIFT;
+    *block_num = (addr & (JBOD_DISK_SIZE - 1)) >> GEOMETRY_JBOD_BLOCK_SHIFT;
+    *offset = addr & (JBOD_BLOCK_SIZE - 1);
+    return;
+  }
+#endif
+  if (geometry->pow2) {
+    *disk_num = addr >> geometry->disk_shift;
+    *block_num = (addr & ((1u << geometry->disk_shift) - 1)) >> geometry->block_shift;
+    *offset = addr & (geometry->block_size - 1);
+    return;
+  }
+  geometry_translate_generic(geometry, addr, disk_num, block_num, offset);
+}
+
+/* Returns the linear block number of block |block_num| of disk |disk_num|. */
+static inline uint32_t geometry_block(const geometry_t *geometry, int disk_num, int block_num) {
+#if GEOMETRY_JBOD_POW2
+  if (geometry->jbod)
+    return ((uint32_t) disk_num << (GEOMETRY_JBOD_DISK_SHIFT - GEOMETRY_JBOD_BLOCK_SHIFT)) | (uint32_t) block_num;
+#endif
+  if (geometry->pow2)
+    return ((uint32_t) disk_num << (geometry->disk_shift - geometry->block_shift)) | (uint32_t) block_num;
+  return (uint32_t) disk_num * geometry->blocks_per_disk + (uint32_t) block_num;
+}
+
+/* Returns the linear block number of the linear address |addr|. */
+static inline uint32_t geometry_block_of(const geometry_t *geometry, uint32_t addr) {
+#if GEOMETRY_JBOD_POW2
+  if (geometry->jbod)
+    return addr >> GEOMETRY_JBOD_BLOCK_SHIFT;
+#endif
+  if (geometry->pow2)
+    return addr >> geometry->block_shift;
+  return addr / geometry->block_size;
+}
+
+#endif
@@ -0,0 +1,109 @@
+#include "layout.h"
+
+/* Implementing the Layout of a volume on its JBOD servers, and the JBOD head model */
+
+
+//// Layout INIT Function
+int layout_init(layout_t *layout, int num_members, int stripe_blocks) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  if ((num_members < 1) || (num_members > LAYOUT_MAX_MEMBERS))
+      return -1;
+
+  // A stripe unit has to tile a member exactly, or its last blocks would be unreachable
+  if ((stripe_blocks < 1) || (LAYOUT_MEMBER_BLOCKS % stripe_blocks != 0))
+      return -1;
+
+  layout->num_members = num_members;
+  layout->stripe_blocks = stripe_blocks;
+  layout->mirrored = false;
+
+  return 1;
+}
+
+
+//// Layout INIT MIRRORED Function
+int layout_init_mirrored(layout_t *layout, int num_members) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  // A single copy is no mirror
+  if ((num_members < 2) || (num_members > LAYOUT_MAX_MEMBERS))
+      return -1;
+
+  layout->num_members = num_members;
+  layout->stripe_blocks = LAYOUT_MEMBER_BLOCKS;
+  layout->mirrored = true;
+
+  return 1;
+}
+
+
+//// Layout NUM BLOCKS Function
+uint32_t layout_num_blocks(const layout_t *layout) {
+
+  // The members of a mirrored volume add copies, not blocks
+  if (layout->mirrored == true)
+      return LAYOUT_MEMBER_BLOCKS;
+
+  return (uint32_t) layout->num_members * LAYOUT_MEMBER_BLOCKS;
+}
+
+
+//// Layout MAP Function - Translates a linear block to its member, disk & block numbers
+void layout_map(const layout_t *layout, uint32_t linear_block, layout_loc_t *loc) {
+
+  uint32_t member_block = linear_block;
+
+  loc->member = 0;
+
+  // Stripe unit 'stripe' goes to member 'stripe % num_members', as its 'stripe / num_members'th unit
+  if ((layout->num_members > 1) && (layout->mirrored == false)) {
+      uint32_t stripe = linear_block / layout->stripe_blocks;
+
+      loc->member = stripe % layout->num_members;
+      member_block = (stripe / layout->num_members) * layout->stripe_blocks +
+                     linear_block % layout->stripe_blocks;
+  }
+
+  loc->disk_num = member_block / JBOD_NUM_BLOCKS_PER_DISK;
+  loc->block_num = member_block % JBOD_NUM_BLOCKS_PER_DISK;
+}
+
+
+//// Layout SEEK Function - Seeks needed to position the JBOD, skipping the redundant ones
+int layout_seek(layout_head_t *head, int disk_num, int block_num) {
+
+  int seeks = 0;
+
+  // Seek to a specific disk, which also positions the JBOD at block 0
+  if ((head->valid == false) || (head->disk_num != disk_num)) {
+      seeks |= LAYOUT_SEEK_DISK;
+
+      head->valid = true;
+      head->disk_num = disk_num;
+      head->block_num = 0;
+  }
+
+  // Seek to a specific block in current disk
+  if (head->block_num != block_num) {
+      seeks |= LAYOUT_SEEK_BLOCK;
+
+      head->block_num = block_num;
+  }
+
+  return seeks;
+}
+
+
+//// Layout ADVANCE Function
+void layout_advance(layout_head_t *head) {
+  head->block_num += 1;	// JBOD moves on to the next block after a read or write
+}
+
+
+//// Layout INVALIDATE Function
+void layout_invalidate(layout_head_t *head) {
+  head->valid = false;
+}
@@ -0,0 +1,74 @@
+#ifndef LAYOUT_H_
+#define LAYOUT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jbod.h"
+
+/* Maximum number of JBOD servers a volume is striped across. */
+#define LAYOUT_MAX_MEMBERS 16
+
+/* Blocks held by one member (one JBOD server). */
+#define LAYOUT_MEMBER_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+
+/* How the linear blocks of a volume are laid out on its members: in stripe
+ * units of |stripe_blocks| consecutive blocks, handed to the members in turn
+ * (RAID-0). A single member holds the blocks in linear order, and so does
+ * every member of a mirrored volume (RAID-1), each holding a copy of all of
+ * them. */
+typedef struct {
+  int num_members;
+  int stripe_blocks;
+  bool mirrored;   /* every member holds every block */
+} layout_t;
+
+/* Where a linear block lives; on a mirrored volume, on every member. */
+typedef struct {
+  int member;      /* index of the member (server) */
+  int disk_num;    /* disk of the member */
+  int block_num;   /* block of the disk */
+} layout_loc_t;
+
+/* Model of the I/O position of a member's JBOD, so that redundant seeks are
+ * not sent over the network. The JBOD advances its block position after
+ * every block read or write, and a seek to a disk positions it at block 0 of
+ * that disk. */
+typedef struct {
+  bool valid;      /* disk_num and block_num are known to match the JBOD */
+  int disk_num;
+  int block_num;
+} layout_head_t;
+
+/* Seeks returned by layout_seek. */
+#define LAYOUT_SEEK_DISK  0x1
+#define LAYOUT_SEEK_BLOCK 0x2
+
+/* Returns 1 on success and -1 on failure. Sets up |layout| for
+ * |num_members| members, striped in units of |stripe_blocks| blocks, which
+ * must divide LAYOUT_MEMBER_BLOCKS. */
+int layout_init(layout_t *layout, int num_members, int stripe_blocks);
+
+/* Returns 1 on success and -1 on failure. Sets up |layout| for a volume
+ * mirrored on |num_members| members, from 2 to LAYOUT_MAX_MEMBERS. */
+int layout_init_mirrored(layout_t *layout, int num_members);
+
+/* Returns the number of linear blocks of the volume. */
+uint32_t layout_num_blocks(const layout_t *layout);
+
+/* Finds where the linear block |linear_block| lives. On a mirrored volume,
+ * the member is the first one; the disk and block are the same on all. */
+void layout_map(const layout_t *layout, uint32_t linear_block, layout_loc_t *loc);
+
+/* Returns the seeks (LAYOUT_SEEK_DISK and/or LAYOUT_SEEK_BLOCK) needed to
+ * position the JBOD modelled by |head| at |disk_num| and |block_num|, and
+ * moves the model there as if they had been done. */
+int layout_seek(layout_head_t *head, int disk_num, int block_num);
+
+/* Moves the model on by one block, after a block read or write. */
+void layout_advance(layout_head_t *head);
+
+/* Forgets the position; the next access seeks to both disk and block. */
+void layout_invalidate(layout_head_t *head);
+
+#endif
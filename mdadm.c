@@ -1,184 +1,489 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <stddef.h>
 
 #include "mdadm.h"
 #include "jbod.h"
 #include "net.h"
+#include "readahead.h"
+#include "layout.h"
+#include "stats.h"
+#include "combine.h"
+#include "geometry.h"
+
+#define HEDGE_SAMPLES 256	// Read latencies the hedging threshold of a context is taken from
+#define HEDGE_UPDATE 64		// Read latencies timed between two updates of the threshold
+
+// A JBOD server holding part of a volume, or a copy of it
+typedef struct {
+    jbod_conn_t *conn;		// connection owned by the context, NULL for the default connection
+    layout_head_t head;		// model of the JBOD I/O position, to skip redundant seeks
+    int inflight;		// asynchronous operations queued and not completed yet
+} member_t;
+
+// An mdadm context: a volume over one or more JBOD servers, its mount state and its Cache. The
+// lock serializes the I/O of the context (each connection and head model is one stream of
+// operations); the Cache, which may be shared with other contexts, has a lock of its own.
+struct mdadm_ctx {
+    geometry_t geometry;	// disks, blocks and block size of the linear volume
+    layout_t layout;		// how the linear blocks are laid out on the members
+    member_t members[LAYOUT_MAX_MEMBERS];
+    cache_t *cache;		// Cache of the context, NULL if none
+    bool default_cache;		// use the default Cache (cache_create), whichever is current
+    int mounted;		// 1 when the linear device is 'Mounted'
+    pthread_mutex_t lock;
+
+    // Asynchronous requests (see mdadm_ctx_submit_read)
+    jbod_loop_t *loop;		// event loop over the member connections, created on first use
+    int outstanding;		// requests submitted and not completed yet
+    mdadm_req_t *done_head;	// requests completed and not reaped by mdadm_ctx_poll() yet
+    mdadm_req_t *done_tail;
+    uint16_t *pending_writes;	// per linear block, asynchronous writes not completed yet
+
+    combine_t combine;		// blocks written in part, not in JBOD yet (see mdadm_ctx_set_write_combining)
+
+    // Hedged reads of a mirrored volume (see mdadm_ctx_set_hedging)
+    double hedge_percentile;	// percentile of the read latencies a read is hedged past, 0 if never
+    uint64_t hedge_after_ns;	// that percentile, 0 until HEDGE_SAMPLES reads were timed
+    uint64_t hedge_samples[HEDGE_SAMPLES];	// latest latencies (ns) of the first try of a read, a ring
+    uint64_t num_hedge_samples;
+    int strays;			// hedged reads whose late tries are still in flight
+};
+
+// A batch of JBOD operations for each member, sent to the servers as one pipelined round trip
+// during which they all work at the same time
+typedef struct {
+    jbod_request_t reqs[LAYOUT_MAX_MEMBERS][JBOD_BATCH_MAX];
+    uint32_t blocks[LAYOUT_MAX_MEMBERS][JBOD_BATCH_MAX];	// linear block of each block read or write
+    int num_reqs[LAYOUT_MAX_MEMBERS];
+} op_batch_t;
 
 // Function declarations
 uint32_t encode_operation(jbod_cmd_t cmd, int disk_num, int block_num);
-void translate_address(uint32_t linear_addr, int *disk_num, int *block_num, int *offset);
-void seek(int disk_num, int block_num);
+void translate_address(mdadm_ctx_t *ctx, uint32_t linear_addr, int *disk_num, int *block_num, int *offset);
+int read_block(mdadm_ctx_t *ctx, int disk_num, int block_num, uint8_t *block);
+int write_block(mdadm_ctx_t *ctx, int disk_num, int block_num, uint8_t *block);
+void invalidate_head(mdadm_ctx_t *ctx);
+int writeback_block(void *arg, int disk_num, int block_num, const uint8_t *block);
+int prefetch_block(uint32_t linear_block);
+static int do_mount(mdadm_ctx_t *ctx);
+static int do_unmount(mdadm_ctx_t *ctx);
+static int do_read(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf);
+static int do_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf);
+static int read_span(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf, uint8_t *last_block);
+static int write_span(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf, uint8_t *last_block);
+static int read_cached(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf);
+static int do_flush(mdadm_ctx_t *ctx);
+static int combine_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf);
+static int flush_combined(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len);
+static int flush_left_behind(mdadm_ctx_t *ctx, uint32_t addr);
+static void batch_init(op_batch_t *batch);
+static int batch_add(op_batch_t *batch, int member, uint32_t op, uint8_t *block);
+static int batch_block_op(mdadm_ctx_t *ctx, op_batch_t *batch, jbod_cmd_t cmd, int disk_num, int block_num, uint8_t *block);
+static jbod_request_t *batch_req(op_batch_t *batch, int ref);
+static int batch_run(mdadm_ctx_t *ctx, op_batch_t *batch);
+static void async_drain(mdadm_ctx_t *ctx);
+static void async_stop(mdadm_ctx_t *ctx);
+static int async_start(mdadm_ctx_t *ctx);
+static int mirror_pick(mdadm_ctx_t *ctx, const op_batch_t *batch, int disk_num, int block_num, int skip);
+static int run_hedged(mdadm_ctx_t *ctx, op_batch_t *batch);
 
 // Global Variables declaration
-int Mount_flag = 0; 	// Initializing to 0 as the device is initially in 'Unmounted' state
+
+// The context of mdadm_mount(), mdadm_read() etc.: the connection of jbod_connect() and the
+// Cache of cache_create(). The readahead thread prefetches for this context only.
+static mdadm_ctx_t default_ctx = {
+    .geometry = GEOMETRY_JBOD(JBOD_NUM_DISKS),
+    .layout = { .num_members = 1, .stripe_blocks = 1 },
+    .members = { { .conn = NULL } },
+    .cache = NULL,
+    .default_cache = true,
+    .mounted = 0,	// the device is initially in 'Unmounted' state
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Incremented by every write of any context, so that a stream can tell whether its copy of a
+// block is still current
+static uint64_t write_generation = 0;
+
+// I/O and seek counters of every context (the fields of mdadm_stats_t before 'cache')
+static mdadm_stats_t io_stats;
+
+// A cursor over the linear device, for I/O of any length (see mdadm_open_stream)
+struct mdadm_stream {
+    mdadm_ctx_t *ctx;		// context the stream does its I/O through
+    uint32_t pos;		// linear address of the next byte to read or write
+    int64_t block_num;		// linear block number of the copy in 'block', -1 if there is none
+    uint64_t generation;	// 'write_generation' when the copy was taken
+    uint8_t block[JBOD_BLOCK_SIZE];	// last block the stream touched, so that the next call
+				// can carry on inside it without fetching it again
+};
 
 // Declaring CONSTANTS
+#define SPAN_MAX_BLOCKS 16	// Blocks handled per span; covers an I/O of MAX_SIZE bytes at any offset
+#define REQ_MAX_BLOCKS 5	// Blocks touched by an asynchronous request of MAX_SIZE bytes at any offset
+#define BLOCK_MAX_AOPS (3 + 3 * LAYOUT_MAX_MEMBERS)	// JBOD operations per block of a request: seeks and
+				// read, seeks and write on every replica of a mirrored volume
+#define POLL_MAX_REQS 64	// Requests reaped per poll
 const int MAX_SIZE = 1024; 		// Maximum size (in bytes) of 'len' to read or write
 const int COMMAND_BIT_START_POS = 26;	// JBOD: Command field - start position
 const int DISKID_BIT_POS = 22; 		// JBOD: Disk ID field - start position
 const int BLOCKID_BIT_POS = 0;		// JBOD: Block ID field - start position
 
+// A block touched by an asynchronous request, with the JBOD operations it takes
+typedef struct {
+    mdadm_req_t *req;
+    int disk_number, block_number;	// on the linear device
+    int offset, chunk;		// bytes of the request within the block
+    uint32_t pos;		// where those bytes are within the request
+    uint8_t data[JBOD_BLOCK_SIZE];	// the block read from JBOD, or to be written into it
+    jbod_aop_t aops[BLOCK_MAX_AOPS];
+    uint8_t aop_member[BLOCK_MAX_AOPS];	// member each operation is queued on
+    int num_aops;
+    jbod_aop_t *fetch;		// read of the block, or NULL
+    uint64_t stores;		// bit i set when aops[i] writes the block (on every replica of a mirrored
+				// volume); the writes are held back until 'data' is complete
+    int stores_left;		// writes of the block not completed yet
+} req_block_t;
+
+// An asynchronous read or write (see mdadm_ctx_submit_read)
+struct mdadm_req {
+    mdadm_ctx_t *ctx;
+    bool write;
+    uint32_t addr, len;
+    uint8_t *buf;		// where a read goes
+    uint8_t wbuf[REQ_MAX_BLOCKS * JBOD_BLOCK_SIZE];	// copy of the data of a write
+    int result;			// 'len' on success, -1 on failure
+    int pending;		// JBOD operations not completed yet
+    req_block_t blocks[REQ_MAX_BLOCKS];
+    int num_blocks;
+    mdadm_req_done_fn done;
+    void *arg;
+    mdadm_req_t *next;		// in the done list of the context
+};
+
+
+//// CONTEXT helpers
+
+// Cache used by the context, NULL if none
+static cache_t *ctx_cache(mdadm_ctx_t *ctx) {
+    return ctx->default_cache ? cache_default() : ctx->cache;
+}
+
+// Connection to a member of the context
+static jbod_conn_t *member_conn(mdadm_ctx_t *ctx, int member) {
+    return (ctx->members[member].conn != NULL) ? ctx->members[member].conn : jbod_default_conn();
+}
+
+// Size of the linear device of the context, in bytes
+static uint32_t ctx_size(mdadm_ctx_t *ctx) {
+    return geometry_size(&ctx->geometry);
+}
+
+// Sends the same command (mount or unmount) to every member; returns 0 on success and -1 on failure.
+// 'done' receives, for each member, whether the command succeeded there.
+static int member_command(mdadm_ctx_t *ctx, jbod_cmd_t cmd, const bool *only, bool *done) {
+
+    op_batch_t batch;
+    int m, ref[LAYOUT_MAX_MEMBERS];
+
+    batch_init(&batch);
+    for (m = 0; m < ctx->layout.num_members; m++) {
+        ref[m] = -1;
+        if ((only == NULL) || (only[m] == true))
+            ref[m] = batch_add(&batch, m, encode_operation(cmd, 0, 0), NULL);
+    }
+
+    int rc = batch_run(ctx, &batch);
+
+    for (m = 0; m < ctx->layout.num_members; m++)
+        done[m] = (ref[m] != -1) && (batch_req(&batch, ref[m])->result == 0);
+
+    return rc;
+}
+
+// Whether the context is mounted; readable without the context lock
+static int ctx_mounted(mdadm_ctx_t *ctx) {
+    return __atomic_load_n(&ctx->mounted, __ATOMIC_ACQUIRE);
+}
+
+static void set_mounted(mdadm_ctx_t *ctx, int mounted) {
+    __atomic_store_n(&ctx->mounted, mounted, __ATOMIC_RELEASE);
+}
+
+
+//// STATISTICS helpers - relaxed atomic increments, cheap enough to always count
+
+// Counts a read or write of 'len' bytes that succeeded; streamed I/O longer than MAX_SIZE goes
+// in the last size class
+static void count_io(bool write, uint32_t len) {
+
+    int size_class = (len <= 1) ? 0 : 32 - __builtin_clz(len - 1);
+
+    if (size_class >= MDADM_STATS_IO_SIZES)
+        size_class = MDADM_STATS_IO_SIZES - 1;
+
+    __atomic_add_fetch(write ? &io_stats.writes : &io_stats.reads, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(write ? &io_stats.bytes_written : &io_stats.bytes_read, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&io_stats.io_sizes[size_class], 1, __ATOMIC_RELAXED);
+}
+
+// Counts the seeks a block operation needed (LAYOUT_SEEK_*), and those the head model saved
+static void count_seeks(int seeks) {
+
+    int issued = __builtin_popcount(seeks);
+
+    __atomic_add_fetch(&io_stats.seeks_issued, issued, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&io_stats.seeks_avoided, 2 - issued, __ATOMIC_RELAXED);
+}
+
 
 //// MOUNT Function - Mount the linear device
-int mdadm_mount(void) {
+static int do_mount(mdadm_ctx_t *ctx) {
   
     // This function to return 1 on Success and -1 on Failure
 
     // If disk is already in 'Mounted' state, then return -1
-    if (Mount_flag == 1)
+    if (ctx->mounted == 1)
     	return -1;
 
-    // Perform JBOD Mount operation
-    uint32_t op = encode_operation(JBOD_MOUNT, 0, 0); // global value: JBOD_MOUNT = 0
-    if (jbod_client_operation(op, NULL) == 0)
-    	Mount_flag = 1; // If JBOD Mount is successful, then set global 'Mount_flag' to 1
-    else
-    	Mount_flag = 0;
+    // Dirty blocks evicted from a write-back Cache are written into JBOD through this context.
+    // A write-back Cache has one owner, so it cannot be mounted by a second context.
+    if (ctx->default_cache == true)
+        cache_set_writeback(writeback_block, ctx);
+    else if ((ctx->cache != NULL) && (cache_set_writeback_in(ctx->cache, writeback_block, ctx) == -1))
+        return -1;
+
+    // Perform JBOD Mount operation on every member. JBOD_MOUNT = 0
+    bool mounted[LAYOUT_MAX_MEMBERS], unmounted[LAYOUT_MAX_MEMBERS];
+    invalidate_head(ctx);
+    __atomic_add_fetch(&write_generation, 1, __ATOMIC_RELAXED);	// the device may have been written meanwhile
+    if (member_command(ctx, JBOD_MOUNT, NULL, mounted) == 0)
+    	set_mounted(ctx, 1); // If JBOD Mount is successful, then set 'mounted' to 1
+    else {
+    	// A volume is mounted whole or not at all
+    	member_command(ctx, JBOD_UNMOUNT, mounted, unmounted);
+    	set_mounted(ctx, 0);
+    }
 
     // Check status of 'Mount' operation
-    if (Mount_flag == 1)
+    if (ctx->mounted == 1)
         return 1;		// when Mount is successful, return 1
     else
         return -1;
 }
 
 //// UNMOUNT Function - Unmount the linear device
-int mdadm_unmount(void) {
+static int do_unmount(mdadm_ctx_t *ctx) {
   
     // This function to return 1 on Success and -1 on Failure
 
     // If disk is already in 'Unmounted' state, then return -1
-    if (Mount_flag == 0)
+    if (ctx->mounted == 0)
     	return -1;
 
-    // Perform JBOD Unmount operation
-    uint32_t op = encode_operation(JBOD_UNMOUNT, 0, 0); // global value: JBOD_UNMOUNT = 1
+    // Complete the asynchronous requests, then write the dirty blocks of a write-back Cache into
+    // JBOD before it goes away
+    async_stop(ctx);
+    if (do_flush(ctx) == -1)
+        return -1;
+
+    // Perform JBOD Unmount operation on every member. JBOD_UNMOUNT = 1
+    bool unmounted[LAYOUT_MAX_MEMBERS];
+    invalidate_head(ctx);
 
-    if (jbod_client_operation(op, NULL) == 0)
-        Mount_flag = 0; // If JBOD Unmount is successful, then set global 'Mount_flag' to 0
+    if (member_command(ctx, JBOD_UNMOUNT, NULL, unmounted) == 0)
+        set_mounted(ctx, 0); // If JBOD Unmount is successful, then set 'mounted' to 0
     else
-        Mount_flag = 1; // If err in Unmount, then let the global 'Mount_flag' remain unchanged.
+        set_mounted(ctx, 1); // If err in Unmount, then let 'mounted' remain unchanged.
 
     // Check status of 'Unmount' operation
-    if (Mount_flag == 0)
+    if (ctx->mounted == 0) {
+
+        // Let another context take over a write-back Cache
+        if ((ctx->default_cache == false) && (ctx->cache != NULL))
+            cache_set_writeback_in(ctx->cache, NULL, NULL);
+
         return 1;		// when Unmount is successful, return 1
+    }
     else
         return -1;
 }
 
 //// READ Function - Reads the block in current I/O position into the buffer
 //// Read 'len' bytes into 'buf' starting at 'addr'
-int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+static int do_read(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf) {
   
     // Return the 'number of bytes read' on Success, and -1 on Failure
 
     // If the disk is in 'Unmounted' state, then return -1
-    if (Mount_flag == 0)
+    if (ctx_mounted(ctx) == 0)
     	return -1;
 
     //// Validate the Input parameters
 
     // Return -1; on read from an out-of-bound linear address
     // JBOD_NUM_DISKS = 16, JBOD_DISK_SIZE = 65536
-    if ((addr + len) >= (JBOD_NUM_DISKS * JBOD_DISK_SIZE))
+    if ((addr + len) >= ctx_size(ctx))
     	return -1;
 
     // Return -1; on read larger than the specified bytes MAX_SIZE
-    if (len > MAX_SIZE)
+    if (len > (uint32_t) MAX_SIZE)
     	return -1;
 
     if (len && buf == NULL)
     	return -1;
 
+    // Blocks of the write-combining buffer that the read touches go into JBOD first
+    if (__atomic_load_n(&ctx->combine.num_used, __ATOMIC_RELAXED) > 0) {
+
+        pthread_mutex_lock(&ctx->lock);
+        async_drain(ctx);
+        int rc = (ctx->mounted == 1) ? flush_combined(ctx, addr, len) : -1;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (rc == -1)
+            return -1;
+    }
+
+    // All the blocks in the Cache: served without taking the context lock, unless asynchronous
+    // requests are in flight, which may write them
+    if ((__atomic_load_n(&ctx->outstanding, __ATOMIC_RELAXED) > 0) || (read_cached(ctx, addr, len, buf) == -1)) {
+
+        pthread_mutex_lock(&ctx->lock);
+        async_drain(ctx);
+        int rc = -1;
+        if ((ctx->mounted == 1) && (flush_left_behind(ctx, addr) == 0))
+            rc = read_span(ctx, addr, len, buf, NULL);
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (rc == -1)
+            return -1;
+    }
+
+    // Let the stream detector see the read, so that it can prefetch the blocks ahead of it
+    if ((ctx == &default_ctx) && (cache_enabled() == true))
+        readahead_observe(addr, len);
+
+    count_io(false, len);
+
+    // On success, return the 'number of bytes'
+    return len;
+}
+
+//// READ SPAN Function - Reads 'len' bytes at 'addr' into 'buf', touching at most SPAN_MAX_BLOCKS
+//// blocks. When 'last_block' is not NULL, the whole last block touched is copied into it.
+//// Returns 0 on success and -1 on failure.
+static int read_span(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf, uint8_t *last_block) {
+
     // Declaring & initializing the local variables
-    int curr_addr = addr; // current address set after every read operation
-    uint32_t length = len;
-    uint32_t available_block_length = 0;
+    uint32_t curr_addr = addr; // current address set after every read operation
+    uint32_t length = len;     // length; pending to be copied into 'buf'
     uint32_t copied_buf_length = 0;
-    uint8_t tmp[JBOD_BLOCK_SIZE]; // JBOD_BLOCK_SIZE = 256
-    int disk_number;
-    int block_number;
-    int offset;
-    int read_flag = 0;	// read_flag set to 1 or 2; based on the data read from disks & blocks.
-    int retval; 	// return value of cache_lookup() function.
-    int returnval; 	// return value of cache_insert() function.
+    uint32_t chunk;            // bytes of 'buf' served by the current block
+    uint8_t blocks[SPAN_MAX_BLOCKS][JBOD_BLOCK_SIZE]; // JBOD_BLOCK_SIZE = 256
+    int disk_number[SPAN_MAX_BLOCKS];
+    int block_number[SPAN_MAX_BLOCKS];
+    int offset[SPAN_MAX_BLOCKS];
+    int read_req[SPAN_MAX_BLOCKS];  // reference to the block's read in 'batch', or -1 if found in Cache
+    int num_blocks = 0;
+    int i, rc = 0;
+    op_batch_t batch;
+    cache_t *cache = ctx_cache(ctx);
+
+    batch_init(&batch);
+
+    //// Pass 1:- Translate linear address, take each block from the Cache, or queue its read from JBOD
+    while (curr_addr < addr + len) {
 
-    // For reading bytes:- Translate linear address, Seek disk & block numbers, Read & process data.
-    while (curr_addr < (addr + len)) {
+        i = num_blocks++;
+        assert(i < SPAN_MAX_BLOCKS);
 
         // Translate the linear address
-        translate_address(curr_addr, &disk_number, &block_number, &offset);
+        translate_address(ctx, curr_addr, &disk_number[i], &block_number[i], &offset[i]);
 
-        // Seek the respective Disk and its Block numbers
-        seek(disk_number, block_number);
+        read_req[i] = -1;
+        if ((cache == NULL) || (cache_lookup_in(cache, disk_number[i], block_number[i], blocks[i]) != 1))
+            read_req[i] = batch_block_op(ctx, &batch, JBOD_READ_BLOCK, disk_number[i], block_number[i], blocks[i]);
 
-        // If cache exist, then read & retrieve data from Cache
-        if (cache_enabled() == true)
-            retval = cache_lookup(disk_number, block_number, tmp); // returns 1 on success
+        curr_addr += ctx->geometry.block_size - offset[i];	// next block to read from
 
-        // If data NOT found in cache or if NO cache exist, then read from JBOD
-        if ((retval != 1) || (cache_enabled() == false))
-	    jbod_client_operation(encode_operation(JBOD_READ_BLOCK, 0, 0), tmp); // JBOD_READ_BLOCK = 4
+    } // end-of while loop
 
-        //// Processing data:- To copy the data read; into the buffer 'buf'
+    // Seek and read all the missing blocks in one pipelined round trip
+    rc = batch_run(ctx, &batch);
 
-        available_block_length = JBOD_BLOCK_SIZE - offset;
+    //// Pass 2:- Cache the blocks read from JBOD, and copy the data into 'buf'
+    for (i = 0; i < num_blocks; i++) {
 
-        // For data read from the same disk or block
-        if ((len < available_block_length) && (read_flag != 2)) {
+        if (read_req[i] != -1) {
 
-            // Copy the bytes read at tmp+offset position; into the buffer 'buf'
-            memcpy(buf, tmp + offset, len);
-	    
-            // If block was NOT found in cache, then insert the data read; into the Cache
-	    if (retval != 1)
-	        returnval = cache_insert(disk_number, block_number, buf);
+            if (batch_req(&batch, read_req[i])->result != 0)
+                continue;
 
-	    read_flag = 1; // For data read from the same disk & block, set read_flag to 1
-            break;
+            // Insert the block read from JBOD into the Cache
+            if (cache != NULL)
+                cache_insert_in(cache, disk_number[i], block_number[i], blocks[i]);
         }
 
-        // For data read from across blocks or disks
-        if (length > available_block_length) {
+        chunk = ctx->geometry.block_size - offset[i];
+        if (chunk > length)
+            chunk = length;
 
-            // Copy the bytes read at tmp+offset position; into appropriate location of 'buf'
-            memcpy(buf + copied_buf_length, tmp + offset, available_block_length);
-	    
-            // If block was NOT found in cache, then insert the data read; into the Cache
-	    if (retval != 1)
-	        returnval = cache_insert(disk_number, block_number, buf);
+        // Copy the bytes read at block+offset position; into appropriate location of 'buf'
+        memcpy(buf + copied_buf_length, blocks[i] + offset[i], chunk);
 
-            copied_buf_length += available_block_length;
-            length -= available_block_length; 	// length; pending to be copied into 'buf'
+        copied_buf_length += chunk;
+        length -= chunk;
+    }
 
-            read_flag = 2; // For data read across blocks or disks, set read_flag to 2
-        }
-	
-        // For data that is read in the end
-        else if ((length <= available_block_length) && (read_flag > 1)) {
+    if (rc == -1)
+        return -1;
 
-            // Copy the bytes read at tmp+offset position; into appropriate location of 'buf'
-            memcpy(buf + copied_buf_length, tmp + offset, length);
+    if ((last_block != NULL) && (num_blocks > 0))
+        memcpy(last_block, blocks[num_blocks - 1], JBOD_BLOCK_SIZE);
 
-            // If block was NOT found in cache, then insert the data read; into the Cache
-	    if (retval != 1)
-	        returnval = cache_insert(disk_number, block_number, buf);
+    return 0;
+}
 
-            copied_buf_length += length;
-            length -= copied_buf_length;	// length; pending to be copied into 'buf'
+//// READ CACHED Function - Reads 'len' bytes at 'addr' into 'buf' from the Cache alone, without the
+//// context lock. Returns 0 on success, and -1 when a block is missing (nothing is counted then,
+//// unless the block got evicted in the meantime).
+static int read_cached(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf) {
 
-            read_flag = 0;
-        }
+    cache_t *cache = ctx_cache(ctx);
+    uint8_t block[JBOD_BLOCK_SIZE];
+    uint32_t curr_addr;
+    int disk_number, block_number, offset;
 
-        // Compute the next address location to Continue with reading data
-        curr_addr += available_block_length;
-	
-    } // end-of while loop
+    if ((cache == NULL) || (len == 0))
+        return -1;
 
-    // On success, return the 'number of bytes'
-    return len;
+    // Check first, so that a read going to JBOD anyway is not counted twice
+    for (curr_addr = addr; curr_addr < addr + len; curr_addr += ctx->geometry.block_size - offset) {
+        translate_address(ctx, curr_addr, &disk_number, &block_number, &offset);
+        if (cache_contains_in(cache, disk_number, block_number) == false)
+            return -1;
+    }
+
+    for (curr_addr = addr; curr_addr < addr + len; curr_addr += ctx->geometry.block_size - offset) {
+
+        translate_address(ctx, curr_addr, &disk_number, &block_number, &offset);
+        if (cache_lookup_in(cache, disk_number, block_number, block) != 1)
+            return -1;
+
+        uint32_t chunk = ctx->geometry.block_size - offset;
+        if (chunk > addr + len - curr_addr)
+            chunk = addr + len - curr_addr;
+
+        memcpy(buf + (curr_addr - addr), block + offset, chunk);
+    }
+
+    return 0;
 }
 
 
@@ -200,157 +505,1792 @@ uint32_t encode_operation(jbod_cmd_t cmd, int disk_num, int block_num) {
 }
 
 // Helper function-2: translate_address()
-void translate_address(uint32_t curr_addr, int *disk_number, int *block_number, int *offset) {
+// Translates a linear address to its disk & block numbers, and offset position, by the geometry
+// of the context: shifts and masks for the JBOD geometry (JBOD_DISK_SIZE = 65536, JBOD_BLOCK_SIZE
+// = 256), known at compile time. Addresses are split into blocks by the geometry's block size
+// throughout; buffers keep JBOD_BLOCK_SIZE, the size of the blocks the protocol moves.
+void translate_address(mdadm_ctx_t *ctx, uint32_t curr_addr, int *disk_number, int *block_number, int *offset) {
+    geometry_translate(&ctx->geometry, curr_addr, disk_number, block_number, offset);
+}
+
+// Helper function-3: batch_init()
+// Empties the batch of every member.
+static void batch_init(op_batch_t *batch) {
+    memset(batch->num_reqs, 0, sizeof(batch->num_reqs));
+}
+
+// Helper function-4: batch_add()
+// Queues one operation for a member. Returns a reference to the request, for batch_req().
+static int batch_add(op_batch_t *batch, int member, uint32_t op, uint8_t *block) {
+
+    int i = batch->num_reqs[member]++;
+
+    batch->reqs[member][i].op = op;
+    batch->reqs[member][i].block = block;
+
+    return member * JBOD_BATCH_MAX + i;
+}
+
+// Helper function-5: batch_req()
+// The request of a reference returned by batch_add() or batch_block_op().
+static jbod_request_t *batch_req(op_batch_t *batch, int ref) {
+    return &batch->reqs[ref / JBOD_BATCH_MAX][ref % JBOD_BATCH_MAX];
+}
+
+// Helper function-6: batch_block_op()
+// Queues a block read or write (JBOD_READ_BLOCK = 4, JBOD_WRITE_BLOCK = 5) of the disk & block of
+// the linear volume, on the member that holds it, with the seeks it needs (JBOD_SEEK_TO_DISK = 2,
+// JBOD_SEEK_TO_BLOCK = 3). The seeks that the head model shows are redundant are skipped, and the
+// model is advanced as if the batch had already run. A mirrored volume writes the block on every
+// replica, and reads it from the least busy one (mirror_pick). Returns a reference to the read or
+// write request (the last replica's write).
+static int batch_block_op(mdadm_ctx_t *ctx, op_batch_t *batch, jbod_cmd_t cmd, int disk_number, int block_number, uint8_t *block) {
+
+    layout_loc_t loc;
+    uint32_t linear = geometry_block(&ctx->geometry, disk_number, block_number);
+    int ref = -1;
+
+    layout_map(&ctx->layout, linear, &loc);
+
+    int first = loc.member, last = loc.member;
+    if ((ctx->layout.mirrored == true) && (cmd == JBOD_WRITE_BLOCK))
+        last = ctx->layout.num_members - 1;
+    else if (ctx->layout.mirrored == true)
+        first = last = mirror_pick(ctx, batch, loc.disk_num, loc.block_num, -1);
+
+    for (int m = first; m <= last; m++) {
+
+        layout_head_t *head = &ctx->members[m].head;
+
+        // Room for two seeks and the operation itself
+        assert(batch->num_reqs[m] + 3 <= JBOD_BATCH_MAX);
+
+        int seeks = layout_seek(head, loc.disk_num, loc.block_num);
+        count_seeks(seeks);
+
+        if (seeks & LAYOUT_SEEK_DISK)
+            batch_add(batch, m, encode_operation(JBOD_SEEK_TO_DISK, loc.disk_num, 0), NULL);
+
+        if (seeks & LAYOUT_SEEK_BLOCK)
+            batch_add(batch, m, encode_operation(JBOD_SEEK_TO_BLOCK, 0, loc.block_num), NULL);
+
+        layout_advance(head);
+
+        ref = batch_add(batch, m, encode_operation(cmd, 0, 0), block);
+        batch->blocks[m][ref % JBOD_BATCH_MAX] = linear;
+    }
+
+    return ref;
+}
+
+// Helper function-7: batch_run()
+// Sends the batches of all the members and receives all the responses; the servers work on their
+// batches at the same time. The result of each request is left in the batch. Reads of a mirrored
+// volume with hedging go through run_hedged() instead.
+// Returns 0 when every request succeeded and -1 otherwise.
+static int batch_run(mdadm_ctx_t *ctx, op_batch_t *batch) {
+
+    jbod_conn_t *conns[LAYOUT_MAX_MEMBERS];
+    jbod_request_t *reqs[LAYOUT_MAX_MEMBERS];
+    int num_reqs[LAYOUT_MAX_MEMBERS];
+    int members[LAYOUT_MAX_MEMBERS];
+    int m, i, n = 0, num_reads = 0;
+    bool hedged = (ctx->hedge_percentile > 0);
+
+    // Only batches of reads and their seeks are hedged
+    for (m = 0; m < ctx->layout.num_members; m++) {
+        for (i = 0; (i < batch->num_reqs[m]) && (hedged == true); i++) {
+            jbod_cmd_t cmd = batch->reqs[m][i].op >> COMMAND_BIT_START_POS;
+            num_reads += (cmd == JBOD_READ_BLOCK);
+            hedged = (cmd == JBOD_READ_BLOCK) || (cmd == JBOD_SEEK_TO_DISK) || (cmd == JBOD_SEEK_TO_BLOCK);
+        }
+    }
+
+    if ((hedged == true) && (num_reads > 0))
+        return run_hedged(ctx, batch);
+
+    // Only the members with something to do take part
+    for (m = 0; m < ctx->layout.num_members; m++) {
+        if (batch->num_reqs[m] > 0) {
+            conns[n] = member_conn(ctx, m);
+            reqs[n] = batch->reqs[m];
+            num_reqs[n] = batch->num_reqs[m];
+            members[n++] = m;
+        }
+    }
+
+    if (n == 0)
+        return 0;
 
-    // Translate linear address to appropriate disk & block numbers, and offset position.
-    int disk_offset;
-    disk_offset = curr_addr % JBOD_DISK_SIZE;
+    // The late tries of hedged reads on these members go first (see run_hedged)
+    for (m = 0; (m < n) && (ctx->strays > 0); m++)
+        while (jbod_async_idle(conns[m]) == false)
+            jbod_loop_run(ctx->loop, -1);
 
-    *disk_number = curr_addr / JBOD_DISK_SIZE;	    // JBOD_DISK_SIZE = 65536
-    *block_number = disk_offset / JBOD_BLOCK_SIZE;  // JBOD_BLOCK_SIZE = 256
-    *offset = disk_offset % JBOD_BLOCK_SIZE;
+    if (jbod_conn_batch_many(conns, reqs, num_reqs, n) == -1) {
+
+        // Where a failed batch left the JBODs positioned is unknown
+        for (m = 0; m < n; m++)
+            layout_invalidate(&ctx->members[members[m]].head);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Helper function-8: read_block()
+// Seeks (when needed) and reads one block from JBOD into 'block', in one round trip.
+// Returns 0 on success and -1 on failure.
+int read_block(mdadm_ctx_t *ctx, int disk_number, int block_number, uint8_t *block) {
+
+    op_batch_t batch;
+
+    batch_init(&batch);
+    batch_block_op(ctx, &batch, JBOD_READ_BLOCK, disk_number, block_number, block);
+
+    return batch_run(ctx, &batch);
+}
+
+// Helper function-9: write_block()
+// Seeks (when needed) and writes one block from 'block' into JBOD, in one round trip.
+// Returns 0 on success and -1 on failure.
+int write_block(mdadm_ctx_t *ctx, int disk_number, int block_number, uint8_t *block) {
+
+    op_batch_t batch;
+
+    batch_init(&batch);
+    batch_block_op(ctx, &batch, JBOD_WRITE_BLOCK, disk_number, block_number, block);
+
+    return batch_run(ctx, &batch);
+}
+
+// Helper function-10: invalidate_head()
+// Forgets the JBOD positions; the next block operation on each member seeks to both disk and block.
+void invalidate_head(mdadm_ctx_t *ctx) {
+    for (int m = 0; m < ctx->layout.num_members; m++)
+        layout_invalidate(&ctx->members[m].head);
+}
+
+// Helper function-11: writeback_block()
+// Called by a write-back Cache to write a dirty block into JBOD, through the context in 'arg' that
+// owns the Cache. The Cache is only used by its owner with the context lock held, which covers
+// this write too. Returns 1 on success and -1 on failure.
+int writeback_block(void *arg, int disk_number, int block_number, const uint8_t *block) {
+
+    mdadm_ctx_t *ctx = arg;
+    uint8_t tmp[JBOD_BLOCK_SIZE];
+
+    // If the disk is in 'Unmounted' state, the block cannot be written
+    if (ctx->mounted == 0)
+        return -1;
+
+    memcpy(tmp, block, JBOD_BLOCK_SIZE);
+    if (write_block(ctx, disk_number, block_number, tmp) == -1)
+        return -1;
+
+    return 1;
 }
 
-// Helper function-3: seek()
-void seek(int disk_number, int block_number) {
+// Helper function-12: prefetch_block()
+// Called by the readahead thread to read one block (by linear block number) into the Cache.
+// Returns 1 on success and -1 on failure.
+int prefetch_block(uint32_t linear_block) {
+
+    uint8_t tmp[JBOD_BLOCK_SIZE];
+    int disk_number, block_number, offset;
+    int rc = 1;
 
-    // Seek to a specific disk. JBOD_SEEK_TO_DISK = 2
-    jbod_client_operation(encode_operation(JBOD_SEEK_TO_DISK, disk_number, 0), NULL);
+    translate_address(&default_ctx, linear_block * default_ctx.geometry.block_size, &disk_number, &block_number,
+                      &offset);
 
-    // Seek to a specific block in current disk. JBOD_SEEK_TO_BLOCK = 3
-    jbod_client_operation(encode_operation(JBOD_SEEK_TO_BLOCK, 0, block_number), NULL);
+    pthread_mutex_lock(&default_ctx.lock);
+    async_drain(&default_ctx);
+
+    // The reader may have fetched the block itself in the meantime
+    if ((default_ctx.mounted == 0) || (cache_enabled() == false))
+        rc = -1;
+    else if (cache_contains(disk_number, block_number) == false) {
+        if (read_block(&default_ctx, disk_number, block_number, tmp) == -1)
+            rc = -1;
+        else
+            rc = cache_prefetch(disk_number, block_number, tmp);
+    }
+
+    pthread_mutex_unlock(&default_ctx.lock);
+
+    return rc;
 }
 
 
 //// Write function - Writes the data from buffer into the block in current I/O position
 //// Writes 'len' bytes from the buffer 'buf' to the storage system, starting at address 'addr'
-int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
+static int do_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf) {
 
     // Return the 'number of bytes read' on Success, and -1 on Failure
 
     // If the disk is in 'Unmounted' state, then return -1
-    if (Mount_flag == 0)
+    if (ctx->mounted == 0)
     	return -1;
 
     //// Validate the input parameters
 
     // Return -1; on attempting Write to an out-of-bound linear address.
     // JBOD_NUM_DISKS = 16, JBOD_DISK_SIZE = 65536
-    if ((addr + len) > (JBOD_NUM_DISKS * JBOD_DISK_SIZE))
+    if ((addr + len) > ctx_size(ctx))
     	return -1;
 
     // Return -1; on read larger than the specified bytes MAX_SIZE
-    if (len > MAX_SIZE)
+    if (len > (uint32_t) MAX_SIZE)
     	return -1;
 
     if (len && buf == NULL)
     	return -1;
 
+    // Partial block writes merge in the write-combining buffer, unless a write-back Cache holds
+    // the blocks back already
+    if ((ctx->combine.capacity > 0) && (cache_write_back_enabled_in(ctx_cache(ctx)) == false)) {
+        if (combine_write(ctx, addr, len, buf) == -1)
+            return -1;
+    }
+    else if (write_span(ctx, addr, len, buf, NULL) == -1)
+        return -1;
+
+    count_io(true, len);
+
+    // On success, return the 'number of bytes'
+    return len;
+}
+
+//// WRITE SPAN Function - Writes 'len' bytes from 'buf' at 'addr', touching at most SPAN_MAX_BLOCKS
+//// blocks. When 'last_block' is not NULL, the whole last block touched is copied into it.
+//// Returns 0 on success and -1 on failure.
+static int write_span(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf, uint8_t *last_block) {
+
     // Declaring & initializing the local variables
-    int curr_addr = addr;
-    uint32_t length = len;
-    uint32_t available_block_length = 0;
+    uint32_t curr_addr = addr;
+    uint32_t length = len;     // length; pending to be written from 'buf'
     uint32_t copied_buf_length = 0;
-    uint8_t tmp[JBOD_BLOCK_SIZE]; // JBOD_BLOCK_SIZE = 256
-    int disk_number;
-    int block_number;
-    int offset;
-    int flag = 0;   // flag set to 1 or 2; based on data to be written to disks & blocks
-    int returnval;  // return value of cache_insert() function.
-    
-    //// For Writing bytes:- Translate linear address, Seek disk & block numbers,
-    //// then, Fetch the data block and process to Write the data
+    uint32_t chunk[SPAN_MAX_BLOCKS];   // bytes of 'buf' that go into each block
+    uint8_t blocks[SPAN_MAX_BLOCKS][JBOD_BLOCK_SIZE]; // JBOD_BLOCK_SIZE = 256
+    int disk_number[SPAN_MAX_BLOCKS];
+    int block_number[SPAN_MAX_BLOCKS];
+    int offset[SPAN_MAX_BLOCKS];
+    int write_req[SPAN_MAX_BLOCKS];    // reference to the block's write in 'batch'
+    int num_blocks = 0;
+    int i, rc = 0;
+    cache_t *cache = ctx_cache(ctx);
+    bool write_back = cache_write_back_enabled_in(cache);
+    op_batch_t batch;
+
+    batch_init(&batch);
+
+    //// Pass 1:- Translate linear address, and Fetch the current contents of the blocks that need it.
+    //// The written bytes get merged into the current contents:
+    ////  - a full block write replaces every byte, so nothing is fetched;
+    ////  - a partial write of a block that is in the Cache merges into the cached copy, which
+    ////    is never older than JBOD (written blocks always go into the Cache too);
+    ////  - only a partial write of an uncached block reads the block from JBOD.
+    while (length > 0) {
+
+        i = num_blocks++;
+        assert(i < SPAN_MAX_BLOCKS);
 
-    // Translate the linear address
-    translate_address(curr_addr, &disk_number, &block_number, &offset);
+        // Translate the linear address
+        translate_address(ctx, curr_addr, &disk_number[i], &block_number[i], &offset[i]);
+
+        chunk[i] = ctx->geometry.block_size - offset[i];
+        if (chunk[i] > length)
+            chunk[i] = length;
 
-    // Seek the respective disk and block numbers
-    seek(disk_number, block_number);
+        if (chunk[i] < ctx->geometry.block_size) {
+            if ((cache == NULL) || (cache_lookup_in(cache, disk_number[i], block_number[i], blocks[i]) != 1))
+                batch_block_op(ctx, &batch, JBOD_READ_BLOCK, disk_number[i], block_number[i], blocks[i]);
+        }
 
-    // Read JBOD. JBOD_READ_BLOCK = 4
-    jbod_client_operation(encode_operation(JBOD_READ_BLOCK, 0, 0), tmp);
+        length -= chunk[i];
+        curr_addr += chunk[i];	// next address location to Continue with writing data
 
-    while (curr_addr < addr + len) {
+    } // end-of while loop
+
+    // Seek and read the blocks to be merged into, in one pipelined round trip
+    if (batch_run(ctx, &batch) == -1)
+        return -1;
 
-        //// Processing data:- to Write data from const buffer 'buf' into JBOD and Cache
+    // Copies of these blocks taken by streams are out of date from now on
+    __atomic_add_fetch(&write_generation, 1, __ATOMIC_RELAXED);
 
-    	available_block_length = JBOD_BLOCK_SIZE - offset;
+    if ((last_block != NULL) && (num_blocks > 0)) {
+        i = num_blocks - 1;
+        memcpy(last_block, blocks[i], JBOD_BLOCK_SIZE);
+        memcpy(last_block + offset[i], buf + (len - chunk[i]), chunk[i]);
+    }
 
-        // For data to be written in the same disk or block
-        if ((len <= available_block_length) && (flag == 0)) {
+    //// Pass 2:- Copy the bytes from 'buf' into the blocks, and Write them
+    for (i = 0; i < num_blocks; i++) {
 
-            // Copy the bytes from const buffer 'buf'; into appropriate location of 'tmp'
-            memcpy(tmp + offset, buf, len);
+        memcpy(blocks[i] + offset[i], buf + copied_buf_length, chunk[i]);
+        copied_buf_length += chunk[i];
 
-            // Seek the disk & block number, to Write data from 'tmp' into JBOD
-            seek(disk_number, block_number);
-            jbod_client_operation(encode_operation(JBOD_WRITE_BLOCK, 0, 0), tmp); // JBOD_WRITE_BLOCK = 5
-	    
-            // If there exist any cache, then write / Insert data into the Cache from 'tmp'
-	    if (cache_enabled() == true)
-		returnval = cache_insert(disk_number, block_number, tmp);
+        // Write-back: only the Cache gets the data now; JBOD gets it on eviction or flush
+        if ((write_back == true) && (cache_write_in(cache, disk_number[i], block_number[i], blocks[i]) == -1))
+            return -1;
+    }
 
-            flag = 1; 	// when data is written into the same disk and block, set flag to 1
-            break;
+    if (write_back == true)
+        return 0;
+
+    // Write-through: Seek and write all the blocks into JBOD, in one pipelined round trip
+    batch_init(&batch);
+    for (i = 0; i < num_blocks; i++)
+        write_req[i] = batch_block_op(ctx, &batch, JBOD_WRITE_BLOCK, disk_number[i], block_number[i], blocks[i]);
+
+    rc = batch_run(ctx, &batch);
+
+    // If there exist any cache, then write / Insert data into the Cache, for every block written
+    for (i = 0; i < num_blocks; i++) {
+        if ((batch_req(&batch, write_req[i])->result == 0) && (cache != NULL))
+            cache_insert_in(cache, disk_number[i], block_number[i], blocks[i]);
+    }
+
+    return rc;
+}
+
+
+//// COMBINE WRITE Function - Writes 'len' bytes from 'buf' at 'addr' through the write-combining
+//// buffer. When the write ends inside a block, where the next write may carry on, the bytes of
+//// that block merge into the buffer (which makes room by flushing its least recently written
+//// block). Every other block touched goes into JBOD now, merged with the bytes the buffer held
+//// for it: a block they complete is not read, like a block written whole.
+//// Returns 0 on success and -1 on failure.
+static int combine_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf) {
+
+    // Declaring & initializing the local variables
+    uint32_t curr_addr = addr;
+    uint32_t pos[SPAN_MAX_BLOCKS];     // where the bytes of each block are within 'buf'
+    uint32_t chunk[SPAN_MAX_BLOCKS];   // bytes of 'buf' that go into each block
+    uint8_t blocks[SPAN_MAX_BLOCKS][JBOD_BLOCK_SIZE]; // JBOD_BLOCK_SIZE = 256
+    int disk_number[SPAN_MAX_BLOCKS];
+    int block_number[SPAN_MAX_BLOCKS];
+    int offset[SPAN_MAX_BLOCKS];
+    combine_block_t *held[SPAN_MAX_BLOCKS];  // bytes of the block held by the buffer, or NULL
+    int write_req[SPAN_MAX_BLOCKS];    // reference to the block's write in 'batch'
+    int num_blocks = 0;
+    int i, rc = 0;
+    combine_t *combine = &ctx->combine;
+    cache_t *cache = ctx_cache(ctx);
+    uint32_t block_size = ctx->geometry.block_size;
+    uint32_t end_block = geometry_block_of(&ctx->geometry, addr + len);	// block the write ends inside, if any
+    bool hold = ((addr + len) % block_size != 0) && (len > 0);
+    op_batch_t batch;
+
+    // Blocks held on a disk the write moves the head away from are written while it is still there
+    if (flush_left_behind(ctx, addr) == -1)
+        return -1;
+
+    // Room for the block to hold is made first, so that the batches below are not interleaved
+    // with the flush of the victim
+    if ((hold == true) && (combine_find(combine, end_block) == NULL) && (combine->num_used == combine->capacity) &&
+        (flush_combined(ctx, combine_victim(combine)->block * block_size, block_size) == -1))
+        return -1;
+
+    batch_init(&batch);
+
+    // Copies of these blocks taken by streams are out of date from now on
+    __atomic_add_fetch(&write_generation, 1, __ATOMIC_RELAXED);
+
+    //// Pass 1:- Merge the bytes into the buffer where it holds the block, or is to hold it; then
+    //// Fetch the current contents of the blocks going into JBOD in part, as write_span() does
+    for (uint32_t done = 0; done < len; done += chunk[i], curr_addr += chunk[i]) {
+
+        i = num_blocks++;
+        assert(i < SPAN_MAX_BLOCKS);
+
+        translate_address(ctx, curr_addr, &disk_number[i], &block_number[i], &offset[i]);
+
+        pos[i] = done;
+        chunk[i] = block_size - offset[i];
+        if (chunk[i] > len - done)
+            chunk[i] = len - done;
+
+        uint32_t linear_block = geometry_block_of(&ctx->geometry, curr_addr);
+        held[i] = combine_find(combine, linear_block);
+
+        // Every byte is replaced, including those the buffer holds for the block; it takes the new
+        // ones too, and keeps the block until it is written
+        if (chunk[i] == block_size) {
+            if (held[i] != NULL)
+                combine_merge(combine, held[i], 0, block_size, buf + done);
+            continue;
         }
 
-        // For data to be written across blocks or disks
-        if (length > available_block_length) {
+        if ((held[i] == NULL) && (hold == true) && (linear_block == end_block))
+            held[i] = combine_add(combine, linear_block);
 
-            // Copy the bytes at buf+copied_buf_length position; into appropriate location of 'tmp'
-            memcpy(tmp + offset, buf + copied_buf_length, available_block_length);
+        if (held[i] != NULL) {
 
-            // Seek the disk & block number, to Write data from 'tmp' into JBOD
-            seek(disk_number, block_number);
-            jbod_client_operation(encode_operation(JBOD_WRITE_BLOCK, 0, 0), tmp);
-	    
-            // If there exist any cache, then write / Insert data into the Cache from 'tmp'
-	    if (cache_enabled() == true)
-	        returnval = cache_insert(disk_number, block_number, tmp);
+            combine_merge(combine, held[i], offset[i], chunk[i], buf + done);
 
-            copied_buf_length += available_block_length;
-            length -= available_block_length;	// length; pending to be copied
+            if (combine_complete(held[i]) == true)
+                continue;
 
-            flag = 2;	// when data is written across blocks or disks, set flag to 2
+            // The end block stays in the buffer for the next write to carry on
+            if (linear_block == end_block) {
+                __atomic_add_fetch(&io_stats.writes_combined, 1, __ATOMIC_RELAXED);
+                num_blocks--;
+                continue;
+            }
         }
-	
-        // For data to be written in the end
-        else if ((length > 0) && (length <= available_block_length) && (flag == 2)) {
 
-            // Copy the bytes at buf+copied_buf_length position; into appropriate location of 'tmp'
-            memcpy(tmp + offset, buf + copied_buf_length, length);
+        if ((cache == NULL) || (cache_lookup_in(cache, disk_number[i], block_number[i], blocks[i]) != 1))
+            batch_block_op(ctx, &batch, JBOD_READ_BLOCK, disk_number[i], block_number[i], blocks[i]);
+    }
 
-            // Seek the disk & block number, to Write data from 'tmp' into JBOD
-            seek(disk_number, block_number);
-            jbod_client_operation(encode_operation(JBOD_WRITE_BLOCK, 0, 0), tmp);
-	    
-            // If there exist any cache, then write / Insert data into the Cache from 'tmp'
-	    if (cache_enabled() == true)
-	        returnval = cache_insert(disk_number, block_number, tmp);
+    // Seek and read the blocks to be merged into, in one pipelined round trip
+    if (batch_run(ctx, &batch) == -1)
+        return -1;
 
-            copied_buf_length += available_block_length;
-            length -= available_block_length;	// length; pending to be copied
+    //// Pass 2:- Merge the bytes into the blocks, and Write them into JBOD, in one round trip
+    batch_init(&batch);
+    for (i = 0; i < num_blocks; i++) {
 
-            flag = -1;
-            break;
+        if ((held[i] != NULL) && (combine_complete(held[i]) == true))
+            memcpy(blocks[i], held[i]->data, JBOD_BLOCK_SIZE);
+        else if (held[i] != NULL)
+            combine_apply(held[i], blocks[i]);
+        else
+            memcpy(blocks[i] + offset[i], buf + pos[i], chunk[i]);
+
+        write_req[i] = batch_block_op(ctx, &batch, JBOD_WRITE_BLOCK, disk_number[i], block_number[i], blocks[i]);
+    }
+
+    rc = batch_run(ctx, &batch);
+
+    // A block of the buffer leaves it once written; one that failed stays for the next flush
+    for (i = 0; i < num_blocks; i++) {
+
+        if (batch_req(&batch, write_req[i])->result != 0)
+            continue;
+
+        if (cache != NULL)
+            cache_insert_in(cache, disk_number[i], block_number[i], blocks[i]);
+        if (held[i] != NULL)
+            combine_release(combine, held[i]);
+    }
+
+    return rc;
+}
+
+// Helper: compare_combined() - orders blocks of the write-combining buffer by linear block number
+static int compare_combined(const void *a, const void *b) {
+
+    uint32_t block_a = (*(combine_block_t * const *) a)->block;
+    uint32_t block_b = (*(combine_block_t * const *) b)->block;
+
+    return (block_a > block_b) - (block_a < block_b);
+}
+
+// Helper: write_combined() - writes 'num_held' blocks of the write-combining buffer into JBOD, and
+// drops them from the buffer. The bytes written into a block are merged into its current contents,
+// taken from the Cache or read from JBOD. Returns 0 on success and -1 on failure; the blocks not
+// written stay in the buffer.
+static int write_combined(mdadm_ctx_t *ctx, combine_block_t **held, int num_held) {
+
+    cache_t *cache = ctx_cache(ctx);
+
+    // In block order, so that runs of blocks need no seek between them
+    qsort(held, num_held, sizeof(held[0]), compare_combined);
+
+    for (int start = 0; start < num_held; start += SPAN_MAX_BLOCKS) {
+
+        uint8_t blocks[SPAN_MAX_BLOCKS][JBOD_BLOCK_SIZE];
+        int disk_number[SPAN_MAX_BLOCKS];
+        int block_number[SPAN_MAX_BLOCKS];
+        int offset;
+        int write_req[SPAN_MAX_BLOCKS];
+        int n = (num_held - start < SPAN_MAX_BLOCKS) ? num_held - start : SPAN_MAX_BLOCKS;
+        combine_block_t **b = held + start;
+        op_batch_t batch;
+        int i, rc;
+
+        //// Pass 1:- Fetch the current contents of the blocks written in part, in one round trip
+        batch_init(&batch);
+        for (i = 0; i < n; i++) {
+
+            translate_address(ctx, b[i]->block * ctx->geometry.block_size, &disk_number[i], &block_number[i], &offset);
+
+            if ((combine_complete(b[i]) == false) &&
+                ((cache == NULL) || (cache_lookup_in(cache, disk_number[i], block_number[i], blocks[i]) != 1)))
+                batch_block_op(ctx, &batch, JBOD_READ_BLOCK, disk_number[i], block_number[i], blocks[i]);
         }
 
-        // Compute the next address location to Continue with writing data
-        curr_addr += available_block_length;
+        if (batch_run(ctx, &batch) == -1)
+            return -1;
 
-        // Translate this curr_address
-        translate_address(curr_addr, &disk_number, &block_number, &offset);
+        //// Pass 2:- Merge the written bytes in, and Write the blocks, in one round trip
+        batch_init(&batch);
+        for (i = 0; i < n; i++) {
+            combine_apply(b[i], blocks[i]);
+            write_req[i] = batch_block_op(ctx, &batch, JBOD_WRITE_BLOCK, disk_number[i], block_number[i], blocks[i]);
+        }
 
-        // Seek the respective Disk and its Block
-        seek(disk_number, block_number);
+        rc = batch_run(ctx, &batch);
 
-        // Read JBOD
-        jbod_client_operation(encode_operation(JBOD_READ_BLOCK, 0, 0), tmp);
+        for (i = 0; i < n; i++) {
 
-    } // end-of while loop
+            if (batch_req(&batch, write_req[i])->result != 0)
+                continue;
 
-    // On success, return the 'number of bytes'
-    return len;
+            if (cache != NULL)
+                cache_insert_in(cache, disk_number[i], block_number[i], blocks[i]);
+            combine_release(&ctx->combine, b[i]);
+        }
+
+        if (rc == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+//// FLUSH COMBINED Function - Writes the blocks of the write-combining buffer that 'len' bytes at
+//// 'addr' touch into JBOD. Returns 0 on success and -1 on failure.
+static int flush_combined(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len) {
+
+    combine_t *combine = &ctx->combine;
+    combine_block_t *held[COMBINE_MAX_BLOCKS];
+    int num_held = 0;
+
+    if (len == 0)
+        return 0;
+
+    uint32_t first = geometry_block_of(&ctx->geometry, addr);
+    uint32_t last = geometry_block_of(&ctx->geometry, addr + len - 1);
+
+    if (combine_holds(combine, first, last) == false)
+        return 0;
+
+    for (int i = 0; i < combine->capacity; i++) {
+        combine_block_t *b = &combine->blocks[i];
+        if ((b->used == true) && (b->block >= first) && (b->block <= last))
+            held[num_held++] = b;
+    }
+
+    return write_combined(ctx, held, num_held);
+}
+
+//// FLUSH LEFT BEHIND Function - Writes the blocks of the write-combining buffer that an operation at
+//// 'addr' is about to leave behind: those on the member holding 'addr', on another disk. The head
+//// of the member is still on their disk, whereas writing them once it moved would take a seek to
+//// it again (the costliest JBOD operation). Returns 0 on success and -1 on failure.
+static int flush_left_behind(mdadm_ctx_t *ctx, uint32_t addr) {
+
+    combine_t *combine = &ctx->combine;
+    combine_block_t *held[COMBINE_MAX_BLOCKS];
+    int num_held = 0;
+    layout_loc_t to, at;
+
+    if (combine->num_used == 0)
+        return 0;
+
+    layout_map(&ctx->layout, geometry_block_of(&ctx->geometry, addr), &to);
+
+    for (int i = 0; i < combine->capacity; i++) {
+
+        combine_block_t *b = &combine->blocks[i];
+        if (b->used == false)
+            continue;
+
+        layout_map(&ctx->layout, b->block, &at);
+        if ((at.member == to.member) && (at.disk_num != to.disk_num))
+            held[num_held++] = b;
+    }
+
+    return (num_held > 0) ? write_combined(ctx, held, num_held) : 0;
+}
+
+
+//// FLUSH Function - Writes the blocks of the write-combining buffer, and every dirty block held by
+//// a write-back Cache, into JBOD
+static int do_flush(mdadm_ctx_t *ctx) {
+
+    // This function to return 1 on Success and -1 on Failure
+
+    // If the disk is in 'Unmounted' state, then return -1
+    if (ctx->mounted == 0)
+        return -1;
+
+    if (flush_combined(ctx, 0, ctx_size(ctx)) == -1)
+        return -1;
+
+    // Nothing else is held back unless the Cache is in write-back mode
+    if (cache_write_back_enabled_in(ctx_cache(ctx)) == false)
+        return 1;
+
+    return cache_flush_in(ctx_cache(ctx));
+}
+
+
+//// STREAM Functions - a cursor over the linear device, for I/O of any length
+
+// Helper: stream_copy_valid() - whether the stream holds a current copy of the block at 'pos'
+static bool stream_copy_valid(mdadm_stream_t *stream, uint32_t pos) {
+    return (stream->block_num == geometry_block_of(&stream->ctx->geometry, pos)) &&
+           (stream->generation == __atomic_load_n(&write_generation, __ATOMIC_RELAXED));
+}
+
+// Reads 'len' bytes at the cursor; returns the number of bytes read, fewer at the end of the device
+static int do_stream_read(mdadm_stream_t *stream, uint32_t len, uint8_t *buf) {
+
+    if (stream->ctx->mounted == 0)
+        return -1;
+
+    if (len && buf == NULL)
+        return -1;
+
+    // Reads stop at the end of the linear device
+    if (len > ctx_size(stream->ctx) - stream->pos)
+        len = ctx_size(stream->ctx) - stream->pos;
+
+    // Blocks of the write-combining buffer that the read touches go into JBOD first
+    if (flush_combined(stream->ctx, stream->pos, len) == -1)
+        return -1;
+
+    uint32_t done = 0;
+
+    while (done < len) {
+
+        uint32_t offset = stream->pos % stream->ctx->geometry.block_size;
+        uint32_t chunk;
+
+        // Carry on inside the block the previous call ended in, without fetching it again
+        if (stream_copy_valid(stream, stream->pos)) {
+
+            chunk = stream->ctx->geometry.block_size - offset;
+            if (chunk > len - done)
+                chunk = len - done;
+
+            memcpy(buf + done, stream->block + offset, chunk);
+        }
+        else {
+
+            // A span of up to SPAN_MAX_BLOCKS blocks, ending at a block boundary when possible
+            chunk = SPAN_MAX_BLOCKS * stream->ctx->geometry.block_size - offset;
+            if (chunk > len - done)
+                chunk = len - done;
+
+            // The generation is taken first: a write in between makes the copy stale, never current
+            stream->generation = __atomic_load_n(&write_generation, __ATOMIC_RELAXED);
+
+            if (read_span(stream->ctx, stream->pos, chunk, buf + done, stream->block) == -1) {
+                stream->block_num = -1;
+                return -1;
+            }
+
+            stream->block_num = geometry_block_of(&stream->ctx->geometry, stream->pos + chunk - 1);
+
+            if ((stream->ctx == &default_ctx) && (cache_enabled() == true))
+                readahead_observe(stream->pos, chunk);
+        }
+
+        stream->pos += chunk;
+        done += chunk;
+    }
+
+    count_io(false, done);
+    return done;
+}
+
+// Writes 'len' bytes at the cursor; returns the number of bytes written
+static int do_stream_write(mdadm_stream_t *stream, uint32_t len, const uint8_t *buf) {
+
+    if (stream->ctx->mounted == 0)
+        return -1;
+
+    if (len && buf == NULL)
+        return -1;
+
+    // Like mdadm_write, a write that does not fit in the linear device fails as a whole
+    if (len > ctx_size(stream->ctx) - stream->pos)
+        return -1;
+
+    // The blocks are written whole from the stream's copies, which must include the bytes held by
+    // the write-combining buffer
+    if (flush_combined(stream->ctx, stream->pos, len) == -1)
+        return -1;
+
+    uint32_t done = 0;
+
+    while (done < len) {
+
+        uint32_t offset = stream->pos % stream->ctx->geometry.block_size;
+        uint32_t chunk;
+
+        // The write below moves the generation on by one; any other write makes the copy stale
+        uint64_t generation = __atomic_load_n(&write_generation, __ATOMIC_RELAXED) + 1;
+
+        if ((offset != 0) && stream_copy_valid(stream, stream->pos)) {
+
+            // Carry on inside the block the previous call ended in: merge into the copy, and
+            // write the whole block, so that it is not read again
+            chunk = stream->ctx->geometry.block_size - offset;
+            if (chunk > len - done)
+                chunk = len - done;
+
+            memcpy(stream->block + offset, buf + done, chunk);
+
+            uint32_t block_size = stream->ctx->geometry.block_size;
+            if (write_span(stream->ctx, stream->pos - offset, block_size, stream->block, NULL) == -1) {
+                stream->block_num = -1;
+                return -1;
+            }
+        }
+        else {
+
+            chunk = SPAN_MAX_BLOCKS * stream->ctx->geometry.block_size - offset;
+            if (chunk > len - done)
+                chunk = len - done;
+
+            if (write_span(stream->ctx, stream->pos, chunk, buf + done, stream->block) == -1) {
+                stream->block_num = -1;
+                return -1;
+            }
+
+            stream->block_num = geometry_block_of(&stream->ctx->geometry, stream->pos + chunk - 1);
+        }
+
+        stream->generation = generation;
+        stream->pos += chunk;
+        done += chunk;
+    }
+
+    count_io(true, done);
+    return done;
+}
+
+
+//// ASYNCHRONOUS Functions - requests submitted without waiting for them, completed by an event
+//// loop over the member connections. Each connection keeps any number of operations in flight,
+//// in submission order, so the servers are not left idle between requests.
+
+// Helper: async_complete() - moves a request whose operations have all completed to the done list
+static void async_complete(mdadm_req_t *req) {
+
+    mdadm_ctx_t *ctx = req->ctx;
+
+    ctx->outstanding -= 1;
+
+    if (req->result != -1)
+        count_io(req->write, req->len);
+
+    req->next = NULL;
+    if (ctx->done_tail != NULL)
+        ctx->done_tail->next = req;
+    else
+        ctx->done_head = req;
+    ctx->done_tail = req;
+}
+
+// Helper: async_op_done() - called by the event loop as each JBOD operation of a request completes
+static void async_op_done(jbod_aop_t *aop) {
+
+    req_block_t *blk = aop->arg;
+    mdadm_req_t *req = blk->req;
+    mdadm_ctx_t *ctx = req->ctx;
+    cache_t *cache = ctx_cache(ctx);
+    uint32_t linear = geometry_block(&ctx->geometry, blk->disk_number, blk->block_number);
+    int k = aop - blk->aops;
+    int member = blk->aop_member[k];
+
+    ctx->members[member].inflight -= 1;
+
+    // Where a failed operation left the JBOD positioned is unknown
+    if (aop->result != 0) {
+        req->result = -1;
+        layout_invalidate(&ctx->members[member].head);
+    }
+
+    if ((aop == blk->fetch) && (req->write == false)) {
+
+        if (aop->result == 0) {
+
+            memcpy(req->buf + blk->pos, blk->data + blk->offset, blk->chunk);
+
+            // A block with writes in flight may already be older than the Cache; a write-back
+            // Cache is not filled here, since an eviction would write into JBOD under the loop
+            if ((cache != NULL) && (ctx->pending_writes[linear] == 0) &&
+                (cache_write_back_enabled_in(cache) == false))
+                cache_insert_in(cache, blk->disk_number, blk->block_number, blk->data);
+        }
+    }
+    else if (aop == blk->fetch) {
+
+        // The rest of a partly written block is known: merge the new bytes and let the writes go.
+        // Without them, each write turns into a seek to the block after it, where the operations
+        // queued behind it expect the JBOD (past the last block, the model matches no block at all)
+        layout_loc_t loc;
+        layout_map(&ctx->layout, linear, &loc);
+
+        if (aop->result == 0)
+            memcpy(blk->data + blk->offset, req->wbuf + blk->pos, blk->chunk);
+
+        for (int i = 0; i < blk->num_aops; i++) {
+
+            if ((blk->stores & ((uint64_t) 1 << i)) == 0)
+                continue;
+
+            if (aop->result != 0) {
+                blk->aops[i].op = encode_operation(JBOD_SEEK_TO_BLOCK, 0,
+                                                   (loc.block_num + 1) % JBOD_NUM_BLOCKS_PER_DISK);
+                blk->aops[i].block = NULL;
+            }
+            jbod_async_ready(member_conn(ctx, blk->aop_member[i]), &blk->aops[i]);
+        }
+    }
+    else if (blk->stores & ((uint64_t) 1 << k)) {
+
+        // The block is written once every replica has it
+        if (--blk->stores_left == 0) {
+            ctx->pending_writes[linear] -= 1;
+            __atomic_add_fetch(&write_generation, 1, __ATOMIC_RELAXED);
+        }
+
+        // Keep a cached copy current; a write-back copy stays dirty, and is rewritten unchanged
+        if ((aop->result == 0) && ((blk->fetch == NULL) || (blk->fetch->result == 0)) && (cache != NULL)) {
+            if (cache_write_back_enabled_in(cache) == true)
+                cache_update_in(cache, blk->disk_number, blk->block_number, blk->data);
+            else
+                cache_insert_in(cache, blk->disk_number, blk->block_number, blk->data);
+        }
+    }
+
+    req->pending -= 1;
+    if (req->pending == 0)
+        async_complete(req);
+}
+
+// Helper: async_block_op() - queues a block read or write on the member that holds the block,
+// with the seeks it needs, like batch_block_op(): on every replica of a mirrored volume for a
+// write. A write that is not 'ready' waits for jbod_async_ready(). Returns the read or the (last)
+// write operation.
+static jbod_aop_t *async_block_op(mdadm_ctx_t *ctx, req_block_t *blk, jbod_cmd_t cmd, bool ready) {
+
+    layout_loc_t loc;
+    jbod_aop_t *aop = NULL;
+
+    layout_map(&ctx->layout, geometry_block(&ctx->geometry, blk->disk_number, blk->block_number), &loc);
+
+    int first = loc.member, last = loc.member;
+    if ((ctx->layout.mirrored == true) && (cmd == JBOD_WRITE_BLOCK))
+        last = ctx->layout.num_members - 1;
+    else if (ctx->layout.mirrored == true)
+        first = last = mirror_pick(ctx, NULL, loc.disk_num, loc.block_num, -1);
+
+    for (int m = first; m <= last; m++) {
+
+        uint32_t ops[3];
+        int n = 0;
+
+        layout_head_t *head = &ctx->members[m].head;
+        int seeks = layout_seek(head, loc.disk_num, loc.block_num);
+        count_seeks(seeks);
+
+        if (seeks & LAYOUT_SEEK_DISK)
+            ops[n++] = encode_operation(JBOD_SEEK_TO_DISK, loc.disk_num, 0);
+        if (seeks & LAYOUT_SEEK_BLOCK)
+            ops[n++] = encode_operation(JBOD_SEEK_TO_BLOCK, 0, loc.block_num);
+        ops[n++] = encode_operation(cmd, 0, 0);
+
+        layout_advance(head);
+
+        for (int i = 0; i < n; i++) {
+
+            assert(blk->num_aops < BLOCK_MAX_AOPS);
+            blk->aop_member[blk->num_aops] = m;
+            aop = &blk->aops[blk->num_aops++];
+
+            aop->op = ops[i];
+            aop->block = (i == n - 1) ? blk->data : NULL;
+            aop->ready = (i < n - 1) || (ready == true);
+            aop->done = async_op_done;
+            aop->arg = blk;
+
+            jbod_async_queue(member_conn(ctx, m), aop);
+            ctx->members[m].inflight += 1;
+            blk->req->pending += 1;
+        }
+
+        if (cmd == JBOD_WRITE_BLOCK) {
+            blk->stores |= (uint64_t) 1 << (blk->num_aops - 1);
+            blk->stores_left += 1;
+        }
+    }
+
+    return aop;
+}
+
+// Helper: async_start() - creates the event loop of the context, on its first request
+static int async_start(mdadm_ctx_t *ctx) {
+
+    if (ctx->loop != NULL)
+        return 0;
+
+    if (ctx->pending_writes == NULL) {
+        ctx->pending_writes = calloc(layout_num_blocks(&ctx->layout), sizeof(uint16_t));
+        if (ctx->pending_writes == NULL)
+            return -1;
+    }
+
+    ctx->loop = jbod_loop_new();
+    if (ctx->loop == NULL)
+        return -1;
+
+    for (int m = 0; m < ctx->layout.num_members; m++) {
+        if (jbod_loop_add(ctx->loop, member_conn(ctx, m)) == -1) {
+            jbod_loop_free(ctx->loop);
+            ctx->loop = NULL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Helper: async_stop() - frees the event loop; the connections may change before the next mount
+static void async_stop(mdadm_ctx_t *ctx) {
+
+    async_drain(ctx);
+
+    // The late tries of hedged reads complete into batches of their own (see run_hedged)
+    while (ctx->strays > 0)
+        jbod_loop_run(ctx->loop, -1);
+
+    jbod_loop_free(ctx->loop);
+    ctx->loop = NULL;
+}
+
+// Helper: async_drain() - completes every request in flight. A connection carries one stream of
+// operations, so synchronous I/O waits for the asynchronous one first.
+static void async_drain(mdadm_ctx_t *ctx) {
+    while (ctx->outstanding > 0)
+        jbod_loop_run(ctx->loop, -1);
+}
+
+//// SUBMIT Function - Queues a read into 'buf', or a write of a copy of 'buf', of 'len' bytes at
+//// 'addr'. Returns the request, or NULL on failure.
+static mdadm_req_t *do_submit(mdadm_ctx_t *ctx, bool write, uint32_t addr, uint32_t len, const uint8_t *buf,
+                              mdadm_req_done_fn done, void *arg) {
+
+    // Same checks as a synchronous read or write: a write may end at the end of the volume
+    uint32_t end = addr + len;
+    if ((ctx->mounted == 0) || (write ? (end > ctx_size(ctx)) : (end >= ctx_size(ctx))) ||
+        (len > (uint32_t) MAX_SIZE) || (len && buf == NULL))
+        return NULL;
+
+    // Blocks of the write-combining buffer that the request touches go into JBOD first, once the
+    // connections are free for synchronous I/O
+    if ((len > 0) && combine_holds(&ctx->combine, geometry_block_of(&ctx->geometry, addr),
+                                    geometry_block_of(&ctx->geometry, addr + len - 1))) {
+        async_drain(ctx);
+        if (flush_combined(ctx, addr, len) == -1)
+            return NULL;
+    }
+
+    if (async_start(ctx) == -1)
+        return NULL;
+
+    mdadm_req_t *req = malloc(sizeof(mdadm_req_t));
+    if (req == NULL)
+        return NULL;
+
+    req->ctx = ctx;
+    req->write = write;
+    req->addr = addr;
+    req->len = len;
+    req->buf = (uint8_t *) buf;
+    req->result = len;
+    req->pending = 0;
+    req->num_blocks = 0;
+    req->done = done;
+    req->arg = arg;
+    if (write == true)
+        memcpy(req->wbuf, buf, len);
+
+    cache_t *cache = ctx_cache(ctx);
+    uint32_t curr_addr = addr;
+
+    while (curr_addr < addr + len) {
+
+        req_block_t *blk = &req->blocks[req->num_blocks++];
+        assert(req->num_blocks <= REQ_MAX_BLOCKS);
+
+        blk->req = req;
+        blk->num_aops = 0;
+        blk->fetch = NULL;
+        blk->stores = 0;
+        blk->stores_left = 0;
+        blk->pos = curr_addr - addr;
+        translate_address(ctx, curr_addr, &blk->disk_number, &blk->block_number, &blk->offset);
+
+        blk->chunk = ctx->geometry.block_size - blk->offset;
+        if ((uint32_t) blk->chunk > addr + len - curr_addr)
+            blk->chunk = addr + len - curr_addr;
+
+        curr_addr += blk->chunk;
+
+        uint32_t linear = geometry_block(&ctx->geometry, blk->disk_number, blk->block_number);
+
+        // The Cache is only current for a block without writes in flight
+        bool cached = (cache != NULL) && (ctx->pending_writes[linear] == 0) &&
+                      (cache_lookup_in(cache, blk->disk_number, blk->block_number, blk->data) == 1);
+
+        if (write == false) {
+            if (cached == true)
+                memcpy(req->buf + blk->pos, blk->data + blk->offset, blk->chunk);
+            else
+                blk->fetch = async_block_op(ctx, blk, JBOD_READ_BLOCK, true);
+            continue;
+        }
+
+        // A write of part of a block needs the rest of it: from the Cache, or read just before
+        bool whole = (blk->chunk == ctx->geometry.block_size);
+
+        if ((whole == true) || (cached == true)) {
+            memcpy(blk->data + blk->offset, req->wbuf + blk->pos, blk->chunk);
+            async_block_op(ctx, blk, JBOD_WRITE_BLOCK, true);
+        }
+        else {
+            blk->fetch = async_block_op(ctx, blk, JBOD_READ_BLOCK, true);
+            async_block_op(ctx, blk, JBOD_WRITE_BLOCK, false);
+        }
+
+        ctx->pending_writes[linear] += 1;
+    }
+
+    ctx->outstanding += 1;
+
+    // Served by the Cache alone: complete already
+    if (req->pending == 0)
+        async_complete(req);
+
+    return req;
+}
+
+//// POLL Function - Reaps up to 'max_reqs' completed requests, waiting up to 'timeout_ms' (-1 for
+//// ever) for the first one. Requests with a callback are handed to it and freed; the others are
+//// stored in 'reqs', or freed when it is NULL. Returns the number of requests reaped, or -1 on failure.
+static int do_poll(mdadm_ctx_t *ctx, mdadm_req_t **reqs, int max_reqs, int timeout_ms) {
+
+    struct timespec now, deadline;
+    mdadm_req_t *reaped[POLL_MAX_REQS];
+    int n = 0, stored = 0;
+
+    if (max_reqs <= 0)
+        return -1;
+    if (max_reqs > POLL_MAX_REQS)
+        max_reqs = POLL_MAX_REQS;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+
+    while ((ctx->done_head == NULL) && (ctx->outstanding > 0)) {
+
+        int wait_ms = -1;
+
+        if (timeout_ms >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long left = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+            wait_ms = (left > 0) ? left : 0;
+        }
+
+        jbod_loop_run(ctx->loop, wait_ms);
+
+        if (wait_ms == 0)
+            break;
+    }
+
+    while ((ctx->done_head != NULL) && (n < max_reqs)) {
+        reaped[n++] = ctx->done_head;
+        ctx->done_head = ctx->done_head->next;
+    }
+    if (ctx->done_head == NULL)
+        ctx->done_tail = NULL;
+
+    pthread_mutex_unlock(&ctx->lock);
+
+    // Callbacks run without the lock, so that they can submit more requests
+    for (int i = 0; i < n; i++) {
+        if (reaped[i]->done != NULL) {
+            reaped[i]->done(reaped[i], reaped[i]->result, reaped[i]->arg);
+            free(reaped[i]);
+        }
+        else if (reqs != NULL)
+            reqs[stored++] = reaped[i];
+        else
+            free(reaped[i]);
+    }
+
+    return n;
+}
+
+
+//// MIRROR Functions - Reads of a mirrored volume: spread over the replicas by the operations they
+//// have outstanding, and hedged, sent to a second replica once the first one is late.
+
+// A read of a hedged batch: tried on one replica, then maybe on a second one
+typedef struct {
+    jbod_request_t *req;	// the read of the batch; NULL once the caller stopped waiting
+    uint32_t linear;		// linear block read
+    int member;			// replica of the first try
+    int tries;			// tries sent, 1 or 2
+    int done;			// tries completed
+    bool bad[2];		// a try failed, in its seeks or in the read itself
+    bool served;		// a try succeeded and served the read
+    uint8_t data[2][JBOD_BLOCK_SIZE];	// block of each try
+} hedge_read_t;
+
+// A JBOD operation of a hedged batch: the read of a try, or one of its seeks
+typedef struct {
+    struct hedge *hedge;
+    hedge_read_t *read;
+    int attempt;		// try of the read it belongs to
+    int member;
+    jbod_aop_t aop;
+} hedge_op_t;
+
+// A batch of reads of a mirrored volume on the event loop. The late tries of its reads outlive
+// the call that sent them: the batch goes with the last reference, the caller's or an operation's.
+typedef struct hedge {
+    mdadm_ctx_t *ctx;
+    struct timespec start;	// when the first tries were sent
+    int refs;			// operations in flight, and one while the caller waits
+    int num_ops, num_reads;
+    hedge_read_t *reads;
+    hedge_op_t ops[];
+} hedge_t;
+
+// Helper: mirror_pick() - the replica of a mirrored volume to read the block at 'disk_num' and
+// 'block_num' from, other than 'skip' (-1 for none): the one with the fewest operations
+// outstanding, queued in 'batch' (NULL for none) or in flight on the event loop, counting the
+// seeks the read would take there. Ties go to the first replica.
+static int mirror_pick(mdadm_ctx_t *ctx, const op_batch_t *batch, int disk_num, int block_num, int skip) {
+
+    int best = -1, best_load = 0;
+
+    for (int m = 0; m < ctx->layout.num_members; m++) {
+
+        if (m == skip)
+            continue;
+
+        layout_head_t head = ctx->members[m].head;
+        int load = ctx->members[m].inflight + __builtin_popcount(layout_seek(&head, disk_num, block_num));
+
+        if (batch != NULL)
+            load += batch->num_reqs[m];
+
+        if ((best == -1) || (load < best_load)) {
+            best = m;
+            best_load = load;
+        }
+    }
+
+    return best;
+}
+
+// Helper: compare_latency() - orders latencies for qsort()
+static int compare_latency(const void *a, const void *b) {
+
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+// Helper: hedge_record() - adds the latency of the first try of a read to the samples of the
+// context, and takes the hedging threshold again from the last HEDGE_SAMPLES of them, every
+// HEDGE_UPDATE samples. A late first try is timed too, when it completes in the background, so that
+// the threshold follows the replicas rather than the hedged reads.
+static void hedge_record(mdadm_ctx_t *ctx, uint64_t latency_ns) {
+
+    uint64_t sorted[HEDGE_SAMPLES];
+
+    ctx->hedge_samples[ctx->num_hedge_samples++ % HEDGE_SAMPLES] = latency_ns;
+    if ((ctx->num_hedge_samples < HEDGE_SAMPLES) || (ctx->num_hedge_samples % HEDGE_UPDATE != 0))
+        return;
+
+    memcpy(sorted, ctx->hedge_samples, sizeof(sorted));
+    qsort(sorted, HEDGE_SAMPLES, sizeof(uint64_t), compare_latency);
+
+    int rank = (int) (ctx->hedge_percentile * HEDGE_SAMPLES / 100);
+    ctx->hedge_after_ns = sorted[(rank < HEDGE_SAMPLES) ? rank : HEDGE_SAMPLES - 1];
+}
+
+// Helper: hedge_op_done() - called by the event loop as each operation of a hedged batch completes
+static void hedge_op_done(jbod_aop_t *aop) {
+
+    hedge_op_t *op = aop->arg;
+    hedge_t *hedge = op->hedge;
+    hedge_read_t *read = op->read;
+    mdadm_ctx_t *ctx = hedge->ctx;
+
+    ctx->members[op->member].inflight -= 1;
+
+    // Where a failed operation left the JBOD positioned is unknown, and so is what the read after
+    // a failed seek returns
+    if (aop->result != 0) {
+        read->bad[op->attempt] = true;
+        layout_invalidate(&ctx->members[op->member].head);
+    }
+
+    // The first try to bring the block back serves the read
+    if (aop->block != NULL) {
+
+        read->done += 1;
+
+        if ((op->attempt == 0) && (ctx->hedge_percentile > 0)) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            hedge_record(ctx, (now.tv_sec - hedge->start.tv_sec) * 1000000000ull + now.tv_nsec - hedge->start.tv_nsec);
+        }
+
+        if ((read->bad[op->attempt] == false) && (read->served == false)) {
+            read->served = true;
+            if (read->req != NULL)
+                memcpy(read->req->block, aop->block, JBOD_BLOCK_SIZE);
+        }
+    }
+
+    if (--hedge->refs == 0) {
+        ctx->strays -= 1;
+        free(hedge);
+    }
+}
+
+// Helper: hedge_queue() - queues an operation of a try of 'read' on 'member'
+static void hedge_queue(hedge_t *hedge, hedge_read_t *read, int member, uint32_t op, uint8_t *block) {
+
+    hedge_op_t *hop = &hedge->ops[hedge->num_ops++];
+
+    hop->hedge = hedge;
+    hop->read = read;
+    hop->attempt = read->tries;
+    hop->member = member;
+    hop->aop = (jbod_aop_t) { .op = op, .block = block, .ready = true, .done = hedge_op_done, .arg = hop };
+
+    jbod_async_queue(member_conn(hedge->ctx, member), &hop->aop);
+    hedge->ctx->members[member].inflight += 1;
+    hedge->refs += 1;
+}
+
+// Helper: hedge_retry() - sends 'read' to a second replica, the least busy other than the first
+static void hedge_retry(hedge_t *hedge, hedge_read_t *read) {
+
+    mdadm_ctx_t *ctx = hedge->ctx;
+    layout_loc_t loc;
+
+    layout_map(&ctx->layout, read->linear, &loc);
+
+    int member = mirror_pick(ctx, NULL, loc.disk_num, loc.block_num, read->member);
+    layout_head_t *head = &ctx->members[member].head;
+    int seeks = layout_seek(head, loc.disk_num, loc.block_num);
+    count_seeks(seeks);
+
+    if (seeks & LAYOUT_SEEK_DISK)
+        hedge_queue(hedge, read, member, encode_operation(JBOD_SEEK_TO_DISK, loc.disk_num, 0), NULL);
+    if (seeks & LAYOUT_SEEK_BLOCK)
+        hedge_queue(hedge, read, member, encode_operation(JBOD_SEEK_TO_BLOCK, 0, loc.block_num), NULL);
+
+    layout_advance(head);
+    hedge_queue(hedge, read, member, encode_operation(JBOD_READ_BLOCK, 0, 0), read->data[1]);
+
+    read->tries = 2;
+    __atomic_add_fetch(&io_stats.reads_hedged, 1, __ATOMIC_RELAXED);
+}
+
+// Helper: run_hedged() - runs a batch of reads of a mirrored volume, and their seeks, like
+// batch_run(), but on the event loop, so that the reads still waiting on their replica past the
+// hedging threshold, or failing there, can be tried on a second one. A read is served by its first
+// try to succeed; a late try goes on in the background, the head models counting it, and its block
+// is dropped. Returns 0 when every read was served and -1 otherwise.
+static int run_hedged(mdadm_ctx_t *ctx, op_batch_t *batch) {
+
+    struct timespec now;
+    int m, i, num_ops = 0, num_reads = 0, rc = 0;
+
+    for (m = 0; m < ctx->layout.num_members; m++) {
+        num_ops += batch->num_reqs[m];
+        for (i = 0; i < batch->num_reqs[m]; i++)
+            num_reads += (batch->reqs[m][i].op >> COMMAND_BIT_START_POS) == JBOD_READ_BLOCK;
+    }
+
+    // Room for a second try of every read, with its seeks
+    int max_ops = num_ops + 3 * num_reads;
+    hedge_t *hedge = calloc(1, sizeof(hedge_t) + max_ops * sizeof(hedge_op_t) + num_reads * sizeof(hedge_read_t));
+
+    if ((hedge == NULL) || (async_start(ctx) == -1)) {
+        free(hedge);
+        return -1;
+    }
+
+    hedge->ctx = ctx;
+    hedge->refs = 1;
+    hedge->reads = (hedge_read_t *) &hedge->ops[max_ops];
+    clock_gettime(CLOCK_MONOTONIC, &hedge->start);
+
+    // The first tries, as batch_block_op() laid them out: each read after its seeks
+    for (m = 0; m < ctx->layout.num_members; m++) {
+
+        int first = 0;
+
+        for (i = 0; i < batch->num_reqs[m]; i++) {
+
+            jbod_request_t *req = &batch->reqs[m][i];
+            req->result = 0;
+
+            if ((req->op >> COMMAND_BIT_START_POS) != JBOD_READ_BLOCK)
+                continue;
+
+            hedge_read_t *read = &hedge->reads[hedge->num_reads++];
+            read->req = req;
+            read->linear = batch->blocks[m][i];
+            read->member = m;
+
+            for (int k = first; k <= i; k++)
+                hedge_queue(hedge, read, m, batch->reqs[m][k].op, (k == i) ? read->data[0] : NULL);
+
+            read->tries = 1;
+            first = i + 1;
+        }
+    }
+
+    while (true) {
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t elapsed = (now.tv_sec - hedge->start.tv_sec) * 1000000000ull + now.tv_nsec - hedge->start.tv_nsec;
+        bool late = (ctx->hedge_after_ns > 0) && (elapsed >= ctx->hedge_after_ns);
+        bool waiting = false;
+
+        for (i = 0; i < hedge->num_reads; i++) {
+
+            hedge_read_t *read = &hedge->reads[i];
+            if (read->served == true)
+                continue;
+
+            // A read gets one more try, once late or failed on its replica
+            if ((read->tries == 1) && ((late == true) || (read->done == 1)))
+                hedge_retry(hedge, read);
+
+            waiting |= (read->done < read->tries);
+        }
+
+        if (waiting == false)
+            break;
+
+        // Wait for the responses, and for the threshold before the reads are late
+        long wait_us = -1;
+        if ((late == false) && (ctx->hedge_after_ns > 0))
+            wait_us = (ctx->hedge_after_ns - elapsed + 999) / 1000;
+
+        jbod_loop_run_us(ctx->loop, wait_us);
+    }
+
+    for (i = 0; i < hedge->num_reads; i++) {
+        hedge->reads[i].req->result = (hedge->reads[i].served == true) ? 0 : -1;
+        if (hedge->reads[i].served == false)
+            rc = -1;
+        hedge->reads[i].req = NULL;
+    }
+
+    // The late tries complete into the batch, which goes with the last of them
+    if (--hedge->refs == 0)
+        free(hedge);
+    else
+        ctx->strays += 1;
+
+    return rc;
+}
+
+
+//// CONTEXT Functions
+
+mdadm_ctx_t *mdadm_ctx_create(const char *ip, uint16_t port, cache_t *cache) {
+
+    mdadm_endpoint_t endpoint = { .ip = ip, .port = port };
+
+    return mdadm_ctx_create_striped(&endpoint, 1, 1, cache);
+}
+
+// Helper: ctx_open() - connects the members of a context whose layout is set, and sets up the rest
+// of it; frees it and returns NULL on failure
+static mdadm_ctx_t *ctx_open(mdadm_ctx_t *ctx, const mdadm_endpoint_t *endpoints, int num_endpoints, cache_t *cache) {
+
+    for (int m = 0; m < num_endpoints; m++) {
+
+        ctx->members[m].conn = jbod_conn_open_backend(endpoints[m].backend, endpoints[m].ip, endpoints[m].port);
+
+        if (ctx->members[m].conn == NULL) {
+            while (--m >= 0)
+                jbod_conn_close(ctx->members[m].conn);
+            free(ctx);
+            return NULL;
+        }
+    }
+
+    ctx->cache = cache;
+    ctx->default_cache = false;
+    pthread_mutex_init(&ctx->lock, NULL);
+
+    return ctx;
+}
+
+mdadm_ctx_t *mdadm_ctx_create_striped(const mdadm_endpoint_t *endpoints, int num_endpoints,
+                                      int stripe_blocks, cache_t *cache) {
+
+    mdadm_ctx_t *ctx = calloc(1, sizeof(mdadm_ctx_t));
+    if (ctx == NULL)
+        return NULL;
+
+    // Each member brings the disks of a JBOD
+    if ((layout_init(&ctx->layout, num_endpoints, stripe_blocks) == -1) ||
+        (geometry_init(&ctx->geometry, num_endpoints * JBOD_NUM_DISKS, JBOD_NUM_BLOCKS_PER_DISK, JBOD_BLOCK_SIZE) == -1)) {
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx_open(ctx, endpoints, num_endpoints, cache);
+}
+
+mdadm_ctx_t *mdadm_ctx_create_mirrored(const mdadm_endpoint_t *endpoints, int num_endpoints, cache_t *cache) {
+
+    mdadm_ctx_t *ctx = calloc(1, sizeof(mdadm_ctx_t));
+    if (ctx == NULL)
+        return NULL;
+
+    // Each member holds a copy of the disks of a JBOD
+    if ((layout_init_mirrored(&ctx->layout, num_endpoints) == -1) ||
+        (geometry_init(&ctx->geometry, JBOD_NUM_DISKS, JBOD_NUM_BLOCKS_PER_DISK, JBOD_BLOCK_SIZE) == -1)) {
+        free(ctx);
+        return NULL;
+    }
+
+    return ctx_open(ctx, endpoints, num_endpoints, cache);
+}
+
+void mdadm_ctx_destroy(mdadm_ctx_t *ctx) {
+
+    if ((ctx == NULL) || (ctx == &default_ctx))
+        return;
+
+    if (ctx->mounted == 1)
+        mdadm_ctx_unmount(ctx);
+
+    // Hedged reads may have started the event loop again, to flush the write-combining buffer
+    async_stop(ctx);
+
+    for (int m = 0; m < ctx->layout.num_members; m++)
+        jbod_conn_close(ctx->members[m].conn);
+
+    // Completed requests nobody reaped
+    while (ctx->done_head != NULL) {
+        mdadm_req_t *req = ctx->done_head;
+        ctx->done_head = req->next;
+        free(req);
+    }
+
+    free(ctx->pending_writes);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+uint32_t mdadm_ctx_size(mdadm_ctx_t *ctx) {
+    return ctx_size(ctx);
+}
+
+
+//// Entry points - every call holds the context lock, except reads served by the Cache alone
+
+int mdadm_ctx_mount(mdadm_ctx_t *ctx) {
+
+    pthread_mutex_lock(&ctx->lock);
+    int rc = do_mount(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+int mdadm_ctx_unmount(mdadm_ctx_t *ctx) {
+
+    // Pending prefetches are dropped first; the one in progress needs the context lock to finish
+    if (ctx == &default_ctx)
+        readahead_cancel();
+
+    pthread_mutex_lock(&ctx->lock);
+    int rc = do_unmount(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+int mdadm_ctx_read(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf) {
+    // Takes the context lock itself, when the Cache cannot serve the whole read
+    return do_read(ctx, addr, len, buf);
+}
+
+int mdadm_ctx_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf) {
+
+    pthread_mutex_lock(&ctx->lock);
+    async_drain(ctx);
+    int rc = do_write(ctx, addr, len, buf);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+int mdadm_ctx_flush(mdadm_ctx_t *ctx) {
+
+    pthread_mutex_lock(&ctx->lock);
+    async_drain(ctx);
+    int rc = do_flush(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+mdadm_stream_t *mdadm_ctx_open_stream(mdadm_ctx_t *ctx, uint32_t addr) {
+
+    if ((ctx == NULL) || (addr > ctx_size(ctx)))
+        return NULL;
+
+    mdadm_stream_t *stream = malloc(sizeof(mdadm_stream_t));
+    if (stream == NULL)
+        return NULL;
+
+    stream->ctx = ctx;
+    stream->pos = addr;
+    stream->block_num = -1;
+    stream->generation = 0;
+
+    return stream;
+}
+
+int mdadm_stream_read(mdadm_stream_t *stream, uint32_t len, uint8_t *buf) {
+
+    if (stream == NULL)
+        return -1;
+
+    pthread_mutex_lock(&stream->ctx->lock);
+    async_drain(stream->ctx);
+    int rc = do_stream_read(stream, len, buf);
+    pthread_mutex_unlock(&stream->ctx->lock);
+
+    return rc;
+}
+
+int mdadm_stream_write(mdadm_stream_t *stream, uint32_t len, const uint8_t *buf) {
+
+    if (stream == NULL)
+        return -1;
+
+    pthread_mutex_lock(&stream->ctx->lock);
+    async_drain(stream->ctx);
+    int rc = do_stream_write(stream, len, buf);
+    pthread_mutex_unlock(&stream->ctx->lock);
+
+    return rc;
+}
+
+mdadm_req_t *mdadm_ctx_submit_read(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf,
+                                   mdadm_req_done_fn done, void *arg) {
+
+    pthread_mutex_lock(&ctx->lock);
+    mdadm_req_t *req = do_submit(ctx, false, addr, len, buf, done, arg);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return req;
+}
+
+mdadm_req_t *mdadm_ctx_submit_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf,
+                                    mdadm_req_done_fn done, void *arg) {
+
+    pthread_mutex_lock(&ctx->lock);
+    mdadm_req_t *req = do_submit(ctx, true, addr, len, buf, done, arg);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return req;
+}
+
+int mdadm_ctx_poll(mdadm_ctx_t *ctx, mdadm_req_t **reqs, int max_reqs, int timeout_ms) {
+    // Takes the context lock itself, and releases it before running the callbacks
+    return do_poll(ctx, reqs, max_reqs, timeout_ms);
+}
+
+int mdadm_req_result(const mdadm_req_t *req) {
+    return req->result;
+}
+
+void mdadm_req_free(mdadm_req_t *req) {
+    free(req);
+}
+
+int mdadm_stream_seek(mdadm_stream_t *stream, uint32_t addr) {
+
+    if ((stream == NULL) || (addr > ctx_size(stream->ctx)))
+        return -1;
+
+    // The block copy is kept: seeking within it still needs no fetch
+    stream->pos = addr;
+    return 1;
+}
+
+uint32_t mdadm_stream_tell(mdadm_stream_t *stream) {
+    return stream->pos;
+}
+
+void mdadm_close_stream(mdadm_stream_t *stream) {
+    free(stream);
+}
+
+
+//// Default context - the original interface
+
+int mdadm_mount(void) {
+    return mdadm_ctx_mount(&default_ctx);
+}
+
+int mdadm_unmount(void) {
+    return mdadm_ctx_unmount(&default_ctx);
+}
+
+int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+    return mdadm_ctx_read(&default_ctx, addr, len, buf);
+}
+
+int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
+    return mdadm_ctx_write(&default_ctx, addr, len, buf);
+}
+
+int mdadm_flush(void) {
+    return mdadm_ctx_flush(&default_ctx);
+}
+
+mdadm_stream_t *mdadm_open_stream(uint32_t addr) {
+    return mdadm_ctx_open_stream(&default_ctx, addr);
+}
+
+mdadm_req_t *mdadm_submit_read(uint32_t addr, uint32_t len, uint8_t *buf, mdadm_req_done_fn done, void *arg) {
+    return mdadm_ctx_submit_read(&default_ctx, addr, len, buf, done, arg);
+}
+
+mdadm_req_t *mdadm_submit_write(uint32_t addr, uint32_t len, const uint8_t *buf, mdadm_req_done_fn done, void *arg) {
+    return mdadm_ctx_submit_write(&default_ctx, addr, len, buf, done, arg);
+}
+
+int mdadm_poll(mdadm_req_t **reqs, int max_reqs, int timeout_ms) {
+    return mdadm_ctx_poll(&default_ctx, reqs, max_reqs, timeout_ms);
+}
+
+//// READAHEAD Function - Enables prefetching of up to 'max_window' blocks ahead of sequential
+//// reads into the Cache, or disables it when 'max_window' is 0
+int mdadm_set_readahead(int max_window) {
+
+    // This function to return 1 on Success and -1 on Failure
+
+    if (max_window < 0)
+        return -1;
+
+    readahead_stop();
+
+    if (max_window == 0)
+        return 1;
+
+    return readahead_start(max_window, prefetch_block);
+}
+
+//// WRITE COMBINING Function - Holds the blocks written in part in a buffer of up to 'max_blocks'
+//// blocks, or disables it when 'max_blocks' is 0; what the buffer held goes into JBOD first
+int mdadm_ctx_set_write_combining(mdadm_ctx_t *ctx, int max_blocks) {
+
+    // This function to return 1 on Success and -1 on Failure
+
+    if ((max_blocks < 0) || (max_blocks > COMBINE_MAX_BLOCKS))
+        return -1;
+
+    pthread_mutex_lock(&ctx->lock);
+    async_drain(ctx);
+
+    int rc = -1;
+    if ((ctx->combine.num_used == 0) || ((ctx->mounted == 1) && (flush_combined(ctx, 0, ctx_size(ctx)) == 0)))
+        rc = combine_init(&ctx->combine, max_blocks);
+
+    pthread_mutex_unlock(&ctx->lock);
+
+    return rc;
+}
+
+int mdadm_set_write_combining(int max_blocks) {
+    return mdadm_ctx_set_write_combining(&default_ctx, max_blocks);
+}
+
+//// HEDGING Function - Sends a read of a mirrored volume to a second replica once it waited past
+//// the 'percentile'th percentile of the latest read latencies, or disables it when 'percentile' is 0
+int mdadm_ctx_set_hedging(mdadm_ctx_t *ctx, double percentile) {
+
+    // This function to return 1 on Success and -1 on Failure
+
+    if ((ctx->layout.mirrored == false) || (percentile < 0) || (percentile >= 100))
+        return -1;
+
+    pthread_mutex_lock(&ctx->lock);
+
+    // The threshold is taken again from reads timed from now on
+    ctx->hedge_percentile = percentile;
+    ctx->hedge_after_ns = 0;
+    ctx->num_hedge_samples = 0;
+
+    pthread_mutex_unlock(&ctx->lock);
+
+    return 1;
+}
+
+//// STATISTICS Functions - Snapshot and reset of the counters of mdadm, of the default Cache and
+//// of the connections, and their periodic dump
+void mdadm_get_stats(mdadm_stats_t *stats) {
+
+    uint64_t *from = (uint64_t *) &io_stats, *to = (uint64_t *) stats;
+
+    for (size_t i = 0; i < offsetof(mdadm_stats_t, cache) / sizeof(uint64_t); i++)
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+
+    cache_get_stats(&stats->cache);
+    jbod_get_stats(&stats->jbod);
+}
+
+void mdadm_reset_stats(void) {
+
+    uint64_t *counters = (uint64_t *) &io_stats;
+
+    for (size_t i = 0; i < offsetof(mdadm_stats_t, cache) / sizeof(uint64_t); i++)
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+
+    cache_reset_stats();
+    jbod_reset_stats();
+}
+
+int mdadm_set_stats_dump(const char *path, int interval_ms) {
+
+    // This function to return 1 on Success and -1 on Failure
+
+    stats_dump_stop();
+
+    if (path == NULL)
+        return 1;
+
+    return stats_dump_start(path, interval_ms, mdadm_get_stats);
 }
 
 /* End-of Program */
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include "jbod.h"
 #include "cache.h"
+#include "net.h"
+#include "combine.h"
 
 /* Return 1 on success and -1 on failure */
 int mdadm_mount(void);
@@ -14,7 +16,209 @@ int mdadm_unmount(void);
 /* Return the number of bytes read on success, -1 on failure. */
 int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf);
 
-/* Return the number of bytes written on success, -1 on failure. */
+/* Return the number of bytes written on success, -1 on failure. With a
+ * write-back cache the data only reaches the JBOD on eviction, on
+ * mdadm_flush or on mdadm_unmount; so do the blocks written in part with
+ * write combining (see mdadm_set_write_combining), or when they are read. */
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf);
 
+/* Writes every dirty block of a write-back cache, and every block of the
+ * write-combining buffer, into the JBOD. Return 1 on success and -1 on
+ * failure. */
+int mdadm_flush(void);
+
+/* A cursor over the linear device, for I/O of any length up to the whole
+ * device. It keeps its position and the last block it touched between calls,
+ * so a transfer split over many calls is not re-seeked, and a block shared by
+ * two calls is not fetched twice. */
+typedef struct mdadm_stream mdadm_stream_t;
+
+/* Returns a stream positioned at |addr|, or NULL on failure. */
+mdadm_stream_t *mdadm_open_stream(uint32_t addr);
+
+/* Reads |len| bytes at the stream position into |buf| and advances it. Return
+ * the number of bytes read, fewer than |len| at the end of the device, and -1
+ * on failure. */
+int mdadm_stream_read(mdadm_stream_t *stream, uint32_t len, uint8_t *buf);
+
+/* Writes |len| bytes from |buf| at the stream position and advances it. Return
+ * the number of bytes written, and -1 on failure (including a write past the
+ * end of the device). */
+int mdadm_stream_write(mdadm_stream_t *stream, uint32_t len, const uint8_t *buf);
+
+/* Moves the stream to |addr|. Return 1 on success and -1 on failure. */
+int mdadm_stream_seek(mdadm_stream_t *stream, uint32_t addr);
+
+/* Returns the stream position. */
+uint32_t mdadm_stream_tell(mdadm_stream_t *stream);
+
+/* Frees the stream. */
+void mdadm_close_stream(mdadm_stream_t *stream);
+
+/* An asynchronous read or write. */
+typedef struct mdadm_req mdadm_req_t;
+
+/* Called by mdadm_poll when |req| completes, with the number of bytes read or
+ * written, or -1 on failure. |req| is freed when it returns. */
+typedef void (*mdadm_req_done_fn)(mdadm_req_t *req, int result, void *arg);
+
+/* Submit a read into |buf|, or a write of |buf|, of |len| bytes at |addr|,
+ * without waiting for it, and return the request, or NULL on failure. The
+ * same limits as mdadm_read and mdadm_write apply. |buf| of a read must stay
+ * valid until the request completes; a write copies it. Requests complete in
+ * any order, each as soon as the JBOD operations it needs are done, and many
+ * of them keep the servers busy at once. Requests touching the same block
+ * take effect in submission order. A write goes through to JBOD even with a
+ * write-back cache. Any synchronous call first waits for the requests in
+ * flight. */
+mdadm_req_t *mdadm_submit_read(uint32_t addr, uint32_t len, uint8_t *buf, mdadm_req_done_fn done, void *arg);
+mdadm_req_t *mdadm_submit_write(uint32_t addr, uint32_t len, const uint8_t *buf, mdadm_req_done_fn done, void *arg);
+
+/* Waits up to |timeout_ms| milliseconds (-1 for ever, 0 not at all) for a
+ * request to complete, then reaps up to |max_reqs| completed requests. A
+ * request with a callback is passed to it; the others are stored in |reqs|
+ * (which may be NULL if every request has a callback), to be checked with
+ * mdadm_req_result and freed with mdadm_req_free. Returns the number of
+ * requests reaped, 0 if none completed in time, and -1 on failure. */
+int mdadm_poll(mdadm_req_t **reqs, int max_reqs, int timeout_ms);
+
+/* Returns the number of bytes read or written by |req|, or -1 on failure. */
+int mdadm_req_result(const mdadm_req_t *req);
+
+/* Frees a request returned by mdadm_poll. */
+void mdadm_req_free(mdadm_req_t *req);
+
+/* An mdadm context: its own connection to a JBOD server, mount state and
+ * cache. Any number of threads may use one context, and contexts run
+ * independently of each other. The functions above work on a default context,
+ * made of the connection of jbod_connect and the cache of cache_create. */
+typedef struct mdadm_ctx mdadm_ctx_t;
+
+/* Returns a context connected to the server at |ip| and |port|, using
+ * |cache| (NULL for none), or NULL on failure. A write-through cache may be
+ * shared by several contexts; a write-back cache can only be mounted by one
+ * context at a time. Each context keeps its own model of the JBOD head, so
+ * contexts sharing a server need one that keeps a head per connection. */
+mdadm_ctx_t *mdadm_ctx_create(const char *ip, uint16_t port, cache_t *cache);
+
+/* A JBOD server, or the local JBOD with |backend| JBOD_BACKEND_LOCAL. */
+typedef struct {
+  const char *ip;
+  uint16_t port;
+  jbod_backend_t backend;  /* JBOD_BACKEND_NET unless set */
+} mdadm_endpoint_t;
+
+/* Returns a context for a volume striped (RAID-0) across the
+ * |num_endpoints| servers of |endpoints|, in units of |stripe_blocks|
+ * blocks, or NULL on failure. The volume holds the disks of all the servers;
+ * I/O spanning several servers keeps them all busy at the same time. The
+ * stripe unit must divide the blocks of a server (JBOD_NUM_DISKS *
+ * JBOD_NUM_BLOCKS_PER_DISK). */
+mdadm_ctx_t *mdadm_ctx_create_striped(const mdadm_endpoint_t *endpoints, int num_endpoints,
+                                      int stripe_blocks, cache_t *cache);
+
+/* Returns a context for a volume mirrored (RAID-1) on the |num_endpoints|
+ * servers of |endpoints| (2 to 16), each holding a copy of the whole volume,
+ * which is the size of one server; or NULL on failure. The copies are
+ * expected to match when the volume is mounted. Each block write goes to
+ * every replica at the same time, and fails if any of them fails. Each block
+ * read goes to the replica with the fewest operations outstanding (queued
+ * in its round trip or in flight asynchronously), counting the seeks it
+ * would take there, so that the reads of a request, and of concurrent
+ * asynchronous requests, are spread over the replicas. */
+mdadm_ctx_t *mdadm_ctx_create_mirrored(const mdadm_endpoint_t *endpoints, int num_endpoints, cache_t *cache);
+
+/* Enables hedged reads on the mirrored volume of |ctx|: a block read still
+ * waiting on its replica past the |percentile|th percentile of the latencies
+ * of the latest 256 first tries (once that many were timed) is sent to the
+ * least busy other replica too, and served by whichever answers first; a
+ * read failing on its replica is tried on another one. The late try goes on
+ * in the background, and is waited for before the next operation on its
+ * replica other than a read. Hedging applies to the synchronous and streamed
+ * reads; asynchronous reads are only spread. 0 disables it. Return 1 on
+ * success and -1 on failure. */
+int mdadm_ctx_set_hedging(mdadm_ctx_t *ctx, double percentile);
+
+/* Returns the size of the volume of |ctx|, in bytes. */
+uint32_t mdadm_ctx_size(mdadm_ctx_t *ctx);
+
+/* Unmounts the context if needed, and closes its connections. */
+void mdadm_ctx_destroy(mdadm_ctx_t *ctx);
+
+/* Same as the functions without _ctx, on |ctx|. */
+int mdadm_ctx_mount(mdadm_ctx_t *ctx);
+int mdadm_ctx_unmount(mdadm_ctx_t *ctx);
+int mdadm_ctx_read(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf);
+int mdadm_ctx_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf);
+int mdadm_ctx_flush(mdadm_ctx_t *ctx);
+
+/* Returns a stream of |ctx| positioned at |addr|, or NULL on failure. A
+ * stream is used by one thread at a time. */
+mdadm_stream_t *mdadm_ctx_open_stream(mdadm_ctx_t *ctx, uint32_t addr);
+
+/* Same as the asynchronous functions above, on |ctx|. */
+mdadm_req_t *mdadm_ctx_submit_read(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf,
+                                   mdadm_req_done_fn done, void *arg);
+mdadm_req_t *mdadm_ctx_submit_write(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf,
+                                    mdadm_req_done_fn done, void *arg);
+int mdadm_ctx_poll(mdadm_ctx_t *ctx, mdadm_req_t **reqs, int max_reqs, int timeout_ms);
+
+/* Enables readahead for the default context: once a read stream is seen
+ * reading sequentially, a background thread prefetches up to |max_window|
+ * blocks ahead of it into the cache. 0 disables it. Needs a cache. Return 1 on success and -1 on failure. */
+int mdadm_set_readahead(int max_window);
+
+/* Enables write combining for the default context: when a write ends inside
+ * a block, where the next one may carry on, the bytes written into that
+ * block are held in a buffer of up to |max_blocks| blocks (at most
+ * COMBINE_MAX_BLOCKS), with a mask of the bytes written, so that small
+ * adjacent or overlapping writes merge into one block write. A held block
+ * goes into the JBOD once complete (without being read), or merged into its
+ * current contents once evicted from the buffer, read (through any path of
+ * the context), flushed by mdadm_flush or mdadm_unmount, or about to be left
+ * behind by the JBOD head moving to another disk. Other contexts sharing the
+ * cache see the held bytes only once they reach the JBOD. Not used with a
+ * write-back cache, which holds the writes back already. 0 disables it,
+ * flushing the buffer. Return 1 on success and -1 on failure. */
+int mdadm_set_write_combining(int max_blocks);
+
+/* Same as mdadm_set_write_combining, on |ctx|. */
+int mdadm_ctx_set_write_combining(mdadm_ctx_t *ctx, int max_blocks);
+
+/* Number of I/O size classes of mdadm_stats_t: I/Os of up to 1 byte, then of
+ * 2, 3-4, 5-8 bytes and so on, up to 513-1024 bytes. */
+#define MDADM_STATS_IO_SIZES 11
+
+/* Counters of mdadm, since the start or mdadm_reset_stats. The I/O counters
+ * cover every context, and count the reads and writes that succeeded,
+ * synchronous, streamed or asynchronous. */
+typedef struct {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t io_sizes[MDADM_STATS_IO_SIZES];  /* reads and writes, by size class */
+  uint64_t seeks_issued;   /* seeks sent to position the JBOD heads */
+  uint64_t seeks_avoided;  /* seeks skipped, the head being known to be there */
+  uint64_t writes_combined;  /* partial block writes held by the write-combining buffer */
+  uint64_t reads_hedged;   /* block reads of a mirrored volume tried on a second replica */
+  cache_stats_t cache;     /* of the default cache, see cache_get_stats */
+  jbod_stats_t jbod;       /* of every connection, see jbod_get_stats */
+} mdadm_stats_t;
+
+/* Stores a snapshot of the counters in |stats|. Counting takes relaxed
+ * atomic increments only, so it is always on; a snapshot taken while I/O
+ * runs is not exactly consistent across counters. */
+void mdadm_get_stats(mdadm_stats_t *stats);
+
+/* Sets the counters of mdadm, of the default cache and of the connections
+ * back to 0. */
+void mdadm_reset_stats(void);
+
+/* Starts appending a snapshot of the counters to the file at |path| every
+ * |interval_ms| milliseconds, from a background thread, as one line of JSON
+ * each (see stats_write_json), and a last one when stopped. A NULL |path|
+ * stops it. Return 1 on success and -1 on failure. */
+int mdadm_set_stats_dump(const char *path, int interval_ms);
+
 #endif
@@ -5,230 +5,1199 @@
 #include <stdio.h>
 #include <errno.h>
 #include <err.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "net.h"
 #include "jbod.h"
+#include "util.h"
 
 /* Implementing  Client component to connect to JBOD server & Execute JBOD operations over network */ 
 
 
+// A JBOD backend: how the operations of its connections are executed. Every command travels as an
+// encoded op, so the backend works at that level: operation() executes one, send() and recv() the
+// two halves of a batch, and pump() makes progress on the asynchronous operations of a connection,
+// returning the number completed, or -1 on failure.
+typedef struct {
+	const char *name;
+	int (*operation)(jbod_conn_t *conn, uint32_t op, uint8_t *block);
+	bool (*send)(jbod_conn_t *conn, jbod_request_t *reqs, int count);
+	int (*recv)(jbod_conn_t *conn, jbod_request_t *reqs, int count);
+	int (*pump)(jbod_conn_t *conn, bool readable);
+} jbod_backend_ops_t;
+
+// A connection to a JBOD. Its lock keeps the packets of one operation or batch together on the
+// socket, when several threads share the connection.
+struct jbod_conn {
+	const jbod_backend_ops_t *backend;
+	int sd;			// socket descriptor, -1 when not connected (or for the local JBOD)
+	pthread_mutex_t lock;
+
+	// Asynchronous operations (see jbod_async_queue), in request order
+	jbod_aop_t *send_head;	// queued, not completely sent yet
+	jbod_aop_t *send_tail;
+	size_t send_off;	// bytes of the packet of 'send_head' already sent
+	jbod_aop_t *wait_head;	// sent, waiting for their response
+	jbod_aop_t *wait_tail;
+
+	// Responses being received (see recv_packet)
+	uint8_t rbuf[JBOD_BATCH_MAX * HEADER_LEN + JBOD_BLOCK_SIZE];	// bytes received ahead, not parsed yet
+	size_t rlen;		// bytes in 'rbuf'
+	size_t rspec;		// bytes read along with a header into the block expected after it
+	bool rhave_header;	// the header of the current response is parsed
+	uint32_t rop;		// ... and its fields
+	uint16_t rret;
+	size_t rpayload;	// bytes of block it announced
+	size_t rgot;		// bytes of the block received so far
+	uint8_t rsink[JBOD_BLOCK_SIZE];	// blocks nobody waits for
+	bool want_out;		// registered for EPOLLOUT, to send the rest of the queue
+	jbod_loop_t *loop;	// event loop the connection is added to, if any
+
+	// Local backend: the connection's own mount state and head, as a server keeps per connection
+	bool local_mounted;
+	int local_disk;
+	int local_block;
+};
+
+// An event loop over the connections added to it
+struct jbod_loop {
+	int epfd;
+	jbod_conn_t *conns[JBOD_LOOP_MAX_CONNS];
+	int num_conns;
+};
+
+static const jbod_backend_ops_t backends[JBOD_NUM_BACKENDS];
+
 // Global Variables declaration
-int cli_sd = -1; // Client socket descriptor for the connection to the server
+static jbod_conn_t default_conn = { .backend = &backends[JBOD_BACKEND_NET], .sd = -1,
+				    .lock = PTHREAD_MUTEX_INITIALIZER };	// of jbod_connect()
+static pthread_mutex_t local_lock = PTHREAD_MUTEX_INITIALIZER;	// of the JBOD linked in, for every local connection
+static int local_mounts = 0;			// local connections that mounted the JBOD
+static jbod_conn_t *local_owner = NULL;		// local connection the JBOD head is positioned for
+static jbod_stats_t stats;			// of every connection, updated with relaxed atomics
+
+// Function count_op() - counts an operation sent, and traces it in the debug log
+static void count_op(uint32_t op) {
+	debug_log("jbod op: cmd %u disk %u block %u", op >> 26, (op >> 22) & 0xf, op & 0xff);
+	if ((op >> 26) < JBOD_NUM_CMDS)
+	    __atomic_add_fetch(&stats.ops[op >> 26], 1, __ATOMIC_RELAXED);
+}
+
+// Function count_round_trip() - counts a send of requests that the sender will wait on
+static void count_round_trip(void) {
+	__atomic_add_fetch(&stats.round_trips, 1, __ATOMIC_RELAXED);
+}
+
+// Function count_sent() / count_received() - counts the packets and bytes that went over a socket
+static void count_sent(int packets, size_t bytes) {
+	__atomic_add_fetch(&stats.packets_sent, packets, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.bytes_sent, bytes, __ATOMIC_RELAXED);
+}
+
+static void count_received(int packets, size_t bytes) {
+	__atomic_add_fetch(&stats.packets_received, packets, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.bytes_received, bytes, __ATOMIC_RELAXED);
+}
 
 
-// Function nread() - attempts to read n bytes from fd;
-// returns true on success and false on failure 
-static bool nread(int fd, int len, uint8_t *buf) {
+// Function nwritev() - attempts to write all the buffers of 'iov' to fd, resuming after short writes;
+// returns true on success and false on failure
+static bool nwritev(int fd, struct iovec *iov, int iovcnt) {
 
-	int retval;
-	int num_read = 0;
+	ssize_t retval;
 
-	// To read 'len' number of bytes from socket handle, into the buffer  
-	while (num_read < len) {
+	while (iovcnt > 0) {
 
-	  retval = read(fd, &buf[num_read], len - num_read );
+	  retval = writev(fd, iov, iovcnt);
 
-	  // On read error, return false
-	  if (retval < 0)
+	  // On write error, return false (an interrupted call is simply retried)
+	  if (retval < 0) {
+	      if (errno == EINTR)
+	          continue;
 	      return false;
+	  }
 
-	  // On end-of read
-	  if (retval == 0)   
-	      break;
+	  // Skip the buffers written completely, and advance into the one written partly
+	  while ((iovcnt > 0) && ((size_t) retval >= iov->iov_len)) {
+	      retval -= iov->iov_len;
+	      iov++;
+	      iovcnt--;
+	  }
 
-	  // When all bytes are read
-	  if (retval == len) 
-	      return true;
-	      
-	  num_read += retval;
+	  if (iovcnt > 0) {
+	      iov->iov_base = (uint8_t *) iov->iov_base + retval;
+	      iov->iov_len -= retval;
+	  }
 	}
 
 	// On success, return true
 	return true;
+}
 
+// Function carries_payload() - whether the request of 'op' is followed by a block of data
+static bool carries_payload(uint32_t op) {
+	return (op >> 26) == JBOD_WRITE_BLOCK;
 }
 
-// Function nwrite() - attempts to write n bytes to fd;
-// returns true on success and false on failure 
-static bool nwrite(int fd, int len, uint8_t *buf) {
+//// Codec - the packets of the wire protocol, sent from and received into the caller's blocks
 
-	int returnval;
-	int num_write = 0;
+// Function encode_header() - writes the header of the request of 'op' into 'header'; 'payload' when
+// a block follows it
+static void encode_header(uint8_t *header, uint32_t op, bool payload) {
 
-	// To write bytes of length 'len' to socket handle, from buffer; received from send_packet()  
-	while (num_write < len) {
+	uint16_t len = htons(payload ? HEADER_LEN + JBOD_BLOCK_SIZE : HEADER_LEN);
+	uint16_t ret = htons(0);
 
-	  returnval = write(fd, &buf[num_write], (len - num_write) );
+	op = htonl(op);
+	memcpy(&header[0], &len, sizeof(len));
+	memcpy(&header[sizeof(len)], &op, sizeof(op));
+	memcpy(&header[sizeof(len) + sizeof(op)], &ret, sizeof(ret));
+}
 
-	  // On write error, return false
-	  if (returnval < 0)
-             return false;
+// Function decode_header() - reads the fields of the header of a response
+static void decode_header(const uint8_t *header, uint16_t *len, uint32_t *op, uint16_t *ret) {
 
-	  num_write += returnval;
-	}
+	memcpy(len, &header[0], sizeof(*len));
+	memcpy(op, &header[sizeof(*len)], sizeof(*op));
+	memcpy(ret, &header[sizeof(*len) + sizeof(*op)], sizeof(*ret));
 
-	// On success, return true	
-	return true; 
+	*len = ntohs(*len);
+	*op = ntohl(*op);
+	*ret = ntohs(*ret);
 }
 
-// Function recv_packet() - attempts to receive a packet from fd;
-// returns true on success and false on failure
-static bool recv_packet(int fd, uint32_t *op, uint16_t *ret, uint8_t *block) {
+// Function returns_payload() - whether the response to 'op' is followed by a block of data
+static bool returns_payload(uint32_t op) {
+	return ((op >> 26) == JBOD_READ_BLOCK) || ((op >> 26) == JBOD_SIGN_BLOCK);
+}
 
-	uint16_t len ;
-	int length = HEADER_LEN;
-	
-	uint8_t header[HEADER_LEN];           // array size is 8
-	uint8_t new_header[JBOD_BLOCK_SIZE];  // array size is 256
+// Function consume() - drops the first 'len' bytes received ahead into the connection buffer
+static void consume(jbod_conn_t *conn, size_t len) {
 
-	// Read bytes from socket handle into buffer 'header'
-	if (nread(fd, length, header) == false)
-	    return false;
+	conn->rlen -= len;
+	memmove(conn->rbuf, conn->rbuf + len, conn->rlen);
+}
 
-	// If read is successful, fetch the header data i.e. 8 bytes
-	int offset = 0;
-	memcpy(&len, &header[offset], sizeof(len));
-	offset += sizeof(len);
-	memcpy(op, &header[offset], sizeof(*op));
-	offset += sizeof(*op);
-	memcpy(ret, &header[offset], sizeof(*ret));
-	offset += sizeof(*ret);
-
-	// Convert header info from network bytes to host data
-	len = ntohs(len);
-	*op = ntohl(*op);
-	*ret = ntohs(*ret);
+// Function quick_ack() - has the socket acknowledge what it received at once: a server answering
+// with Nagle on holds the next responses of a batch until then. The kernel drops back to delayed
+// acknowledgements as soon as requests go out, so it is armed again whenever the receiver is about
+// to wait, which is when an acknowledgement held back would stall the server.
+static void quick_ack(int sd) {
+	setsockopt(sd, IPPROTO_TCP, TCP_QUICKACK, &(int) { 1 }, sizeof(int));
+}
 
-	// If length field of 'header' fetched is more than HEADER_LEN
-	if (len > HEADER_LEN) {
-	    int new_length = JBOD_BLOCK_SIZE ;
-	    
-	    // Continue to read bytes from socket handle into buffer 'new_header' i.e. 256 bytes
-  	    if (nread(fd, new_length, new_header) == false)
-	        return false;
+// Function recv_packet() - receives the response to the request of 'req_op', its block straight
+// into 'block' (or the connection's sink when NULL, or when the request expects none). Without
+// 'wait', it stops where the socket has nothing more for now, and picks up from there on the next
+// call. The header is read along with the block expected after it, or with up to 'lookahead' bytes
+// of the headers expected after it; what comes in ahead of a response waits in the connection
+// buffer. Returns 1 once the response is complete, with its header fields in 'op' and 'ret', 0 when
+// it would block and -1 on failure.
+static int recv_packet(jbod_conn_t *conn, uint32_t req_op, size_t lookahead, uint8_t *block, bool wait,
+		       uint32_t *op, uint16_t *ret) {
 
-	    // If reading block is successful, then fetch the data directly to 'block'
-	    for (int j = 0; j < JBOD_BLOCK_SIZE; j++) {
-		 memset(block+j, new_header[j], 1);
+	uint8_t *dst = (returns_payload(req_op) && (block != NULL)) ? block : conn->rsink;
+	int flags = wait ? 0 : MSG_DONTWAIT;
+
+	while (true) {
+
+	    struct iovec iov[2];
+	    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 1 };
+	    ssize_t got;
+
+	    if ((conn->rhave_header == false) && (conn->rlen >= HEADER_LEN)) {
+
+	        uint16_t len;
+	        decode_header(conn->rbuf, &len, &conn->rop, &conn->rret);
+	        consume(conn, HEADER_LEN);
+	        conn->rhave_header = true;
+	        conn->rpayload = (len > HEADER_LEN) ? JBOD_BLOCK_SIZE : 0;
+
+	        // Bytes read into the block ahead of a response without one belong to the next ones
+	        if (conn->rpayload == 0) {
+	            memcpy(conn->rbuf + conn->rlen, dst, conn->rspec);
+	            conn->rlen += conn->rspec;
+	            conn->rspec = 0;
+	        }
+	        conn->rgot = conn->rspec;
+	        conn->rspec = 0;
 	    }
 
-            offset += sizeof(*block);	    
-	}
-	    
-	// On success, return true
-	return true;
+	    if (conn->rhave_header == true) {
 
-}
+	        // The block, from what came ahead of it first, then straight from the socket
+	        if ((conn->rgot < conn->rpayload) && (conn->rlen > 0)) {
+	            size_t take = (conn->rlen < conn->rpayload - conn->rgot) ? conn->rlen : conn->rpayload - conn->rgot;
+	            memcpy(dst + conn->rgot, conn->rbuf, take);
+	            consume(conn, take);
+	            conn->rgot += take;
+	        }
 
-// Function send_packet() - attempts to send a packet to sd; 
-// returns true on success and false on failure */
-static bool send_packet(int sd, uint32_t op, uint8_t *block) {
+	        if (conn->rgot == conn->rpayload) {
+	            *op = conn->rop;
+	            *ret = conn->rret;
+	            conn->rhave_header = false;
+	            count_received(1, HEADER_LEN + conn->rpayload);
+	            return 1;
+	        }
 
-	int offset = 0;
-	uint16_t len, length;
-	uint16_t ret = 0;
+	        iov[0].iov_base = dst + conn->rgot;
+	        iov[0].iov_len = conn->rpayload - conn->rgot;
+	    }
+	    else {
 
-	uint8_t header[HEADER_LEN + JBOD_BLOCK_SIZE]; // array size is 264
+	        // The rest of the header, with the block expected after it in the same call
+	        size_t want = HEADER_LEN;
+	        if (returns_payload(req_op) == false)
+	            want = (lookahead > HEADER_LEN) ? lookahead : HEADER_LEN;
+	        if (want > sizeof(conn->rbuf))
+	            want = sizeof(conn->rbuf);
 
-	// Check if there exist any data in the block
-	if (block == NULL)
-	    length = HEADER_LEN;
-	else
-	    length = HEADER_LEN + JBOD_BLOCK_SIZE;
+	        iov[0].iov_base = conn->rbuf + conn->rlen;
+	        iov[0].iov_len = want - conn->rlen;
+	        if (returns_payload(req_op) == true) {
+	            iov[1].iov_base = dst;
+	            iov[1].iov_len = JBOD_BLOCK_SIZE;
+	            msg.msg_iovlen = 2;
+	        }
+	    }
 
-	// Convert header info i.e. 8 bytes, from host to network bytes
-	len = htons(length);
-	op = htonl(op);
-	ret = htons(ret);
+	    got = recvmsg(conn->sd, &msg, flags);
 
-	// Construct buffer 'header' struct data
-	memcpy(&header[offset], &len, sizeof(len));
-	offset += sizeof(len);
-	memcpy(&header[offset], &op, sizeof(op));
-	offset += sizeof(op);
-	memcpy(&header[offset], &ret, sizeof(ret));
-	offset += sizeof(ret);
+	    if (got < 0) {
+	        if (errno == EINTR)
+	            continue;
+	        if ((wait == false) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+	            return 0;
+	        return -1;
+	    }
 
-	// If the block has data, then include this data in buffer 'header'
-	if (block != NULL) {
+	    // The server closed the connection
+	    if (got == 0)
+	        return -1;
 
-	    for (int j = 0; j < JBOD_BLOCK_SIZE; j++) {
-	         memset(&header[offset], block[j], 1);
-	         offset += 1;
+	    if (conn->rhave_header == true)
+	        conn->rgot += got;
+	    else if ((size_t) got <= iov[0].iov_len)
+	        conn->rlen += got;
+	    else {
+	        conn->rlen += iov[0].iov_len;
+	        conn->rspec = got - iov[0].iov_len;
 	    }
+	}
+}
 
-	} // end-of-IF
+// Function reset_recv() - forgets what was received of the responses of the connection
+static void reset_recv(jbod_conn_t *conn) {
 
-	
-	// Write bytes to socket handle from the buffer 'header'
-	if (nwrite(sd, length, header) == false)
+	conn->rlen = conn->rspec = conn->rgot = conn->rpayload = 0;
+	conn->rhave_header = false;
+}
+
+// Function send_packet() - attempts to send the request of 'op' to sd, its block (for a write)
+// straight from 'block'; returns true on success and false on failure
+static bool send_packet(int sd, uint32_t op, uint8_t *block) {
+
+	uint8_t header[HEADER_LEN];
+	bool payload = carries_payload(op) && (block != NULL);
+	struct iovec iov[2] = { { .iov_base = header, .iov_len = HEADER_LEN },
+				{ .iov_base = block, .iov_len = JBOD_BLOCK_SIZE } };
+
+	encode_header(header, op, payload);
+
+	if (nwritev(sd, iov, payload ? 2 : 1) == false)
 	    return false;
-  
+
+	count_op(op);
+	count_sent(1, payload ? HEADER_LEN + JBOD_BLOCK_SIZE : HEADER_LEN);
+
 	// On success, return true
 	return true;
-
 }
 
-// Function jbod_connect() - attempts to connect to server and set the global cli_sd variable to socket;
-// returns true if successful and false if not
-bool jbod_connect(const char *ip, uint16_t port) {
+// Function open_socket() - attempts to connect to the server at ip and port;
+// returns the socket descriptor if successful and -1 if not
+static int open_socket(const char *ip, uint16_t port) {
 
 	struct sockaddr_in caddr;
+	int sd;
 
 	caddr.sin_family = AF_INET;
-	caddr.sin_port = htons(JBOD_PORT);
+	caddr.sin_port = htons(port);
 
-	if (inet_aton(JBOD_SERVER, &caddr.sin_addr) == 0 ) {
-	    return false;
+	if (inet_aton(ip, &caddr.sin_addr) == 0 ) {
+	    return -1;
 	}
 
-	cli_sd = socket(PF_INET , SOCK_STREAM, 0 );
-	if (cli_sd == -1) {
+	sd = socket(PF_INET , SOCK_STREAM, 0 );
+	if (sd == -1) {
 	    printf("Error in socket creation [%s]\n", strerror(errno));
-	    return false;
+	    return -1;
 	}
 
-	if (connect(cli_sd, (const struct sockaddr *) &caddr, sizeof(caddr) ) == -1 ) {
+	if (connect(sd, (const struct sockaddr *) &caddr, sizeof(caddr) ) == -1 ) {
 	    printf("Error in socket connect [%s]\n", strerror(errno));
-	    return false;
+	    close(sd);
+	    return -1;
 	}
-	
+
+	// Batches are sent whole; small requests must not wait on Nagle for the responses of the last ones
+	setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &(int) { 1 }, sizeof(int));
+	quick_ack(sd);
+
 	//printf("Connected to the JBOD server\n");
-	
-	// On success, return 0
-	return true;
 
+	// On success, return the socket descriptor
+	return sd;
+}
+
+
+// Function jbod_conn_open() - attempts to open a connection of its own to the server at ip and port;
+// returns the connection if successful and NULL if not
+jbod_conn_t *jbod_conn_open(const char *ip, uint16_t port) {
+	return jbod_conn_open_backend(JBOD_BACKEND_NET, ip, port);
+}
+
+
+// Function jbod_conn_open_backend() - attempts to open a connection to the JBOD of the backend;
+// returns the connection if successful and NULL if not
+jbod_conn_t *jbod_conn_open_backend(jbod_backend_t backend, const char *ip, uint16_t port) {
+
+	if ((backend < 0) || (backend >= JBOD_NUM_BACKENDS))
+	    return NULL;
+
+	jbod_conn_t *conn = malloc(sizeof(jbod_conn_t));
+	if (conn == NULL)
+	    return NULL;
+
+	conn->backend = &backends[backend];
+	conn->sd = (backend == JBOD_BACKEND_NET) ? open_socket(ip, port) : -1;
+	if ((backend == JBOD_BACKEND_NET) && (conn->sd == -1)) {
+	    free(conn);
+	    return NULL;
+	}
+
+	pthread_mutex_init(&conn->lock, NULL);
+	conn->send_head = conn->send_tail = NULL;
+	conn->wait_head = conn->wait_tail = NULL;
+	conn->send_off = 0;
+	reset_recv(conn);
+	conn->want_out = false;
+	conn->loop = NULL;
+	conn->local_mounted = false;
+	conn->local_disk = conn->local_block = 0;
+	return conn;
+}
+
+
+// Function jbod_conn_close() - closes a connection opened by jbod_conn_open()
+void jbod_conn_close(jbod_conn_t *conn) {
+
+	if (conn == NULL)
+	    return;
+
+	if (conn->sd != -1)
+	    close(conn->sd);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+
+// Function jbod_default_conn() - the connection of jbod_connect()
+jbod_conn_t *jbod_default_conn(void) {
+	return &default_conn;
+}
+
+
+// Function jbod_connect() - attempts to connect to server and set up the default connection;
+// returns true if successful and false if not
+bool jbod_connect(const char *ip, uint16_t port) {
+	return jbod_connect_backend(JBOD_BACKEND_NET, ip, port);
+}
+
+
+// Function jbod_connect_backend() - sets up the default connection on the backend (to the server
+// at ip and port, for the network); returns true if successful and false if not
+bool jbod_connect_backend(jbod_backend_t backend, const char *ip, uint16_t port) {
+
+	if ((backend < 0) || (backend >= JBOD_NUM_BACKENDS))
+	    return false;
+
+	default_conn.backend = &backends[backend];
+	reset_recv(&default_conn);
+	if (backend == JBOD_BACKEND_LOCAL)
+	    return true;
+
+	default_conn.sd = open_socket(ip, port);
+
+	return default_conn.sd != -1;
 }
 
  
-// Function jbod_disconnect() - disconnects from the JBOD server, and resets cli_sd
+// Function jbod_disconnect() - disconnects the default connection from the JBOD server
 void jbod_disconnect(void) {
 
-	close(cli_sd);
-	cli_sd = -1;
+	if (default_conn.sd != -1)
+	    close(default_conn.sd);
+	default_conn.sd = -1;
+	default_conn.backend = &backends[JBOD_BACKEND_NET];
 	
 	//printf("Closed connection to the JBOD server\n");
 }
 
 
-// Function jbod_client_operation() - sends the JBOD operation to the server, and
-// receives and processes the response
-int jbod_client_operation(uint32_t op, uint8_t *block) {
+// Function conn_operation() - sends the JBOD operation to the server, and
+// receives and processes the response; the connection lock is held by the caller
+static int conn_operation(jbod_conn_t *conn, uint32_t op, uint8_t *block) {
 
         uint16_t ret;
 
 	// Send JBOD Operation to Server; for writing the data packet
-	if (send_packet(cli_sd, op, block) == false)
+	if (send_packet(conn->sd, op, block) == false)
 	    return -1;	
+	count_round_trip();
 	
 
         // Receive from Server the data packet; as response to the sent JBOD Operation 	
-	if (recv_packet(cli_sd, &op, &ret, block) == false)
+	if (recv_packet(conn, op, HEADER_LEN, block, true, &op, &ret) != 1)
+	    return -1;
+
+	// The return code in the response header tells whether the JBOD operation failed
+	if (ret != 0)
 	    return -1;
 
-	
 	// On success, return 0
 	return 0;
 }
+
+
+// Function jbod_conn_operation() - executes one JBOD operation over the connection
+int jbod_conn_operation(jbod_conn_t *conn, uint32_t op, uint8_t *block) {
+
+	pthread_mutex_lock(&conn->lock);
+	int rc = conn->backend->operation(conn, op, block);
+	pthread_mutex_unlock(&conn->lock);
+
+	return rc;
+}
+
+
+// Function jbod_client_operation() - executes one JBOD operation over the default connection
+int jbod_client_operation(uint32_t op, uint8_t *block) {
+	return jbod_conn_operation(&default_conn, op, block);
+}
+
+
+// Function send_requests() - sends up to JBOD_BATCH_MAX operations back to back, in one go;
+// returns true on success and false on failure
+static bool send_requests(jbod_conn_t *conn, jbod_request_t *reqs, int count) {
+
+	struct iovec iov[2 * JBOD_BATCH_MAX];
+	uint8_t headers[JBOD_BATCH_MAX][HEADER_LEN];
+	int iovcnt = 0;
+	size_t bytes = 0;
+
+	// Construct the packets: the header of each request, followed by its block for a write
+	for (int i = 0; i < count; i++) {
+
+	    jbod_request_t *req = &reqs[i];
+	    bool payload = carries_payload(req->op) && (req->block != NULL);
+
+	    count_op(req->op);
+	    encode_header(headers[i], req->op, payload);
+
+	    iov[iovcnt].iov_base = headers[i];
+	    iov[iovcnt].iov_len = HEADER_LEN;
+	    iovcnt++;
+
+	    if (payload) {
+	        iov[iovcnt].iov_base = req->block;
+	        iov[iovcnt].iov_len = JBOD_BLOCK_SIZE;
+	        iovcnt++;
+	    }
+
+	    req->result = -1;
+	    bytes += payload ? HEADER_LEN + JBOD_BLOCK_SIZE : HEADER_LEN;
+	}
+
+	count_round_trip();
+	if (nwritev(conn->sd, iov, iovcnt) == false)
+	    return false;
+
+	count_sent(count, bytes);
+	quick_ack(conn->sd);
+	return true;
+}
+
+// Function recv_responses() - receives the responses to the operations sent by send_requests(),
+// which the server answers in request order; returns 0 if all of them succeeded and -1 otherwise
+static int recv_responses(jbod_conn_t *conn, jbod_request_t *reqs, int count) {
+
+	int rc = 0;
+
+	for (int i = 0; i < count; i++) {
+
+	    jbod_request_t *req = &reqs[i];
+	    uint32_t op;
+	    uint16_t ret;
+	    int run = 0;
+
+	    // The headers of a run of responses without a block can be read in one go
+	    while ((i + run < count) && (returns_payload(reqs[i + run].op) == false))
+	        run++;
+
+	    if (recv_packet(conn, req->op, run * HEADER_LEN, req->block, true, &op, &ret) != 1)
+	        return -1;
+
+	    if ((op == req->op) && (ret == 0))
+	        req->result = 0;
+	    else
+	        rc = -1;
+	}
+
+	return rc;
+}
+
+// Function conn_batch_many() - executes a batch of operations on each connection. Every round
+// sends up to JBOD_BATCH_MAX operations to each server before draining any response, so the
+// servers work in parallel. Returns 0 if all of them succeeded and -1 otherwise.
+// The connection locks are held by the caller.
+static int conn_batch_many(jbod_conn_t **conns, jbod_request_t **reqs, const int *num_reqs, int num_conns) {
+
+	int count[num_conns];
+	bool sent[num_conns];
+	int rc = 0;
+
+	for (int first = 0; ; first += JBOD_BATCH_MAX) {
+
+	    bool more = false;
+
+	    for (int c = 0; c < num_conns; c++) {
+
+	        count[c] = num_reqs[c] - first;
+	        if (count[c] > JBOD_BATCH_MAX)
+	            count[c] = JBOD_BATCH_MAX;
+
+	        sent[c] = (count[c] > 0) && conns[c]->backend->send(conns[c], reqs[c] + first, count[c]);
+	        if ((count[c] > 0) && (sent[c] == false))
+	            rc = -1;
+
+	        more = more || (num_reqs[c] > first + JBOD_BATCH_MAX);
+	    }
+
+	    for (int c = 0; c < num_conns; c++) {
+	        if ((sent[c] == true) && (conns[c]->backend->recv(conns[c], reqs[c] + first, count[c]) == -1))
+	            rc = -1;
+	    }
+
+	    if (more == false)
+	        break;
+	}
+
+	return rc;
+}
+
+
+// Function jbod_conn_batch() - executes a batch of JBOD operations over the connection, in one
+// round trip; no other thread's operations get in between
+int jbod_conn_batch(jbod_conn_t *conn, jbod_request_t *reqs, int num_reqs) {
+
+	pthread_mutex_lock(&conn->lock);
+	int rc = conn_batch_many(&conn, &reqs, &num_reqs, 1);
+	pthread_mutex_unlock(&conn->lock);
+
+	return rc;
+}
+
+
+// Function jbod_conn_batch_many() - executes a batch of JBOD operations on each of several
+// connections, with all the servers working at the same time
+int jbod_conn_batch_many(jbod_conn_t **conns, jbod_request_t **reqs, const int *num_reqs, int num_conns) {
+
+	int c, rc;
+
+	for (c = 0; c < num_conns; c++)
+	    pthread_mutex_lock(&conns[c]->lock);
+
+	rc = conn_batch_many(conns, reqs, num_reqs, num_conns);
+
+	for (c = num_conns - 1; c >= 0; c--)
+	    pthread_mutex_unlock(&conns[c]->lock);
+
+	return rc;
+}
+
+
+// Function jbod_client_batch() - executes a batch of JBOD operations over the default connection
+int jbod_client_batch(jbod_request_t *reqs, int num_reqs) {
+	return jbod_conn_batch(&default_conn, reqs, num_reqs);
+}
+
+
+//// Asynchronous operations - queued on a connection, and completed by its event loop
+
+// Function packet_len() - length of the request packet of an operation
+static size_t packet_len(jbod_aop_t *aop) {
+	return (carries_payload(aop->op) && (aop->block != NULL)) ? HEADER_LEN + JBOD_BLOCK_SIZE : HEADER_LEN;
+}
+
+// Function fail_all() - completes every queued and waiting operation of the connection as failed
+static void fail_all(jbod_conn_t *conn) {
+
+	jbod_aop_t *lists[2] = { conn->wait_head, conn->send_head };
+
+	conn->wait_head = conn->wait_tail = NULL;
+	conn->send_head = conn->send_tail = NULL;
+	conn->send_off = 0;
+	reset_recv(conn);
+
+	for (int l = 0; l < 2; l++) {
+	    jbod_aop_t *aop = lists[l];
+	    while (aop != NULL) {
+	        jbod_aop_t *next = aop->next;
+	        aop->result = -1;
+	        aop->done(aop);
+	        aop = next;
+	    }
+	}
+}
+
+// Function async_send() - sends the queued operations, up to the first one not ready, without
+// blocking; returns 0 on success and -1 on failure
+static int async_send(jbod_conn_t *conn) {
+
+	struct iovec iov[2 * JBOD_BATCH_MAX];
+	uint8_t headers[JBOD_BATCH_MAX][HEADER_LEN];
+
+	while ((conn->send_head != NULL) && (conn->send_head->ready == true)) {
+
+	    int iovcnt = 0, count = 0;
+	    jbod_aop_t *aop;
+
+	    // Gather the packets of up to JBOD_BATCH_MAX ready operations
+	    for (aop = conn->send_head; (aop != NULL) && (aop->ready == true) && (count < JBOD_BATCH_MAX); aop = aop->next) {
+
+	        encode_header(headers[count], aop->op, packet_len(aop) > HEADER_LEN);
+
+	        iov[iovcnt].iov_base = headers[count];
+	        iov[iovcnt].iov_len = HEADER_LEN;
+	        iovcnt++;
+
+	        if (packet_len(aop) > HEADER_LEN) {
+	            iov[iovcnt].iov_base = aop->block;
+	            iov[iovcnt].iov_len = JBOD_BLOCK_SIZE;
+	            iovcnt++;
+	        }
+
+	        count++;
+	    }
+
+	    // Skip what an earlier call already sent of the first packet
+	    size_t skip = conn->send_off;
+	    int first = 0;
+	    while (skip >= iov[first].iov_len) {
+	        skip -= iov[first].iov_len;
+	        first++;
+	    }
+	    iov[first].iov_base = (uint8_t *) iov[first].iov_base + skip;
+	    iov[first].iov_len -= skip;
+
+	    struct msghdr msg = { .msg_iov = &iov[first], .msg_iovlen = iovcnt - first };
+	    ssize_t sent = sendmsg(conn->sd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	    if (sent < 0) {
+	        if (errno == EINTR)
+	            continue;
+	        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+	            return 0;		// the rest goes when the socket is writable again
+	        return -1;
+	    }
+
+	    // Move the operations sent completely over to the waiting list
+	    size_t done = conn->send_off + sent;
+	    int moved = 0;
+	    count_round_trip();
+
+	    while ((conn->send_head != NULL) && (done >= packet_len(conn->send_head))) {
+
+	        aop = conn->send_head;
+	        done -= packet_len(aop);
+
+	        conn->send_head = aop->next;
+	        if (conn->send_head == NULL)
+	            conn->send_tail = NULL;
+
+	        aop->next = NULL;
+	        if (conn->wait_tail != NULL)
+	            conn->wait_tail->next = aop;
+	        else
+	            conn->wait_head = aop;
+	        conn->wait_tail = aop;
+	        count_op(aop->op);
+	        moved++;
+	    }
+
+	    conn->send_off = done;
+	    count_sent(moved, sent);
+	    quick_ack(conn->sd);
+	}
+
+	return 0;
+}
+
+// Function async_recv() - receives the responses available, without blocking, and completes their
+// operations; returns the number of operations completed, or -1 on failure
+static int async_recv(jbod_conn_t *conn) {
+
+	int completed = 0;
+
+	while (true) {
+
+	    jbod_aop_t *aop = conn->wait_head;
+	    uint32_t op;
+	    uint16_t ret;
+	    int run = 0;
+
+	    // Nothing is expected: anything but the socket having nothing to read is a failure
+	    if (aop == NULL) {
+	        uint8_t byte;
+	        ssize_t got = recv(conn->sd, &byte, 1, MSG_DONTWAIT | MSG_PEEK);
+	        if ((got < 0) && (errno == EINTR))
+	            continue;
+	        return ((got < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) ? completed : -1;
+	    }
+
+	    for (jbod_aop_t *next = aop; (next != NULL) && (returns_payload(next->op) == false); next = next->next)
+	        run++;
+
+	    int rc = recv_packet(conn, aop->op, run * HEADER_LEN, aop->block, false, &op, &ret);
+	    if (rc != 1)
+	        return (rc == 0) ? completed : -1;
+
+	    // A complete response: it answers the oldest waiting operation
+	    conn->wait_head = aop->next;
+	    if (conn->wait_head == NULL)
+	        conn->wait_tail = NULL;
+	    aop->next = NULL;
+
+	    aop->result = ((op == aop->op) && (ret == 0)) ? 0 : -1;
+	    completed++;
+
+	    aop->done(aop);
+	}
+}
+
+// Function async_pump() - sends and receives what the connection can without blocking, then
+// registers for the events it waits for; returns the operations completed, or -1 on failure
+static int async_pump(jbod_conn_t *conn, bool readable) {
+
+	int completed = 0;
+
+	if (readable == true) {
+	    completed = async_recv(conn);
+	    if (completed == -1) {
+	        fail_all(conn);
+	        return -1;
+	    }
+	}
+
+	// Completions may have made more operations ready
+	if (async_send(conn) == -1) {
+	    fail_all(conn);
+	    return -1;
+	}
+
+	bool want_out = (conn->send_head != NULL) && (conn->send_head->ready == true);
+
+	if ((conn->loop != NULL) && (want_out != conn->want_out)) {
+	    struct epoll_event ev = { .events = EPOLLIN | (want_out ? EPOLLOUT : 0), .data.ptr = conn };
+	    epoll_ctl(conn->loop->epfd, EPOLL_CTL_MOD, conn->sd, &ev);
+	    conn->want_out = want_out;
+	}
+
+	return completed;
+}
+
+
+// Function jbod_async_queue() - queues an operation at the end of the connection; it is sent once it
+// and all the operations before it are ready
+void jbod_async_queue(jbod_conn_t *conn, jbod_aop_t *aop) {
+
+	aop->result = -1;
+	aop->next = NULL;
+
+	if (conn->send_tail != NULL)
+	    conn->send_tail->next = aop;
+	else
+	    conn->send_head = aop;
+	conn->send_tail = aop;
+}
+
+
+// Function jbod_async_ready() - marks a queued operation as ready to be sent
+void jbod_async_ready(jbod_conn_t *conn, jbod_aop_t *aop) {
+	(void) conn;
+	aop->ready = true;
+}
+
+
+// Function jbod_async_idle() - whether the connection has no operation queued or waiting
+bool jbod_async_idle(jbod_conn_t *conn) {
+	return (conn->send_head == NULL) && (conn->wait_head == NULL);
+}
+
+
+// Function jbod_loop_new() - creates an event loop
+jbod_loop_t *jbod_loop_new(void) {
+
+	jbod_loop_t *loop = calloc(1, sizeof(jbod_loop_t));
+	if (loop == NULL)
+	    return NULL;
+
+	loop->epfd = epoll_create1(0);
+	if (loop->epfd == -1) {
+	    free(loop);
+	    return NULL;
+	}
+
+	return loop;
+}
+
+
+// Function jbod_loop_free() - frees an event loop; its connections stay open
+void jbod_loop_free(jbod_loop_t *loop) {
+
+	if (loop == NULL)
+	    return;
+
+	for (int c = 0; c < loop->num_conns; c++)
+	    loop->conns[c]->loop = NULL;
+
+	close(loop->epfd);
+	free(loop);
+}
+
+
+// Function jbod_loop_add() - adds a connection to the event loop; returns 0 on success, -1 on failure
+int jbod_loop_add(jbod_loop_t *loop, jbod_conn_t *conn) {
+
+	if ((loop->num_conns == JBOD_LOOP_MAX_CONNS) || (conn->loop != NULL))
+	    return -1;
+
+	// A local connection completes its operations as the loop sends them; it has nothing to wait for
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+	if ((conn->sd != -1) && (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, conn->sd, &ev) == -1))
+	    return -1;
+
+	conn->loop = loop;
+	conn->want_out = false;
+	loop->conns[loop->num_conns++] = conn;
+
+	return 0;
+}
+
+
+// Function loop_wait() - waits up to 'timeout_us' microseconds (-1 forever) for events of
+// the loop: with epoll_pwait2() for a timeout finer than a millisecond, where the kernel has it,
+// and rounded up to milliseconds otherwise
+static int loop_wait(jbod_loop_t *loop, struct epoll_event *events, long timeout_us) {
+
+	if ((timeout_us > 0) && (timeout_us % 1000 != 0)) {
+
+	    struct timespec timeout = { .tv_sec = timeout_us / 1000000, .tv_nsec = (timeout_us % 1000000) * 1000 };
+	    int n = epoll_pwait2(loop->epfd, events, JBOD_LOOP_MAX_CONNS, &timeout, NULL);
+
+	    if ((n != -1) || (errno != ENOSYS))
+	        return n;
+	}
+
+	return epoll_wait(loop->epfd, events, JBOD_LOOP_MAX_CONNS, (timeout_us < 0) ? -1 : (int) ((timeout_us + 999) / 1000));
+}
+
+// Function jbod_loop_run() - sends the ready operations of every connection, then waits up to
+// 'timeout_ms' (-1 forever) for responses and completes their operations; returns the number of
+// operations completed, or -1 when a connection failed (its operations are completed as failed)
+int jbod_loop_run(jbod_loop_t *loop, int timeout_ms) {
+	return jbod_loop_run_us(loop, (timeout_ms < 0) ? -1 : timeout_ms * 1000L);
+}
+
+// Function jbod_loop_run_us() - same as jbod_loop_run(), waiting up to 'timeout_us' microseconds
+int jbod_loop_run_us(jbod_loop_t *loop, long timeout_us) {
+
+	struct epoll_event events[JBOD_LOOP_MAX_CONNS];
+	int c, n, completed = 0, rc = 0;
+	bool waiting = false;
+
+	for (c = 0; c < loop->num_conns; c++) {
+	    int got = loop->conns[c]->backend->pump(loop->conns[c], false);
+	    if (got == -1)
+	        rc = -1;
+	    else
+	        completed += got;
+	    if (jbod_async_idle(loop->conns[c]) == false)
+	        waiting = true;
+	}
+
+	// Nothing in flight: nothing to wait for. Operations completed already: only the responses
+	// that are in are collected.
+	if (waiting == false)
+	    return (rc == -1) ? -1 : completed;
+	if (completed > 0)
+	    timeout_us = 0;
+
+	do {
+	    n = loop_wait(loop, events, timeout_us);
+	} while ((n == -1) && (errno == EINTR));
+
+	for (int e = 0; e < n; e++) {
+
+	    jbod_conn_t *conn = events[e].data.ptr;
+	    int got = conn->backend->pump(conn, (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0);
+
+	    if (got == -1)
+	        rc = -1;
+	    else
+	        completed += got;
+	}
+
+	return (rc == -1) ? -1 : completed;
+}
+
+
+// Function probe_done() - completion of the request of jbod_conn_probe()
+static void probe_done(jbod_aop_t *aop) {
+	*(bool *) aop->arg = true;
+}
+
+// Function jbod_conn_probe() - whether the server answers a request on the connection, which is in
+// no event loop, within 'timeout_ms'; returns 1 if it does, 0 if not, and -1 on failure
+int jbod_conn_probe(jbod_conn_t *conn, int timeout_ms) {
+
+	jbod_loop_t *loop = jbod_loop_new();
+	uint8_t block[JBOD_BLOCK_SIZE];
+	bool answered = false;
+	jbod_aop_t aop = { .op = (uint32_t) JBOD_SIGN_BLOCK << 26, .block = block, .ready = true,
+			   .done = probe_done, .arg = &answered };
+	int rc = -1;
+
+	if ((loop != NULL) && (jbod_loop_add(loop, conn) == 0)) {
+
+	    jbod_async_queue(conn, &aop);
+
+	    // Signing changes nothing, and any answer, even a failure, tells the connection is served
+	    rc = 0;
+	    for (int waited = 0; (answered == false) && (waited < timeout_ms); waited += 10)
+	        if (jbod_loop_run(loop, 10) == -1) {
+	            rc = -1;
+	            break;
+	        }
+	    if ((rc == 0) && (answered == true))
+	        rc = 1;
+	}
+
+	jbod_loop_free(loop);
+
+	return rc;
+}
+
+
+// Function jbod_op_counts() - the operations sent so far, per command
+void jbod_op_counts(uint64_t counts[JBOD_NUM_CMDS]) {
+	for (int cmd = 0; cmd < JBOD_NUM_CMDS; cmd++)
+	    counts[cmd] = __atomic_load_n(&stats.ops[cmd], __ATOMIC_RELAXED);
+}
+
+
+// Function jbod_round_trips() - the round trips taken so far
+uint64_t jbod_round_trips(void) {
+	return __atomic_load_n(&stats.round_trips, __ATOMIC_RELAXED);
+}
+
+
+// Function jbod_get_stats() - the counters of every connection
+void jbod_get_stats(jbod_stats_t *out) {
+	uint64_t *from = (uint64_t *) &stats, *to = (uint64_t *) out;
+
+	for (size_t i = 0; i < sizeof(stats) / sizeof(uint64_t); i++)
+	    to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+}
+
+
+// Function jbod_reset_stats() - sets the counters back to 0
+void jbod_reset_stats(void) {
+	uint64_t *counters = (uint64_t *) &stats;
+
+	for (size_t i = 0; i < sizeof(stats) / sizeof(uint64_t); i++)
+	    __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+}
+
+
+//// Local backend - the JBOD linked into this process (jbod_operation), without a server
+
+// Function local_seek() - positions the JBOD head where the connection left it, when another one
+// moved it since; seeks to the disk only when 'disk_only'. Expects the local lock to be held.
+static void local_seek(jbod_conn_t *conn, bool disk_only) {
+
+	if (local_owner == conn)
+	    return;
+
+	jbod_operation(JBOD_SEEK_TO_DISK << 26 | conn->local_disk << 22, NULL);
+
+	// Past the last block of a disk, the head is wherever the JBOD left it; mdadm seeks again anyway
+	if ((disk_only == false) && (conn->local_block < JBOD_NUM_BLOCKS_PER_DISK))
+	    jbod_operation(JBOD_SEEK_TO_BLOCK << 26 | conn->local_block, NULL);
+
+	local_owner = conn;
+}
+
+// Function local_operation() - executes one JBOD operation on the local JBOD; returns 0 on success
+// and -1 on failure. The JBOD is one device with one head, shared by every local connection: each
+// connection mounts it on its own and keeps a head of its own, which the JBOD's is brought back to
+// whenever another connection moved it.
+static int local_operation(jbod_conn_t *conn, uint32_t op, uint8_t *block) {
+
+	int rc = -1;
+
+	pthread_mutex_lock(&local_lock);
+
+	switch (op >> 26) {
+
+	case JBOD_MOUNT:
+	    // The first connection mounts the JBOD, with its head at the start
+	    if (conn->local_mounted == false) {
+	        rc = (local_mounts == 0) ? jbod_operation(op, block) : 0;
+	        if ((rc == 0) && (local_mounts++ == 0))
+	            local_owner = conn;
+	        conn->local_mounted = (rc == 0);
+	        conn->local_disk = conn->local_block = 0;
+	    }
+	    break;
+
+	case JBOD_UNMOUNT:
+	    // ... and the last one unmounts it
+	    if (conn->local_mounted == true) {
+	        rc = (local_mounts == 1) ? jbod_operation(op, block) : 0;
+	        if (rc == 0) {
+	            local_mounts--;
+	            conn->local_mounted = false;
+	            if (local_owner == conn)
+	                local_owner = NULL;
+	        }
+	    }
+	    break;
+
+	case JBOD_SEEK_TO_DISK:
+	    if ((conn->local_mounted == true) && ((rc = jbod_operation(op, block)) == 0)) {
+	        conn->local_disk = (op >> 22) & 0xF;
+	        conn->local_block = 0;
+	        local_owner = conn;
+	    }
+	    break;
+
+	case JBOD_SEEK_TO_BLOCK:
+	    if (conn->local_mounted == true) {
+	        local_seek(conn, true);
+	        if ((rc = jbod_operation(op, block)) == 0)
+	            conn->local_block = op & 0xFF;
+	    }
+	    break;
+
+	case JBOD_READ_BLOCK:
+	case JBOD_WRITE_BLOCK:
+	    // The JBOD moves on to the next block after a read or write
+	    if (conn->local_mounted == true) {
+	        local_seek(conn, false);
+	        if ((rc = jbod_operation(op, block)) == 0)
+	            conn->local_block += 1;
+	    }
+	    break;
+
+	default:
+	    rc = jbod_operation(op, block);
+	    break;
+	}
+
+	pthread_mutex_unlock(&local_lock);
+
+	count_op(op);
+
+	return (rc == 0) ? 0 : -1;
+}
+
+// Function local_send() - executes a batch of operations right away, storing their results;
+// returns true
+static bool local_send(jbod_conn_t *conn, jbod_request_t *reqs, int count) {
+
+	uint8_t scratch[JBOD_BLOCK_SIZE];
+
+	for (int i = 0; i < count; i++) {
+	    uint8_t *block = (reqs[i].block != NULL) ? reqs[i].block : scratch;
+	    bool data = ((reqs[i].op >> 26) == JBOD_READ_BLOCK) || ((reqs[i].op >> 26) == JBOD_SIGN_BLOCK) ||
+			carries_payload(reqs[i].op);
+	    reqs[i].result = local_operation(conn, reqs[i].op, data ? block : NULL);
+	}
+
+	return true;
+}
+
+// Function local_recv() - the outcome of a batch executed by local_send(); returns 0 if all of
+// its operations succeeded and -1 otherwise
+static int local_recv(jbod_conn_t *conn, jbod_request_t *reqs, int count) {
+
+	(void) conn;
+
+	for (int i = 0; i < count; i++) {
+	    if (reqs[i].result != 0)
+	        return -1;
+	}
+
+	return 0;
+}
+
+// Function local_pump() - executes the ready operations at the head of the queue, completing
+// each one at once; returns the number of operations completed
+static int local_pump(jbod_conn_t *conn, bool readable) {
+
+	jbod_request_t req;
+	int completed = 0;
+
+	(void) readable;
+
+	// A completion may make the next operations ready, so the head is checked again after each one
+	while ((conn->send_head != NULL) && (conn->send_head->ready == true)) {
+
+	    jbod_aop_t *aop = conn->send_head;
+
+	    conn->send_head = aop->next;
+	    if (conn->send_head == NULL)
+	        conn->send_tail = NULL;
+	    aop->next = NULL;
+
+	    req = (jbod_request_t) { .op = aop->op, .block = aop->block };
+	    local_send(conn, &req, 1);
+
+	    aop->result = req.result;
+	    completed++;
+
+	    aop->done(aop);
+	}
+
+	return completed;
+}
+
+static const jbod_backend_ops_t backends[JBOD_NUM_BACKENDS] = {
+	[JBOD_BACKEND_NET] = { "net", conn_operation, send_requests, recv_responses, async_pump },
+	[JBOD_BACKEND_LOCAL] = { "local", local_operation, local_send, local_recv, local_pump },
+};
+
+
+// Function jbod_backend_name() - the short name of a backend, or NULL
+const char *jbod_backend_name(jbod_backend_t backend) {
+	return ((backend >= 0) && (backend < JBOD_NUM_BACKENDS)) ? backends[backend].name : NULL;
+}
@@ -4,12 +4,165 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "jbod.h"
+
 #define HEADER_LEN (sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint16_t))
 #define JBOD_SERVER "127.0.0.1"
 #define JBOD_PORT 3333
 
+/* Maximum number of requests sent back to back before their responses are
+ * drained; longer batches are sent in several rounds. */
+#define JBOD_BATCH_MAX 64
+
+/* One JBOD operation of a pipelined batch. |block| is the payload sent with
+ * JBOD_WRITE_BLOCK and receives the one of JBOD_READ_BLOCK and JBOD_SIGN_BLOCK;
+ * it is unused (may be NULL) for the other commands. |result| is set to 0 on
+ * success and -1 on failure. */
+typedef struct {
+  uint32_t op;
+  uint8_t *block;
+  int result;
+} jbod_request_t;
+
+/* A connection to a JBOD server. Operations and batches on one connection may
+ * come from several threads; each one is sent and answered as a whole. */
+typedef struct jbod_conn jbod_conn_t;
+
+/* JBOD backends: where the operations of a connection are executed. */
+typedef enum {
+  JBOD_BACKEND_NET,    /* a JBOD server, over TCP (the default) */
+  JBOD_BACKEND_LOCAL,  /* the JBOD linked into this process (jbod_operation),
+                        * one device shared by every local connection; each
+                        * one mounts it and moves a head of its own, as the
+                        * server keeps per connection */
+  JBOD_NUM_BACKENDS,
+} jbod_backend_t;
+
+/* Returns the short name of |backend| ("net", "local"), or NULL. */
+const char *jbod_backend_name(jbod_backend_t backend);
+
+/* Opens a connection to the server at |ip| and |port|. Returns NULL on
+ * failure. */
+jbod_conn_t *jbod_conn_open(const char *ip, uint16_t port);
+
+/* Same as jbod_conn_open, on |backend|; |ip| and |port| are only used by the
+ * network backend. */
+jbod_conn_t *jbod_conn_open_backend(jbod_backend_t backend, const char *ip, uint16_t port);
+void jbod_conn_close(jbod_conn_t *conn);
+
+/* Returns the connection set up by jbod_connect. */
+jbod_conn_t *jbod_default_conn(void);
+
+/* Same as jbod_client_operation and jbod_client_batch, over |conn|. */
+int jbod_conn_operation(jbod_conn_t *conn, uint32_t op, uint8_t *block);
+int jbod_conn_batch(jbod_conn_t *conn, jbod_request_t *reqs, int num_reqs);
+
+/* Executes the |num_reqs[i]| operations of |reqs[i]| on |conns[i]|, for each
+ * of the |num_conns| connections, which must all be different. Every server
+ * gets its operations before any response is drained, so the servers work
+ * in parallel. Returns 0 if every operation succeeded and -1 otherwise. */
+int jbod_conn_batch_many(jbod_conn_t **conns, jbod_request_t **reqs, const int *num_reqs, int num_conns);
+
 int jbod_client_operation(uint32_t op, uint8_t *block);
+
+/* Asynchronous operations. An operation is queued on a connection and
+ * completed later by the event loop the connection is added to, which calls
+ * |done|. The server answers in order, so any number of operations can be
+ * outstanding on a connection. The asynchronous functions of a connection and
+ * its loop are used by one thread at a time, and not while a synchronous
+ * operation or batch is in progress on it. */
+typedef struct jbod_aop jbod_aop_t;
+typedef void (*jbod_aop_done_fn)(jbod_aop_t *aop);
+
+struct jbod_aop {
+  uint32_t op;
+  uint8_t *block;          /* as in jbod_request_t */
+  int result;              /* 0 on success and -1 on failure, set before |done| */
+  bool ready;              /* may be sent; holds back the operations after it */
+  jbod_aop_done_fn done;
+  void *arg;               /* for the caller */
+  jbod_aop_t *next;        /* used by the connection */
+};
+
+/* Maximum number of connections of an event loop. */
+#define JBOD_LOOP_MAX_CONNS 16
+
+typedef struct jbod_loop jbod_loop_t;
+
+/* Queues |aop| after the operations already queued on |conn|. It is sent
+ * once it, and every operation before it, is ready. */
+void jbod_async_queue(jbod_conn_t *conn, jbod_aop_t *aop);
+
+/* Marks a queued operation as ready; for instance a write, once its data is
+ * known. */
+void jbod_async_ready(jbod_conn_t *conn, jbod_aop_t *aop);
+
+/* Returns true if |conn| has no operation queued or waiting for a response. */
+bool jbod_async_idle(jbod_conn_t *conn);
+
+/* Returns a new event loop (epoll), or NULL on failure. */
+jbod_loop_t *jbod_loop_new(void);
+void jbod_loop_free(jbod_loop_t *loop);
+
+/* Adds |conn| to |loop|. Returns 0 on success and -1 on failure. */
+int jbod_loop_add(jbod_loop_t *loop, jbod_conn_t *conn);
+
+/* Sends the ready operations of every connection of |loop|, then waits up to
+ * |timeout_ms| (-1 for ever) for responses, and completes their operations.
+ * Returns the number of operations completed, or -1 if a connection failed
+ * (its outstanding operations are then completed as failed). */
+int jbod_loop_run(jbod_loop_t *loop, int timeout_ms);
+
+/* Same as jbod_loop_run, waiting up to |timeout_us| microseconds (-1 for
+ * ever); a timeout under a millisecond is rounded up to one on kernels
+ * without epoll_pwait2. */
+int jbod_loop_run_us(jbod_loop_t *loop, long timeout_us);
+
+/* Sends |conn|, which has nothing outstanding and is in no event loop, a
+ * request that changes nothing, and waits up to |timeout_ms| for the answer:
+ * a server serving one connection at a time (as jbod_server does) leaves the
+ * requests of a connection unread while another one is open. Returns 1 if
+ * the server answered, 0 if it did not (|conn| can then only be closed), and
+ * -1 on failure. */
+int jbod_conn_probe(jbod_conn_t *conn, int timeout_ms);
+
+/* Counters of every connection, since the start or jbod_reset_stats. The
+ * local backend sends operations without any packet on a socket. */
+typedef struct {
+  uint64_t ops[JBOD_NUM_CMDS];  /* operations sent, per command */
+  uint64_t round_trips;         /* see jbod_round_trips */
+  uint64_t packets_sent;
+  uint64_t packets_received;
+  uint64_t bytes_sent;          /* headers and blocks, as they went on the wire */
+  uint64_t bytes_received;
+} jbod_stats_t;
+
+/* Stores the counters in |stats|. They are updated with relaxed atomics, so
+ * a snapshot taken while operations run is not exactly consistent across
+ * counters. */
+void jbod_get_stats(jbod_stats_t *stats);
+
+/* Sets the counters back to 0. */
+void jbod_reset_stats(void);
+
+/* Stores in |counts| the number of operations of each command sent so far by
+ * every connection. */
+void jbod_op_counts(uint64_t counts[JBOD_NUM_CMDS]);
+
+/* Returns the number of round trips taken so far by every connection: sends
+ * of one operation, or of a batch or run of asynchronous operations sent
+ * back to back. The local backend takes none. */
+uint64_t jbod_round_trips(void);
+
+/* Sends |num_reqs| operations back to back, then receives their responses in
+ * order, so a batch costs one round trip instead of one per operation.
+ * Returns 0 if every operation succeeded and -1 otherwise; the result of each
+ * operation is in its |result| field. */
+int jbod_client_batch(jbod_request_t *reqs, int num_reqs);
 bool jbod_connect(const char *ip, uint16_t port);
+
+/* Same as jbod_connect, on |backend|. */
+bool jbod_connect_backend(jbod_backend_t backend, const char *ip, uint16_t port);
 void jbod_disconnect(void);
 
 #endif
@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "readahead.h"
+#include "cache.h"
+#include "jbod.h"
+
+/* Implementing sequential Stream detection and asynchronous Readahead for mdadm */
+
+// A read stream, i.e. a run of reads each starting where the previous one ended
+typedef struct {
+  bool active;
+  uint32_t next_block;	// linear block the stream is expected to read next
+  uint32_t ahead;	// prefetches are queued up to (not including) this block
+  int seq_reads;	// sequential reads seen since the stream started
+  int window;		// number of blocks kept prefetched ahead of the stream
+  long last_use;	// detector clock of the latest read, for replacing streams
+} ra_stream_t;
+
+// Declaring CONSTANTS
+#define QUEUE_LEN 1024			// Maximum number of queued prefetches
+const int MIN_WINDOW = 2;		// Smallest prefetch window (blocks)
+const int INITIAL_WINDOW = 4;		// Window of a newly detected stream (blocks)
+const uint32_t TOTAL_BLOCKS = JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK;
+
+// Global Variables declaration
+static ra_stream_t streams[READAHEAD_NUM_STREAMS];
+static long ra_clock = 0;
+static int max_window = 0;
+static long last_hits = 0;	// cache prefetch counters seen by the previous read,
+static long last_wasted = 0;	// to tell whether prefetching has been paying off
+
+// Prefetch queue, drained by the background thread
+static uint32_t queue[QUEUE_LEN];
+static int queue_head = 0;
+static int queue_len = 0;
+static bool running = false;
+static bool stopping = false;
+static bool busy = false;		// the thread is fetching a block right now
+static readahead_fetch_fn fetch_fn = NULL;
+static pthread_t worker;
+static pthread_mutex_t ra_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;	// queue not empty, or stopping
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;	// a fetch completed
+
+
+//// HELPER Functions ////
+
+// Helper function-1: readahead_worker() - background thread, prefetches the queued blocks
+static void *readahead_worker(void *arg) {
+
+  (void) arg;
+
+  pthread_mutex_lock(&ra_lock);
+
+  while (true) {
+
+      while ((stopping == false) && (queue_len == 0))
+          pthread_cond_wait(&work_cond, &ra_lock);
+
+      if (stopping == true)
+          break;
+
+      uint32_t block = queue[queue_head];
+      queue_head = (queue_head + 1) % QUEUE_LEN;
+      queue_len -= 1;
+      busy = true;
+
+      // Fetch without holding the queue lock, so that readers can keep queueing
+      pthread_mutex_unlock(&ra_lock);
+      fetch_fn(block);
+      pthread_mutex_lock(&ra_lock);
+
+      busy = false;
+      pthread_cond_broadcast(&idle_cond);
+  }
+
+  pthread_mutex_unlock(&ra_lock);
+  return NULL;
+}
+
+// Helper function-2: find_stream() - stream that a read starting at 'first' block continues, or NULL
+static ra_stream_t *find_stream(uint32_t first) {
+
+  int i;
+
+  // A sequential read starts at the block after the previous read, or within its last block
+  for (i = 0; i < READAHEAD_NUM_STREAMS; i++) {
+      if ((streams[i].active == true) &&
+          ((first == streams[i].next_block) || (first + 1 == streams[i].next_block)))
+          return &streams[i];
+  }
+
+  return NULL;
+}
+
+// Helper function-3: new_stream() - takes a free stream slot, or the least recently used stream
+static ra_stream_t *new_stream(void) {
+
+  int i, victim = 0;
+
+  for (i = 0; i < READAHEAD_NUM_STREAMS; i++) {
+      if (streams[i].active == false)
+          return &streams[i];
+      if (streams[i].last_use < streams[victim].last_use)
+          victim = i;
+  }
+
+  return &streams[victim];
+}
+
+
+//// Readahead START Function - Starts the background prefetching thread
+int readahead_start(int window, readahead_fetch_fn fetch) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  if ((running == true) || (window < 1) || (fetch == NULL))
+      return -1;
+
+  memset(streams, 0, sizeof(streams));
+  max_window = window;
+  fetch_fn = fetch;
+  queue_head = queue_len = 0;
+  stopping = false;
+  busy = false;
+
+  if (pthread_create(&worker, NULL, readahead_worker, NULL) != 0)
+      return -1;
+
+  running = true;
+  return 1;
+}
+
+
+//// Readahead STOP Function - Drops the pending prefetches and stops the thread
+void readahead_stop(void) {
+
+  if (running == false)
+      return;
+
+  pthread_mutex_lock(&ra_lock);
+  stopping = true;
+  queue_len = 0;
+  pthread_cond_signal(&work_cond);
+  pthread_mutex_unlock(&ra_lock);
+
+  pthread_join(worker, NULL);
+  running = false;
+}
+
+
+//// Readahead CANCEL Function - Drops the pending prefetches, and waits for the one in progress
+void readahead_cancel(void) {
+
+  if (running == false)
+      return;
+
+  pthread_mutex_lock(&ra_lock);
+  queue_len = 0;
+  while (busy == true)
+      pthread_cond_wait(&idle_cond, &ra_lock);
+
+  // The streams start over; anything they had queued is gone
+  memset(streams, 0, sizeof(streams));
+  pthread_mutex_unlock(&ra_lock);
+}
+
+
+//// Readahead ENABLED Function
+bool readahead_enabled(void) {
+  return running;
+}
+
+
+//// Readahead OBSERVE Function - Detects sequential streams, and queues the blocks ahead of them
+void readahead_observe(uint32_t addr, uint32_t len) {
+
+  if ((running == false) || (len == 0))
+      return;
+
+  uint32_t first = addr / JBOD_BLOCK_SIZE;
+  uint32_t last = (addr + len - 1) / JBOD_BLOCK_SIZE;
+  long prefetched, hits, wasted;
+
+  // Readers on several threads share the stream table
+  pthread_mutex_lock(&ra_lock);
+
+  cache_prefetch_stats(&prefetched, &hits, &wasted);
+  ra_clock += 1;
+
+  ra_stream_t *s = find_stream(first);
+
+  if (s != NULL) {
+
+      s->seq_reads += 1;
+
+      // Shrink the window when prefetched blocks got evicted unread, grow it when they got used
+      if (wasted > last_wasted)
+          s->window = (s->window / 2 > MIN_WINDOW) ? s->window / 2 : MIN_WINDOW;
+      else if (hits > last_hits)
+          s->window = (s->window * 2 < max_window) ? s->window * 2 : max_window;
+  }
+  else {
+
+      // Not a continuation of any stream: start tracking a new one
+      s = new_stream();
+      s->active = true;
+      s->seq_reads = 0;
+      s->window = (INITIAL_WINDOW < max_window) ? INITIAL_WINDOW : max_window;
+      s->ahead = last + 1;
+  }
+
+  s->next_block = last + 1;
+  s->last_use = ra_clock;
+  if (s->ahead < s->next_block)
+      s->ahead = s->next_block;
+
+  last_hits = hits;
+  last_wasted = wasted;
+
+  // Only a stream that has read sequentially at least once gets blocks prefetched
+  if (s->seq_reads == 0) {
+      pthread_mutex_unlock(&ra_lock);
+      return;
+  }
+
+  uint32_t target = s->next_block + s->window;
+  if (target > TOTAL_BLOCKS)
+      target = TOTAL_BLOCKS;
+
+  while ((s->ahead < target) && (queue_len < QUEUE_LEN)) {
+      queue[(queue_head + queue_len) % QUEUE_LEN] = s->ahead;
+      queue_len += 1;
+      s->ahead += 1;
+  }
+
+  pthread_cond_signal(&work_cond);
+  pthread_mutex_unlock(&ra_lock);
+}
@@ -0,0 +1,34 @@
+#ifndef READAHEAD_H_
+#define READAHEAD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Number of read streams tracked at the same time. */
+#define READAHEAD_NUM_STREAMS 8
+
+/* Prefetches one block, given by its linear block number, into the cache.
+ * Returns 1 on success and -1 on failure. */
+typedef int (*readahead_fetch_fn)(uint32_t linear_block);
+
+/* Returns 1 on success and -1 on failure. Starts the background thread that
+ * prefetches blocks through |fetch|, with windows of up to |max_window|
+ * blocks. Calling it again without first calling readahead_stop should fail. */
+int readahead_start(int max_window, readahead_fetch_fn fetch);
+
+/* Drops the pending prefetches and stops the background thread. */
+void readahead_stop(void);
+
+/* Drops the pending prefetches and waits for the one in progress, if any. */
+void readahead_cancel(void);
+
+/* Returns true if readahead is running. */
+bool readahead_enabled(void);
+
+/* Feeds a read of |len| bytes at |addr| to the stream detector. Once a stream
+ * is seen reading sequentially, the blocks ahead of it are queued for
+ * prefetching. The window is sized from the default cache's prefetch
+ * counters. Safe to call from several threads. */
+void readahead_observe(uint32_t addr, uint32_t len);
+
+#endif
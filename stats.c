@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.h"
+
+/* Implementing the machine-readable Dump of the mdadm statistics */
+
+// Declaring CONSTANTS
+static const char *cmd_names[JBOD_NUM_CMDS] = { "mount", "unmount", "seek_to_disk", "seek_to_block",
+                                                "read_block", "write_block", "sign_block" };
+
+// Global Variables declaration
+static FILE *dump_file = NULL;
+static int dump_interval_ms = 0;
+static stats_snapshot_fn snapshot_fn = NULL;
+static bool running = false;
+static bool stopping = false;
+static pthread_t dumper;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_cond;	// stopping, on CLOCK_MONOTONIC so that the interval ignores clock changes
+
+
+//// HELPER Functions ////
+
+// Helper function-1: write_snapshot() - appends a snapshot to the dump file
+static void write_snapshot(void) {
+
+  mdadm_stats_t stats;
+
+  snapshot_fn(&stats);
+  stats_write_json(dump_file, &stats);
+  fflush(dump_file);
+}
+
+// Helper function-2: stats_dumper() - background thread, writes a snapshot every interval until stopped
+static void *stats_dumper(void *arg) {
+
+  struct timespec next;
+
+  (void) arg;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  pthread_mutex_lock(&dump_lock);
+
+  while (stopping == false) {
+
+      next.tv_sec += dump_interval_ms / 1000;
+      next.tv_nsec += (dump_interval_ms % 1000) * 1000000L;
+      if (next.tv_nsec >= 1000000000L) {
+          next.tv_sec += 1;
+          next.tv_nsec -= 1000000000L;
+      }
+
+      while ((stopping == false) && (pthread_cond_timedwait(&stop_cond, &dump_lock, &next) == 0))
+          ;
+
+      write_snapshot();
+  }
+
+  pthread_mutex_unlock(&dump_lock);
+  return NULL;
+}
+
+
+//// JSON Function
+void stats_write_json(FILE *out, const mdadm_stats_t *stats) {
+
+  struct timespec now;
+  const cache_stats_t *c = &stats->cache;
+  const jbod_stats_t *j = &stats->jbod;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  fprintf(out, "{\"time_ms\":%lld,\"mdadm\":{\"reads\":%lu,\"writes\":%lu,\"bytes_read\":%lu,"
+          "\"bytes_written\":%lu,\"io_sizes\":[", (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000,
+          (unsigned long) stats->reads, (unsigned long) stats->writes, (unsigned long) stats->bytes_read,
+          (unsigned long) stats->bytes_written);
+  for (int k = 0; k < MDADM_STATS_IO_SIZES; k++)
+      fprintf(out, "%s%lu", (k > 0) ? "," : "", (unsigned long) stats->io_sizes[k]);
+  fprintf(out, "],\"seeks_issued\":%lu,\"seeks_avoided\":%lu,\"writes_combined\":%lu,\"reads_hedged\":%lu},",
+          (unsigned long) stats->seeks_issued, (unsigned long) stats->seeks_avoided,
+          (unsigned long) stats->writes_combined, (unsigned long) stats->reads_hedged);
+
+  fprintf(out, "\"cache\":{\"lookups\":%ld,\"hits\":%ld,\"misses\":%ld,\"inserts\":%ld,\"evictions\":%ld,"
+          "\"writebacks\":%ld,\"prefetched\":%ld,\"prefetch_hits\":%ld,\"prefetch_wasted\":%ld,\"restored\":%ld},",
+          c->lookups, c->hits, c->misses, c->inserts, c->evictions, c->writebacks, c->prefetched,
+          c->prefetch_hits, c->prefetch_wasted, c->restored);
+
+  fprintf(out, "\"jbod\":{\"ops\":{");
+  for (int cmd = 0; cmd < JBOD_NUM_CMDS; cmd++)
+      fprintf(out, "%s\"%s\":%lu", (cmd > 0) ? "," : "", cmd_names[cmd], (unsigned long) j->ops[cmd]);
+  fprintf(out, "},\"round_trips\":%lu,\"packets_sent\":%lu,\"packets_received\":%lu,\"bytes_sent\":%lu,"
+          "\"bytes_received\":%lu}}\n", (unsigned long) j->round_trips, (unsigned long) j->packets_sent,
+          (unsigned long) j->packets_received, (unsigned long) j->bytes_sent, (unsigned long) j->bytes_received);
+}
+
+
+//// Dump START Function - Opens the dump file and starts the background thread
+int stats_dump_start(const char *path, int interval_ms, stats_snapshot_fn snapshot) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  pthread_condattr_t attr;
+
+  if ((running == true) || (path == NULL) || (interval_ms < 1) || (snapshot == NULL))
+      return -1;
+
+  dump_file = fopen(path, "a");
+  if (dump_file == NULL)
+      return -1;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&stop_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  dump_interval_ms = interval_ms;
+  snapshot_fn = snapshot;
+  stopping = false;
+
+  if (pthread_create(&dumper, NULL, stats_dumper, NULL) != 0) {
+      pthread_cond_destroy(&stop_cond);
+      fclose(dump_file);
+      dump_file = NULL;
+      return -1;
+  }
+
+  running = true;
+  return 1;
+}
+
+
+//// Dump STOP Function - Writes a last snapshot and stops the thread
+void stats_dump_stop(void) {
+
+  if (running == false)
+      return;
+
+  pthread_mutex_lock(&dump_lock);
+  stopping = true;
+  pthread_cond_signal(&stop_cond);
+  pthread_mutex_unlock(&dump_lock);
+
+  pthread_join(dumper, NULL);
+  pthread_cond_destroy(&stop_cond);
+
+  fclose(dump_file);
+  dump_file = NULL;
+  running = false;
+}
@@ -0,0 +1,28 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+
+#include "mdadm.h"
+
+/* Stores a snapshot of the counters in |stats|. */
+typedef void (*stats_snapshot_fn)(mdadm_stats_t *stats);
+
+/* Writes |stats| to |out| as one line of JSON, stamped with the wall clock
+ * time in milliseconds:
+ *   {"time_ms":..., "mdadm":{"reads":..., ..., "io_sizes":[...], ...},
+ *    "cache":{"lookups":..., ...}, "jbod":{"ops":{"mount":..., ...}, ...}}
+ * with the fields of mdadm_stats_t, cache_stats_t and jbod_stats_t. */
+void stats_write_json(FILE *out, const mdadm_stats_t *stats);
+
+/* Returns 1 on success and -1 on failure. Opens |path| for appending, and
+ * starts the background thread that writes a snapshot taken with |snapshot|
+ * there every |interval_ms| milliseconds. Calling it again without first
+ * calling stats_dump_stop should fail. */
+int stats_dump_start(const char *path, int interval_ms, stats_snapshot_fn snapshot);
+
+/* Writes a last snapshot, stops the background thread and closes the file.
+ * Does nothing when no dump is running. */
+void stats_dump_stop(void);
+
+#endif
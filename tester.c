@@ -10,6 +10,10 @@
 #include <fcntl.h>
 #include <err.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <glob.h>
+#include <limits.h>
 
 #include "cache.h"
 #include "jbod.h"
@@ -17,51 +21,289 @@
 #include "util.h"
 #include "tester.h"
 #include "net.h"
+#include "bench.h"
+#include "verify.h"
+#include "geometry.h"
 
-#define TESTER_ARGUMENTS "hw:s:"
-#define USAGE                                               \
-  "USAGE: test [-h] [-w workload-file] [-s cache_size] \n"  \
-  "\n"                                                      \
-  "where:\n"                                                \
-  "    -h - help mode (display this message)\n"             \
-  "\n"                                                      \
+#define TESTER_ARGUMENTS "hbcAWw:s:d:r:t:p:S:g:B:G:T:D:l:L:V:C:M:H:"
+#define USAGE                                                                  \
+  "USAGE: test [-h] [-b [-t threads]] [-c] [-A] [-W] [-r window] [-p policy]\n" \
+  "            [-B backend] [-G workload-spec] [-T threads] [-D stats-file]\n" \
+  "            [-l log-file] [-L log-file] [-V [local:]threads] [-C blocks]\n" \
+  "            [-M port,port[,...] [-H percentile]]\n"                       \
+  "            [-w workload-file] [-s cache_size [-d pool_blocks]\n"        \
+  "            [-S snapshot-file [-g generation]]]\n"                        \
+  "\n"                                                                         \
+  "where:\n"                                                                   \
+  "    -h - help mode (display this message)\n"                                \
+  "    -b - cache benchmark mode (replay the workload's block\n"               \
+  "         accesses against the cache alone, for every cache\n"               \
+  "         size from 2 to 4096 entries)\n"                                    \
+  "    -t - with -b, stress the cache lookups from 1 up to\n"                 \
+  "         'threads' threads instead, on a cache of one shard\n"             \
+  "         and on one of many shards\n"                                      \
+  "    -c - policy comparison mode (replay the workload, or every\n"          \
+  "         traces/*-input without -w, under every eviction policy\n"         \
+  "         and cache size from 2 to 4096 entries; print the hit\n"           \
+  "         rate and the JBOD operations)\n"                                  \
+  "    -A - address translation benchmark mode (check each path\n"        \
+  "         of the volume geometry against divisions, and print\n"        \
+  "         the cost of a translation on each)\n"                          \
+  "    -G - generated benchmark mode (run a synthetic workload\n"           \
+  "         through mdadm instead of a trace, with the cache and\n"       \
+  "         backend options, and print the throughput and the\n"           \
+  "         latency percentiles). The workload is given as\n"             \
+  "         pattern[:option=value,...], where the pattern is seq,\n"        \
+  "         uniform or zipf, and the options are ops (100000),\n"         \
+  "         reads (percent, 70), size (bytes or min-max, 256),\n"         \
+  "         align (256), theta (zipf skew, 0.99) and seed\n"              \
+  "    -T - parallel replay mode (split the volume into a region\n"        \
+  "         per thread, and replay the trace's commands of each\n"      \
+  "         region, or run a -G workload in each, from 'threads'\n"      \
+  "         threads with a connection each, sharing the cache; print\n" \
+  "         each thread's and the overall throughput and latency,\n"    \
+  "         and check the final state of the volume). Needs a server\n" \
+  "         keeping a head per connection, or -B local (a server\n"     \
+  "         serving one connection at a time, as jbod_server, is\n"    \
+  "         refused within a second); the cache cannot be\n"           \
+  "         write-back and readahead is not used\n"                      \
+  "    -D - append the statistics of mdadm, the cache and the\n"          \
+  "         connections to 'stats-file' every second, and when\n"        \
+  "         done, one line of JSON each\n"                                 \
+  "    -l - trace every JBOD operation into the binary debug\n"           \
+  "         log 'log-file'\n"                                             \
+  "    -L - print the binary debug log 'log-file' as text, and exit\n"   \
+  "    -V - verify the volume at SIGNALL (and after -T) from\n"          \
+  "         'threads' threads with a connection each, signing a\n"       \
+  "         chunk of blocks per round trip, and print only the\n"        \
+  "         blocks differing from the expected output; with\n"           \
+  "         local:, the blocks are read (or taken from the cache)\n"    \
+  "         and signed in the tester, which needs a server keeping a\n" \
+  "         head per connection, or -B local. One remote thread\n"     \
+  "         signs over the tester's connection; on a server serving\n"   \
+  "         one connection at a time (jbod_server), it is the only\n"   \
+  "         one, and local: fails\n"                                    \
+  "    -C - combine small writes: hold the block a write ends\n"        \
+  "         inside in a buffer of up to 'blocks' blocks (64 at\n"         \
+  "         most), until complete, evicted, read, flushed or left\n"     \
+  "         behind by the head; not used with -W nor by -T threads\n"    \
+  "    -M - with -G, run the workload on a volume mirrored on the\n"      \
+  "         servers of 'port's (2 to 16) instead: writes go to\n"           \
+  "         every replica, reads to the least busy one; also print\n"     \
+  "         the reads hedged. Readahead is not used, and a server\n"      \
+  "         serving one connection at a time (jbod_server) is\n"          \
+  "         refused within a second\n"                                    \
+  "    -H - with -M, hedge the reads: try a block read on another\n"      \
+  "         replica once it waits past the 'percentile'th\n"               \
+  "         percentile of the latest reads\n"                              \
+  "    -p - cache eviction policy: lru (default), clock, 2q or arc\n"        \
+  "    -B - JBOD backend: net (the server, by default) or local\n"          \
+  "         (the JBOD linked into the tester, to measure mdadm and\n"      \
+  "         the cache without the network)\n"                               \
+  "    -d - store the cached blocks in a pool of 'pool_blocks'\n"            \
+  "         blocks, shared by identical blocks (blocks of a\n"                \
+  "         single byte value take none); the cache size may\n"              \
+  "         then be up to 65536 entries\n"                                   \
+  "    -S - warm the cache from 'snapshot-file', if it holds a\n"          \
+  "         snapshot of the volume's generation, and save the\n"           \
+  "         cache there when the workload is done\n"                         \
+  "    -g - generation of the volume, other than 0 (needed by -S);\n"     \
+  "         move it on whenever the JBOD may have changed since the\n"     \
+  "         snapshot (jbod_server blanks its disks on every mount)\n"      \
+  "    -W - write-back cache (writes reach the JBOD on eviction,\n"            \
+  "         flush or unmount)\n"                                               \
+  "    -r - readahead of up to 'window' blocks ahead of\n"                     \
+  "         sequential reads (needs a cache)\n"                                \
+  "\n"                                                                         \
 
-int run_workload(char *workload, int cache_size);
+#define MAX_REPLICAS 16
+
+/* A volume mirrored across servers, to run a generated workload on (-M). */
+typedef struct {
+  int num_replicas;
+  mdadm_endpoint_t replicas[MAX_REPLICAS];
+  double hedge;           /* percentile of the hedged reads, 0 for none */
+  int combine_blocks;
+} mirror_config_t;
+
+int run_workload(char *workload, const cache_config_t *config, int readahead, const verify_config_t *verify);
+int run_generated_benchmark(const char *spec, const cache_config_t *config, int readahead,
+                            const mirror_config_t *mirror);
+int run_parallel_replay(char *workload, const char *spec, int threads, const cache_config_t *config,
+                        jbod_backend_t backend, const verify_config_t *verify);
+int run_policy_comparison(char *workload, bool write_back);
+int run_cache_benchmark(char *workload);
+int run_lookup_benchmark(char *workload, int max_threads);
+int run_translation_benchmark(void);
 
 int main(int argc, char *argv[])
 {
-  int ch, cache_size = 0;
-  char *workload = NULL;
+  int ch, cache_size = 0, pool_blocks = 0, readahead = 0, threads = 0, replay_threads = 0, combine_blocks = 0;
+  bool benchmark = false, compare = false, write_back = false, verifying = false, translating = false;
+  cache_policy_t policy = CACHE_LRU;
+  jbod_backend_t backend = JBOD_BACKEND_NET;
+  char *workload = NULL, *snapshot = NULL, *generate = NULL, *stats_file = NULL;
+  uint64_t generation = 0;
+  verify_config_t verify = { .mode = VERIFY_REMOTE, .num_threads = 1, .ip = JBOD_SERVER, .port = JBOD_PORT };
+  mirror_config_t mirror = { 0 };
+  char *ports = NULL;
 
   while ((ch = getopt(argc, argv, TESTER_ARGUMENTS)) != -1) {
     switch (ch) {
       case 'h':
         fprintf(stderr, USAGE);
         return 0;
+      case 'b':
+        benchmark = true;
+        break;
+      case 'c':
+        compare = true;
+        break;
+      case 'A':
+        translating = true;
+        break;
+      case 'W':
+        write_back = true;
+        break;
+      case 'p':
+        for (policy = 0; policy < CACHE_NUM_POLICIES; ++policy)
+          if (strcmp(optarg, cache_policy_name(policy)) == 0)
+            break;
+        if (policy == CACHE_NUM_POLICIES) {
+          fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'B':
+        for (backend = 0; backend < JBOD_NUM_BACKENDS; ++backend)
+          if (strcmp(optarg, jbod_backend_name(backend)) == 0)
+            break;
+        if (backend == JBOD_NUM_BACKENDS) {
+          fprintf(stderr, "Unknown JBOD backend (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'r':
+        readahead = atoi(optarg);
+        break;
+      case 'C':
+        combine_blocks = atoi(optarg);
+        break;
       case 's':
         cache_size = atoi(optarg);
         break;
+      case 'd':
+        pool_blocks = atoi(optarg);
+        break;
+      case 'S':
+        snapshot = optarg;
+        break;
+      case 'g':
+        generation = strtoull(optarg, NULL, 0);
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      case 'T':
+        replay_threads = atoi(optarg);
+        break;
+      case 'D':
+        stats_file = optarg;
+        break;
+      case 'l':
+        set_debug_logfile(optarg);
+        enable_debug_log();
+        break;
+      case 'V':
+        if (verify_parse_spec(optarg, &verify) != 1) {
+          fprintf(stderr, "Invalid verification (%s), aborting.\n", optarg);
+          return -1;
+        }
+        verifying = true;
+        break;
+      case 'L':
+        if (decode_debug_log(optarg, stdout) != 1) {
+          fprintf(stderr, "Cannot decode the debug log %s, aborting.\n", optarg);
+          return -1;
+        }
+        return 0;
       case 'w':
         workload = optarg;
         break;
+      case 'G':
+        generate = optarg;
+        break;
+      case 'M':
+        ports = optarg;
+        break;
+      case 'H':
+        mirror.hedge = atof(optarg);
+        break;
       default:
         fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
         return -1;
     }
   }
 
-  if (!workload) {
+  if (translating)
+    return run_translation_benchmark();
+
+  if (!workload && !compare && !generate) {
     fprintf(stderr, USAGE);
     return -1;
   }
 
-  if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
+  for (char *port = ports ? strtok(ports, ",") : NULL; port; port = strtok(NULL, ",")) {
+    if (mirror.num_replicas == MAX_REPLICAS || atoi(port) <= 0 || atoi(port) > UINT16_MAX) {
+      fprintf(stderr, "Invalid mirror ports, aborting.\n");
+      return -1;
+    }
+    mirror.replicas[mirror.num_replicas++] = (mdadm_endpoint_t) { .ip = JBOD_SERVER, .port = atoi(port),
+                                                                  .backend = backend };
+  }
+  mirror.combine_blocks = combine_blocks;
+  if (snapshot && generation == 0) {
+    fprintf(stderr, "A snapshot (-S) needs the volume's generation (-g, other than 0), aborting.\n");
+    return -1;
+  }
+  if (ports && (!generate || replay_threads > 0)) {
+    fprintf(stderr, "A mirrored volume (-M) runs a -G workload only, aborting.\n");
+    return -1;
+  }
+
+  if (benchmark && threads > 0)
+    return run_lookup_benchmark(workload, threads);
+  if (benchmark)
+    return run_cache_benchmark(workload);
+
+  if (!jbod_connect_backend(backend, JBOD_SERVER, JBOD_PORT))
     return -1;
-  
-  run_workload(workload, cache_size);
+  verify.backend = backend;
+  verify.conn = jbod_default_conn();
+
+  cache_config_t config = { .num_entries = cache_size, .write_back = write_back, .policy = policy,
+                            .num_blocks = pool_blocks, .snapshot = snapshot, .generation = generation };
+
+  if (combine_blocks && mdadm_set_write_combining(combine_blocks) != 1)
+    errx(1, "Failed to enable write combining.");
+
+  if (stats_file && mdadm_set_stats_dump(stats_file, 1000) != 1)
+    errx(1, "Failed to dump the statistics to %s.", stats_file);
+
+  int rc = 0;
+  if (compare)
+    run_policy_comparison(workload, write_back);
+  else if (replay_threads > 0)
+    rc = run_parallel_replay(generate ? NULL : workload, generate, replay_threads, &config, backend,
+                             verifying ? &verify : NULL);
+  else if (generate)
+    run_generated_benchmark(generate, &config, readahead, mirror.num_replicas ? &mirror : NULL);
+  else
+    run_workload(workload, &config, readahead, verifying ? &verify : NULL);
+  mdadm_set_stats_dump(NULL, 0);
   jbod_disconnect();
 
-  return 0;
+  return rc;
 }
 
 int equals(const char *s1, const char *s2) {
@@ -80,7 +322,57 @@ static uint32_t encode_op(jbod_cmd_t cmd, int disk_num, int block_num) {
   return op;
 }
 
-int run_workload(char *workload, int cache_size) {
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Signs every block of the JBOD as |verify| says, and compares the
+ * signatures with the expected output of |workload| (its -input replaced by
+ * -expected-output), printing the mismatching blocks on stdout, or every
+ * signature when there is no expected output. A local verification takes
+ * the blocks |cache| holds from it. Returns 1 if the signatures match, 0 if
+ * they do not, and -1 if there is no expected output. */
+static int sign_and_compare(const char *workload, const verify_config_t *verify, cache_t *cache) {
+  char expected_path[PATH_MAX], *suffix;
+  verify_config_t config = *verify;
+  FILE *expected = NULL;
+
+  config.cache = cache;
+
+  snprintf(expected_path, sizeof(expected_path), "%s", workload);
+  suffix = strstr(expected_path, "-input");
+  if (suffix && strlen(suffix) == strlen("-input") &&
+      (size_t) (suffix - expected_path) + strlen("-expected-output") < sizeof(expected_path)) {
+    strcpy(suffix, "-expected-output");
+    expected = fopen(expected_path, "r");
+  }
+
+  double start = now_ns();
+  long mismatches = verify_volume(&config, expected, stdout);
+  if (mismatches == -1) {
+    /* The server keeps the JBOD mounted past the tester otherwise. */
+    mdadm_unmount();
+    errx(1, "Failed to verify the volume.");
+  }
+
+  fprintf(stderr, "verify: %d blocks signed (%s, %d threads) in %.2f ms", JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK,
+          verify_mode_name(verify->mode), verify->num_threads, (now_ns() - start) / 1e6);
+  if (expected) {
+    fprintf(stderr, ", %ld mismatching\n", mismatches);
+    fclose(expected);
+  } else {
+    fprintf(stderr, ", no expected output to check\n");
+  }
+
+  return expected ? (mismatches == 0) : -1;
+}
+
+/* Replays the commands of |workload| through mdadm. SIGNALL prints the
+ * signatures of every block when |sign| is set, or with |verify| (when not
+ * NULL), verifies them against the expected output of |workload|. */
+static void replay_workload(char *workload, bool sign, const verify_config_t *verify) {
   char line[256], cmd[32];
   uint8_t buf[MAX_IO_SIZE];
   uint32_t addr, len, ch;
@@ -92,12 +384,6 @@ int run_workload(char *workload, int cache_size) {
   if (!f)
     err(1, "Cannot open workload file %s", workload);
 
-  if (cache_size) {
-    rc = cache_create(cache_size);
-    if (rc != 1)
-      errx(1, "Failed to create cache.");
-  }
-
   int line_num = 0;
   while (fgets(line, 256, f)) {
     ++line_num;
@@ -107,7 +393,11 @@ int run_workload(char *workload, int cache_size) {
     } else if (equals(line, "UNMOUNT")) {
       rc = mdadm_unmount();
     } else if (equals(line, "SIGNALL")) {
-      for (int i = 0; i < JBOD_NUM_DISKS; ++i)
+      /* The signatures come from the JBOD, so dirty cached blocks go first. */
+      rc = mdadm_flush();
+      if (sign && verify)
+        sign_and_compare(workload, verify, cache_default());
+      for (int i = 0; sign && !verify && i < JBOD_NUM_DISKS; ++i)
         for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j) {
           uint8_t b[JBOD_BLOCK_SIZE];
           jbod_client_operation(encode_op(JBOD_SIGN_BLOCK, i, j), b);
@@ -130,8 +420,23 @@ int run_workload(char *workload, int cache_size) {
       errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
   }
   fclose(f);
+}
+
+int run_workload(char *workload, const cache_config_t *config, int readahead, const verify_config_t *verify) {
+  int rc;
 
-  if (cache_size)
+  if (config->num_entries) {
+    rc = cache_create_config(config);
+    if (rc != 1)
+      errx(1, "Failed to create cache.");
+    if (readahead && mdadm_set_readahead(readahead) != 1)
+      errx(1, "Failed to enable readahead.");
+  }
+
+  replay_workload(workload, true, verify);
+
+  mdadm_set_readahead(0);
+  if (config->num_entries)
     cache_destroy();
 
   jbod_print_cost();
@@ -139,3 +444,736 @@ int run_workload(char *workload, int cache_size) {
 
   return 0;
 }
+
+/* Replays |workload| (every trace input under traces/ when NULL) under each eviction
+ * policy and cache size, and prints the hit rate with the JBOD operations
+ * it took, to choose a policy for a workload. */
+int run_policy_comparison(char *workload, bool write_back) {
+  glob_t traces = { 0 };
+  char *one[] = { workload };
+  char **paths = one;
+  size_t num_paths = 1;
+
+  if (!workload) {
+    if (glob("traces/*-input", 0, NULL, &traces) != 0)
+      errx(1, "No traces/*-input workloads found.");
+    paths = traces.gl_pathv;
+    num_paths = traces.gl_pathc;
+  }
+
+  fprintf(stdout, "%-24s %6s %8s %9s %10s %10s %10s\n", "workload", "policy", "entries", "hit rate",
+          "seeks", "reads", "writes");
+
+  for (size_t w = 0; w < num_paths; ++w)
+    for (cache_policy_t policy = 0; policy < CACHE_NUM_POLICIES; ++policy)
+      for (int size = 2; size <= 4096; size *= 2) {
+        cache_config_t config = { .num_entries = size, .write_back = write_back, .policy = policy };
+        uint64_t before[JBOD_NUM_CMDS], after[JBOD_NUM_CMDS];
+        long queries, hits;
+
+        if (cache_create_config(&config) != 1)
+          errx(1, "Failed to create cache.");
+
+        jbod_op_counts(before);
+        replay_workload(paths[w], false, NULL);
+        jbod_op_counts(after);
+
+        cache_query_stats_in(cache_default(), &queries, &hits);
+        cache_destroy();
+
+        fprintf(stdout, "%-24s %6s %8d %8.1f%% %10lu %10lu %10lu\n", paths[w], cache_policy_name(policy), size,
+                queries ? 100.0 * hits / queries : 0.0,
+                (unsigned long) (after[JBOD_SEEK_TO_DISK] + after[JBOD_SEEK_TO_BLOCK] -
+                                 before[JBOD_SEEK_TO_DISK] - before[JBOD_SEEK_TO_BLOCK]),
+                (unsigned long) (after[JBOD_READ_BLOCK] - before[JBOD_READ_BLOCK]),
+                (unsigned long) (after[JBOD_WRITE_BLOCK] - before[JBOD_WRITE_BLOCK]));
+      }
+
+  if (!workload)
+    globfree(&traces);
+  return 0;
+}
+
+/* Reads the READ and WRITE commands of |workload|; returns their number. */
+static int load_commands(char *workload, bench_cmd_t **out) {
+  char line[256], cmd[32];
+  uint32_t addr, len, ch;
+  bench_cmd_t *cmds = NULL;
+  int num_cmds = 0, max_cmds = 0;
+
+  FILE *f = fopen(workload, "r");
+  if (!f)
+    err(1, "Cannot open workload file %s", workload);
+
+  while (fgets(line, 256, f)) {
+    if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
+      continue;
+    if (num_cmds == max_cmds) {
+      max_cmds = max_cmds ? 2 * max_cmds : 1024;
+      cmds = realloc(cmds, max_cmds * sizeof(bench_cmd_t));
+      if (!cmds)
+        err(1, "Cannot allocate the workload");
+    }
+    cmds[num_cmds].write = equals(cmd, "WRITE");
+    cmds[num_cmds].addr = addr;
+    cmds[num_cmds].len = len;
+    cmds[num_cmds].fill = ch;
+    ++num_cmds;
+  }
+  fclose(f);
+
+  *out = cmds;
+  return num_cmds;
+}
+
+/* Replays the block accesses of |workload| against the cache alone, the way
+ * mdadm drives it: a lookup per block, an insert on a miss and an update on a
+ * write. Prints the average cost of a cache operation for each cache size. */
+int run_cache_benchmark(char *workload) {
+  uint8_t block[JBOD_BLOCK_SIZE];
+  bench_cmd_t *cmds = NULL;
+  int num_cmds = load_commands(workload, &cmds);
+
+  memset(block, 0, JBOD_BLOCK_SIZE);
+  fprintf(stdout, "%8s %12s %10s %9s\n", "entries", "cache ops", "ns/op", "hit rate");
+
+  for (int size = 2; size <= 4096; size *= 2) {
+    long ops = 0, lookups = 0, hits = 0;
+
+    if (cache_create(size) != 1)
+      errx(1, "Failed to create cache.");
+
+    double start = now_ns();
+    /* Replay the workload until enough operations are timed. */
+    while (ops < 1000000) {
+      for (int i = 0; i < num_cmds; ++i) {
+        if (cmds[i].len == 0)
+          continue;
+        uint32_t first = cmds[i].addr / JBOD_BLOCK_SIZE;
+        uint32_t last = (cmds[i].addr + cmds[i].len - 1) / JBOD_BLOCK_SIZE;
+        for (uint32_t b = first; b <= last; ++b) {
+          int disk_num = b / JBOD_NUM_BLOCKS_PER_DISK;
+          int block_num = b % JBOD_NUM_BLOCKS_PER_DISK;
+
+          ++lookups;
+          if (cache_lookup(disk_num, block_num, block) == 1) {
+            ++hits;
+          } else {
+            cache_insert(disk_num, block_num, block);
+            ++ops;
+          }
+          if (cmds[i].write) {
+            cache_update(disk_num, block_num, block);
+            ++ops;
+          }
+          ++ops;
+        }
+      }
+    }
+    double elapsed = now_ns() - start;
+
+    cache_destroy();
+    fprintf(stdout, "%8d %12ld %10.1f %8.1f%%\n", size, ops, elapsed / ops,
+            100.0 * hits / lookups);
+  }
+
+  free(cmds);
+  return 0;
+}
+
+/* A thread of the lookup benchmark. */
+typedef struct {
+  pthread_t thread;
+  cache_t *cache;
+  const uint32_t *blocks;
+  int num_blocks;
+  int first;             /* threads start at different places of the list */
+  long lookups;
+} lookup_thread_t;
+
+static volatile bool lookups_stop;
+
+static void *lookup_thread(void *arg) {
+  lookup_thread_t *t = arg;
+  uint8_t block[JBOD_BLOCK_SIZE];
+  long n = 0;
+
+  for (int i = t->first; !lookups_stop; i = (i + 1) % t->num_blocks, ++n) {
+    uint32_t b = t->blocks[i];
+    cache_lookup_in(t->cache, b / JBOD_NUM_BLOCKS_PER_DISK, b % JBOD_NUM_BLOCKS_PER_DISK, block);
+  }
+
+  t->lookups = n;
+  return NULL;
+}
+
+/* Lookups per second of |num_threads| threads looking up |blocks| for a
+ * while in a full cache of |num_shards| shards. */
+static double lookup_rate(const uint32_t *blocks, int num_blocks, int num_shards, int num_threads) {
+  cache_config_t config = { .num_entries = 4096, .write_back = false, .num_shards = num_shards };
+  uint8_t block[JBOD_BLOCK_SIZE];
+  lookup_thread_t *threads = calloc(num_threads, sizeof(lookup_thread_t));
+  cache_t *cache = cache_new(&config);
+  long lookups = 0;
+
+  if (!threads || !cache)
+    errx(1, "Failed to create cache.");
+
+  memset(block, 0, JBOD_BLOCK_SIZE);
+  for (int i = 0; i < num_blocks; ++i)
+    cache_insert_in(cache, blocks[i] / JBOD_NUM_BLOCKS_PER_DISK, blocks[i] % JBOD_NUM_BLOCKS_PER_DISK, block);
+
+  lookups_stop = false;
+  double start = now_ns();
+  for (int i = 0; i < num_threads; ++i) {
+    threads[i] = (lookup_thread_t) { .cache = cache, .blocks = blocks, .num_blocks = num_blocks,
+                                     .first = (int) ((long) num_blocks * i / num_threads) };
+    if (pthread_create(&threads[i].thread, NULL, lookup_thread, &threads[i]) != 0)
+      errx(1, "Failed to start a thread.");
+  }
+
+  struct timespec run = { .tv_sec = 0, .tv_nsec = 500000000 };
+  nanosleep(&run, NULL);
+  lookups_stop = true;
+
+  for (int i = 0; i < num_threads; ++i) {
+    pthread_join(threads[i].thread, NULL);
+    lookups += threads[i].lookups;
+  }
+  double elapsed = now_ns() - start;
+
+  cache_free(cache);
+  free(threads);
+  return lookups / (elapsed / 1e9);
+}
+
+/* Looks up the blocks of |workload| from 1 up to |max_threads| threads at
+ * once, in a cache with a single lock and in a sharded one with lock-free
+ * lookups. Prints the lookup rates and how they scale with the threads. */
+int run_lookup_benchmark(char *workload, int max_threads) {
+  bench_cmd_t *cmds = NULL;
+  int num_cmds = load_commands(workload, &cmds);
+  uint32_t *blocks = NULL;
+  int num_blocks = 0, max_blocks = 0;
+
+  for (int i = 0; i < num_cmds; ++i) {
+    if (cmds[i].len == 0)
+      continue;
+    uint32_t first = cmds[i].addr / JBOD_BLOCK_SIZE;
+    uint32_t last = (cmds[i].addr + cmds[i].len - 1) / JBOD_BLOCK_SIZE;
+    for (uint32_t b = first; b <= last; ++b) {
+      if (num_blocks == max_blocks) {
+        max_blocks = max_blocks ? 2 * max_blocks : 1024;
+        blocks = realloc(blocks, max_blocks * sizeof(uint32_t));
+        if (!blocks)
+          err(1, "Cannot allocate the workload");
+      }
+      blocks[num_blocks++] = b;
+    }
+  }
+
+  if (num_blocks == 0)
+    errx(1, "No block accesses in workload %s", workload);
+
+  char sharded_label[32];
+  snprintf(sharded_label, sizeof(sharded_label), "%d shards Mops/s", CACHE_MAX_SHARDS);
+  fprintf(stdout, "%8s %16s %8s %16s %8s\n", "threads", "1 shard Mops/s", "scaling",
+          sharded_label, "scaling");
+
+  double base_locked = 0, base_sharded = 0;
+  for (int n = 1; n <= max_threads; n *= 2) {
+    double locked = lookup_rate(blocks, num_blocks, 1, n);
+    double sharded = lookup_rate(blocks, num_blocks, CACHE_MAX_SHARDS, n);
+    if (n == 1) {
+      base_locked = locked;
+      base_sharded = sharded;
+    }
+    fprintf(stdout, "%8d %16.2f %7.2fx %16.2f %7.2fx\n", n, locked / 1e6, locked / base_locked,
+            sharded / 1e6, sharded / base_sharded);
+    if (n < max_threads && 2 * n > max_threads)
+      n = max_threads / 2;
+  }
+
+  free(blocks);
+  free(cmds);
+  return 0;
+}
+
+/* Where the translations end up, so that they are not optimized away. */
+uint32_t translation_sink;
+
+/* Translates the |count| addresses of |addrs| through |geometry|, |rounds|
+ * times over, and returns the cost of one translation in nanoseconds. The
+ * geometry is only known at runtime here, as it is in mdadm. */
+static double __attribute__((noinline)) translation_cost(const geometry_t *geometry, const uint32_t *addrs,
+                                                         int count, int rounds) {
+  uint32_t sum = 0;
+  int disk_num, block_num, offset;
+
+  double start = now_ns();
+  for (int r = 0; r < rounds; ++r)
+    for (int i = 0; i < count; ++i) {
+      geometry_translate(geometry, addrs[i], &disk_num, &block_num, &offset);
+      sum += disk_num ^ block_num ^ offset;
+    }
+  double elapsed = now_ns() - start;
+
+  translation_sink += sum;
+  return elapsed / ((double) count * rounds);
+}
+
+/* Checks every translation path of the volume geometry against divisions:
+ * the JBOD constants, shifts computed at runtime and the generic divisions,
+ * on the JBOD geometry and on geometries of their own. Prints the cost of a
+ * translation on each. */
+int run_translation_benchmark(void) {
+  enum { NUM_ADDRS = 1 << 16, ROUNDS = 200 };
+  geometry_t jbod = GEOMETRY_JBOD(JBOD_NUM_DISKS), shifts = jbod, generic = jbod, pow2, other;
+  uint32_t *raw = malloc(NUM_ADDRS * sizeof(uint32_t)), *addrs = malloc(NUM_ADDRS * sizeof(uint32_t));
+
+  if (!raw || !addrs)
+    err(1, "Cannot allocate the addresses");
+
+  /* The JBOD geometry, made to take the runtime paths. */
+  shifts.jbod = false;
+  generic.jbod = generic.pow2 = false;
+  if (geometry_init(&pow2, 64, 128, 512) != 1 || geometry_init(&other, 12, 200, 100) != 1)
+    errx(1, "Failed to set up the geometries.");
+
+  struct {
+    const char *name;
+    const geometry_t *geometry;
+  } paths[] = {
+    { "jbod (16x256x256)", &jbod },
+    { "runtime shifts (16x256x256)", &shifts },
+    { "generic (16x256x256)", &generic },
+    { "runtime shifts (64x128x512)", &pow2 },
+    { "generic (12x200x100)", &other },
+  };
+
+  srandom(1);
+  for (int i = 0; i < NUM_ADDRS; ++i)
+    raw[i] = ((uint32_t) random() << 16) ^ (uint32_t) random();
+
+  fprintf(stdout, "%-28s %12s\n", "geometry", "ns/address");
+  for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); ++p) {
+    const geometry_t *g = paths[p].geometry;
+    uint32_t disk_size = g->blocks_per_disk * g->block_size;
+
+    for (int i = 0; i < NUM_ADDRS; ++i) {
+      uint32_t addr = addrs[i] = raw[i] % geometry_size(g);
+      uint32_t disk_num = addr / disk_size, block_num = addr % disk_size / g->block_size;
+      int d, b, o;
+
+      geometry_translate(g, addr, &d, &b, &o);
+      if ((uint32_t) d != disk_num || (uint32_t) b != block_num || (uint32_t) o != addr % g->block_size ||
+          geometry_block_of(g, addr) != addr / g->block_size ||
+          geometry_block(g, d, b) != addr / g->block_size)
+        errx(1, "%s translates address %u wrong.", paths[p].name, addr);
+    }
+
+    fprintf(stdout, "%-28s %12.2f\n", paths[p].name, translation_cost(g, addrs, NUM_ADDRS, ROUNDS));
+  }
+
+  free(raw);
+  free(addrs);
+  return 0;
+}
+
+/* Prints a generated workload. */
+static void print_spec(FILE *out, const bench_spec_t *spec) {
+  fprintf(out, "workload %s, %ld ops, %d%% reads, %u-%u bytes aligned to %u", bench_pattern_name(spec->pattern),
+          spec->num_ops, spec->read_percent, spec->min_len, spec->max_len, spec->align);
+  if (spec->pattern == BENCH_ZIPF)
+    fprintf(out, ", theta %.2f", spec->theta);
+  fprintf(out, ", seed %lu\n", (unsigned long) spec->seed);
+}
+
+/* Prints the throughput and latency of the I/Os of |hist|, which moved
+ * |bytes| in |elapsed| nanoseconds, and what they cost: the JBOD operations
+ * between the counts |before| and |after|, |trips| round trips, and
+ * |queries| cache lookups of which |hits| hit. */
+static void print_run(FILE *out, const bench_hist_t *hist, long bytes, double elapsed, const uint64_t *before,
+                      const uint64_t *after, uint64_t trips, long queries, long hits) {
+  uint64_t ops = 0;
+  for (int c = 0; c < JBOD_NUM_CMDS; ++c)
+    ops += after[c] - before[c];
+
+  fprintf(out, "%12.0f ops/s %10.2f MB/s\n", hist->total / (elapsed / 1e9), bytes / (elapsed / 1e3));
+  fprintf(out, "latency (us): mean %.2f, min %.2f, p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+          bench_hist_mean(hist) / 1e3, hist->min / 1e3, bench_hist_percentile(hist, 50) / 1e3,
+          bench_hist_percentile(hist, 99) / 1e3, bench_hist_percentile(hist, 99.9) / 1e3, hist->max / 1e3);
+  fprintf(out, "%.2f round trips/op, %.2f JBOD ops/op, hit rate %.1f%%\n", (double) trips / hist->total,
+          (double) ops / hist->total, queries ? 100.0 * hits / queries : 0.0);
+}
+
+/* Returns true if the server on |port| answers a connection of its own,
+ * within a second, while the default connection stays open. */
+static bool served_alongside(uint16_t port) {
+  jbod_conn_t *probe = jbod_conn_open(JBOD_SERVER, port);
+  int served = probe ? jbod_conn_probe(probe, 1000) : -1;
+  jbod_conn_close(probe);
+  return served == 1;
+}
+
+/* Runs the workload generated from |spec| through mdadm, on a cache made with
+ * |config| (none if it has no entries), timing every I/O; on the mirrored
+ * volume of |mirror| instead of the server if it is not NULL. Prints the
+ * throughput, the latency percentiles, the round trips and JBOD operations
+ * per I/O, and the hit rate. */
+int run_generated_benchmark(const char *spec_text, const cache_config_t *config, int readahead,
+                            const mirror_config_t *mirror) {
+  uint32_t volume_size = JBOD_NUM_DISKS * JBOD_DISK_SIZE;
+  uint64_t before[JBOD_NUM_CMDS], after[JBOD_NUM_CMDS], trips;
+  uint8_t buf[MAX_IO_SIZE];
+  long queries = 0, hits = 0, bytes = 0;
+  bench_spec_t spec;
+  bench_cmd_t cmd;
+
+  if (bench_parse_spec(spec_text, &spec) != 1 || spec.max_len > MAX_IO_SIZE)
+    errx(1, "Invalid workload [%s], aborting.", spec_text);
+
+  bench_gen_t *gen = bench_gen_new(&spec, volume_size);
+  bench_hist_t *hist = malloc(sizeof(bench_hist_t));
+  if (!gen || !hist)
+    errx(1, "Failed to set up the workload.");
+  bench_hist_init(hist);
+
+  mdadm_ctx_t *ctx = NULL;
+  cache_t *cache = NULL;
+  if (mirror) {
+    /* The replicas' batches would wait for ever on a server serving one
+     * connection at a time. */
+    for (int i = 0; i < mirror->num_replicas; ++i)
+      if (mirror->replicas[i].backend == JBOD_BACKEND_NET && !served_alongside(mirror->replicas[i].port))
+        errx(1, "The server on port %u does not serve several connections at once; -M needs servers "
+                "that do. Aborting.", mirror->replicas[i].port);
+    if (config->num_entries && !(cache = cache_new(config)))
+      errx(1, "Failed to create cache.");
+    ctx = mdadm_ctx_create_mirrored(mirror->replicas, mirror->num_replicas, cache);
+    if (!ctx)
+      errx(1, "Failed to set up the mirrored volume.");
+    if (mirror->hedge > 0 && mdadm_ctx_set_hedging(ctx, mirror->hedge) != 1)
+      errx(1, "Failed to enable hedged reads.");
+    if (mirror->combine_blocks && mdadm_ctx_set_write_combining(ctx, mirror->combine_blocks) != 1)
+      errx(1, "Failed to enable write combining.");
+  } else if (config->num_entries) {
+    if (cache_create_config(config) != 1)
+      errx(1, "Failed to create cache.");
+    if (readahead && mdadm_set_readahead(readahead) != 1)
+      errx(1, "Failed to enable readahead.");
+  }
+  if ((ctx ? mdadm_ctx_mount(ctx) : mdadm_mount()) != 1)
+    errx(1, "Failed to mount.");
+
+  mdadm_stats_t io_before, io_after;
+  mdadm_get_stats(&io_before);
+
+  jbod_op_counts(before);
+  trips = jbod_round_trips();
+
+  double start = now_ns();
+  for (long i = 0; i < spec.num_ops; ++i) {
+    bench_gen_next(gen, &cmd);
+    if (cmd.write)
+      memset(buf, cmd.fill, cmd.len);
+
+    double op_start = now_ns();
+    int rc;
+    if (ctx)
+      rc = cmd.write ? mdadm_ctx_write(ctx, cmd.addr, cmd.len, buf) : mdadm_ctx_read(ctx, cmd.addr, cmd.len, buf);
+    else
+      rc = cmd.write ? mdadm_write(cmd.addr, cmd.len, buf) : mdadm_read(cmd.addr, cmd.len, buf);
+    bench_hist_record(hist, (uint64_t) (now_ns() - op_start));
+
+    if (rc != (int) cmd.len)
+      errx(1, "Failed to %s %u bytes at %u.", cmd.write ? "write" : "read", cmd.len, cmd.addr);
+    bytes += cmd.len;
+  }
+  double elapsed = now_ns() - start;
+
+  jbod_op_counts(after);
+  trips = jbod_round_trips() - trips;
+  cache_query_stats_in(ctx ? cache : cache_default(), &queries, &hits);
+  mdadm_get_stats(&io_after);
+
+  if (ctx) {
+    mdadm_ctx_destroy(ctx);
+    if (cache)
+      cache_free(cache);
+  } else {
+    mdadm_set_readahead(0);
+    mdadm_unmount();
+    if (config->num_entries)
+      cache_destroy();
+  }
+
+  print_spec(stdout, &spec);
+  print_run(stdout, hist, bytes, elapsed, before, after, trips, queries, hits);
+  if (mirror)
+    fprintf(stdout, "%d replicas, %lu block reads hedged\n", mirror->num_replicas,
+            (unsigned long) (io_after.reads_hedged - io_before.reads_hedged));
+
+  bench_gen_free(gen);
+  free(hist);
+  return 0;
+}
+
+/* A thread of the parallel replay, with its own context: the commands of its
+ * region of the volume, or the stream generated over that region. */
+typedef struct {
+  pthread_t thread;
+  mdadm_ctx_t *ctx;
+  pthread_barrier_t *start;  /* threads start together */
+  uint32_t base;             /* start of the region */
+  uint32_t size;             /* bytes of the region */
+  bench_cmd_t *cmds;         /* trace: the commands of the region */
+  bench_gen_t *gen;          /* generated: the stream, at addresses from base */
+  uint8_t *shadow;           /* generated: what the region should hold */
+  long num_ops;
+  long max_cmds;
+  long bytes;
+  long mismatches;           /* reads that did not return the shadow */
+  double elapsed;
+  bool failed;
+  bench_hist_t hist;
+} replay_thread_t;
+
+static void *replay_thread(void *arg) {
+  replay_thread_t *t = arg;
+  uint8_t buf[MAX_IO_SIZE];
+  bench_cmd_t cmd;
+
+  pthread_barrier_wait(t->start);
+
+  double start = now_ns();
+  for (long i = 0; i < t->num_ops; ++i) {
+    if (t->gen) {
+      bench_gen_next(t->gen, &cmd);
+      cmd.addr += t->base;
+    } else {
+      cmd = t->cmds[i];
+    }
+    if (cmd.write)
+      memset(buf, cmd.fill, cmd.len);
+
+    double op_start = now_ns();
+    int rc = cmd.write ? mdadm_ctx_write(t->ctx, cmd.addr, cmd.len, buf) : mdadm_ctx_read(t->ctx, cmd.addr, cmd.len, buf);
+    bench_hist_record(&t->hist, (uint64_t) (now_ns() - op_start));
+
+    if (rc != (int) cmd.len) {
+      t->failed = true;
+      break;
+    }
+    if (t->shadow && cmd.write)
+      memcpy(t->shadow + cmd.addr - t->base, buf, cmd.len);
+    else if (t->shadow && memcmp(t->shadow + cmd.addr - t->base, buf, cmd.len) != 0)
+      ++t->mismatches;
+    t->bytes += cmd.len;
+  }
+  t->elapsed = now_ns() - start;
+
+  return NULL;
+}
+
+/* Start of the region of thread |i| of |threads|: the volume is split into
+ * regions of whole blocks, as even as they can be. */
+static uint32_t region_start(int i, int threads) {
+  uint32_t num_blocks = JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK;
+  return (uint32_t) ((uint64_t) i * num_blocks / threads) * JBOD_BLOCK_SIZE;
+}
+
+/* The thread of |threads| whose region holds |addr|. */
+static int region_of(uint32_t addr, int threads) {
+  uint32_t num_blocks = JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK;
+  return (int) (((uint64_t) (addr / JBOD_BLOCK_SIZE + 1) * threads - 1) / num_blocks);
+}
+
+/* Adds |cmd| to the commands of thread |t|. */
+static void add_command(replay_thread_t *t, bench_cmd_t cmd) {
+  if (t->num_ops == t->max_cmds) {
+    t->max_cmds = t->max_cmds ? 2 * t->max_cmds : 1024;
+    t->cmds = realloc(t->cmds, t->max_cmds * sizeof(bench_cmd_t));
+    if (!t->cmds)
+      err(1, "Cannot allocate the workload");
+  }
+  t->cmds[t->num_ops++] = cmd;
+}
+
+/* Runs |threads| threads at once, each with its own context (and connection)
+ * and the cache made with |config| shared between them (none if it has no
+ * entries). The volume is split into a region per thread: a trace |workload|
+ * is partitioned by region, commands spanning two regions being split, and a
+ * generated workload |spec_text| runs a stream of its own in each region,
+ * seeded from the seed of the spec. Since a block is only ever touched by one
+ * thread, the final state of the volume does not depend on how the threads
+ * interleave: a trace ends with the signatures of every block, checked
+ * against its expected output as |verify| says (remotely from a connection
+ * per thread when NULL), and each generated region is read back and checked
+ * against what its stream wrote. Prints the throughput and latency of each
+ * thread, then of all of them, with what they cost. */
+int run_parallel_replay(char *workload, const char *spec_text, int threads, const cache_config_t *config,
+                        jbod_backend_t backend, const verify_config_t *verify) {
+  uint32_t volume_size = JBOD_NUM_DISKS * JBOD_DISK_SIZE;
+  uint64_t before[JBOD_NUM_CMDS], after[JBOD_NUM_CMDS], trips;
+  mdadm_endpoint_t endpoint = { .ip = JBOD_SERVER, .port = JBOD_PORT, .backend = backend };
+  FILE *out = spec_text ? stdout : stderr;  /* a trace prints its signatures on stdout */
+  long queries = 0, hits = 0, bytes = 0, mismatches = 0;
+  bench_spec_t spec;
+  pthread_barrier_t start;
+  cache_t *cache = NULL;
+  bool failed = false;
+
+  if (threads > JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+    errx(1, "Too many threads (%d), aborting.", threads);
+  if (config->write_back)
+    errx(1, "A write-back cache cannot be shared by several threads, aborting.");
+
+  /* A server serving one connection at a time would never read the threads'
+   * mounts while the default connection is open. */
+  if (backend == JBOD_BACKEND_NET && !served_alongside(JBOD_PORT))
+    errx(1, "The server does not serve several connections at once; -T needs one keeping a head per "
+            "connection, or -B local. Aborting.");
+
+  replay_thread_t *t = calloc(threads, sizeof(replay_thread_t));
+  if (!t)
+    errx(1, "Failed to set up the threads.");
+
+  if (spec_text) {
+    if (bench_parse_spec(spec_text, &spec) != 1 || spec.max_len > MAX_IO_SIZE)
+      errx(1, "Invalid workload [%s], aborting.", spec_text);
+  } else {
+    bench_cmd_t *cmds = NULL;
+    int num_cmds = load_commands(workload, &cmds);
+
+    for (int i = 0; i < num_cmds; ++i) {
+      bench_cmd_t cmd = cmds[i];
+      while (cmd.len > 0) {
+        int r = region_of(cmd.addr, threads);
+        uint32_t end = (r + 1 < threads) ? region_start(r + 1, threads) : volume_size;
+        bench_cmd_t piece = cmd;
+        piece.len = (cmd.addr + cmd.len <= end) ? cmd.len : end - cmd.addr;
+        add_command(&t[r], piece);
+        cmd.addr += piece.len;
+        cmd.len -= piece.len;
+      }
+    }
+    free(cmds);
+  }
+
+  if (config->num_entries && !(cache = cache_new(config)))
+    errx(1, "Failed to create cache.");
+  if (mdadm_mount() != 1)
+    errx(1, "Failed to mount.");
+
+  for (int i = 0; i < threads; ++i) {
+    t[i].base = region_start(i, threads);
+    t[i].size = ((i + 1 < threads) ? region_start(i + 1, threads) : volume_size) - t[i].base;
+    t[i].start = &start;
+    bench_hist_init(&t[i].hist);
+
+    t[i].ctx = mdadm_ctx_create_striped(&endpoint, 1, 1, cache);
+    if (!t[i].ctx || mdadm_ctx_mount(t[i].ctx) != 1)
+      errx(1, "Failed to mount the context of thread %d.", i);
+
+    if (spec_text) {
+      bench_spec_t stream = spec;
+
+      // The first stream picks the seed when there is none; the others follow it
+      if (i > 0)
+        stream.seed = spec.seed + i;
+      t[i].gen = bench_gen_new(&stream, t[i].size);
+      if (!t[i].gen)
+        errx(1, "The workload does not fit the %u bytes of a thread, aborting.", t[i].size);
+      if (i == 0)
+        spec.seed = stream.seed;
+      t[i].num_ops = spec.num_ops;
+
+      // The last byte of a region is never accessed (nor is the one of the volume readable)
+      t[i].shadow = malloc(t[i].size);
+      if (!t[i].shadow)
+        errx(1, "Cannot allocate the shadow of thread %d", i);
+      for (uint32_t off = 0; off < t[i].size - 1; off += MAX_IO_SIZE) {
+        uint32_t len = (t[i].size - 1 - off < MAX_IO_SIZE) ? t[i].size - 1 - off : MAX_IO_SIZE;
+        if (mdadm_read(t[i].base + off, len, t[i].shadow + off) != (int) len)
+          errx(1, "Failed to read the region of thread %d.", i);
+      }
+    }
+  }
+
+  if (pthread_barrier_init(&start, NULL, threads + 1) != 0)
+    errx(1, "Failed to set up the threads.");
+  for (int i = 0; i < threads; ++i)
+    if (pthread_create(&t[i].thread, NULL, replay_thread, &t[i]) != 0)
+      errx(1, "Failed to start a thread.");
+
+  jbod_op_counts(before);
+  trips = jbod_round_trips();
+
+  pthread_barrier_wait(&start);
+  double wall = now_ns();
+  for (int i = 0; i < threads; ++i)
+    pthread_join(t[i].thread, NULL);
+  wall = now_ns() - wall;
+
+  jbod_op_counts(after);
+  trips = jbod_round_trips() - trips;
+  if (cache)
+    cache_query_stats_in(cache, &queries, &hits);
+  pthread_barrier_destroy(&start);
+
+  bench_hist_t *hist = malloc(sizeof(bench_hist_t));
+  if (!hist)
+    errx(1, "Failed to set up the workload.");
+  bench_hist_init(hist);
+
+  if (spec_text)
+    print_spec(out, &spec);
+  for (int i = 0; i < threads; ++i) {
+    fprintf(out, "thread %2d: %8ld ops %12.0f ops/s %10.2f MB/s, p50 %.2f us, p99 %.2f us, p99.9 %.2f us%s\n", i,
+            (long) t[i].hist.total, t[i].hist.total / (t[i].elapsed / 1e9), t[i].bytes / (t[i].elapsed / 1e3),
+            bench_hist_percentile(&t[i].hist, 50) / 1e3, bench_hist_percentile(&t[i].hist, 99) / 1e3,
+            bench_hist_percentile(&t[i].hist, 99.9) / 1e3, t[i].failed ? " (failed)" : "");
+    bench_hist_merge(hist, &t[i].hist);
+    bytes += t[i].bytes;
+    failed |= t[i].failed;
+  }
+  fprintf(out, "%d threads:\n", threads);
+  print_run(out, hist, bytes, wall, before, after, trips, queries, hits);
+
+  // The contexts are done: their regions are checked through the default one, which has no cache
+  for (int i = 0; i < threads; ++i)
+    mdadm_ctx_destroy(t[i].ctx);
+
+  if (spec_text) {
+    uint8_t buf[MAX_IO_SIZE];
+    for (int i = 0; i < threads; ++i) {
+      mismatches += t[i].mismatches;
+      for (uint32_t off = 0; off < t[i].size - 1; off += MAX_IO_SIZE) {
+        uint32_t len = (t[i].size - 1 - off < MAX_IO_SIZE) ? t[i].size - 1 - off : MAX_IO_SIZE;
+        if (mdadm_read(t[i].base + off, len, buf) != (int) len || memcmp(buf, t[i].shadow + off, len) != 0)
+          ++mismatches;
+      }
+      bench_gen_free(t[i].gen);
+      free(t[i].shadow);
+    }
+    fprintf(out, "consistency: %s (%ld mismatches)\n", mismatches ? "FAILED" : "ok", mismatches);
+  } else {
+    verify_config_t remote = { .mode = VERIFY_REMOTE, .num_threads = threads, .backend = backend,
+                               .ip = JBOD_SERVER, .port = JBOD_PORT, .conn = jbod_default_conn() };
+    int rc = sign_and_compare(workload, verify ? verify : &remote, cache);
+    mismatches = (rc == 0);
+    fprintf(out, "consistency: %s\n", (rc == 1) ? "signatures match the expected output" :
+            (rc == 0) ? "FAILED, signatures differ from the expected output" : "no expected output to check");
+  }
+
+  mdadm_unmount();
+  if (cache)
+    cache_free(cache);
+
+  for (int i = 0; i < threads; ++i)
+    free(t[i].cmds);
+  free(t);
+  free(hist);
+  return (failed || mismatches) ? -1 : 0;
+}
@@ -3,11 +3,15 @@
 
 #include <stdint.h>
 
-void enable_debug_log(void);
-void set_debug_logfile(const char *filename);
-void debug_log(const char *fmt, ...);
+#include "debuglog.h"
+
+#define SHA1_SIG_LEN 80
 
 const char *sha1_sig(uint8_t *buf, uint32_t size);
+
+/* Same as sha1_sig, into |sig| (SHA1_SIG_LEN bytes) instead of a static
+ * buffer, so that several threads can sign at once. */
+const char *sha1_sig_r(uint8_t *buf, uint32_t size, char *sig);
 uint32_t get_rand(uint32_t min, uint32_t max);
 
 #endif
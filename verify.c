@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "verify.h"
+#include "util.h"
+
+/* Implementing the parallel Verification of the volume against a SIGNALL output */
+
+// Declaring CONSTANTS
+static const char *mode_names[VERIFY_NUM_MODES] = { "remote", "local" };
+#define NUM_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+#define NUM_CHUNKS (NUM_BLOCKS / VERIFY_CHUNK)	// a chunk never spans two disks
+#define PROBE_WAIT_MS 200			// longest wait for the server to answer a new connection
+
+// A verification in progress: the threads claim the chunks in order, and the caller compares
+// them as they complete
+typedef struct {
+  const verify_config_t *config;
+  jbod_conn_t *shared;			// the caller's connection, until a thread takes it
+  char (*sigs)[VERIFY_SIG_LEN];		// signature line of each block
+  int next_chunk;			// next chunk to claim
+  int chunk_state[NUM_CHUNKS];		// 0 while pending, 1 once signed, -1 if it failed
+  pthread_mutex_t lock;
+  pthread_cond_t chunk_done;
+} verify_run_t;
+
+
+//// HELPER Functions ////
+
+// Helper function-1: op_of() - a JBOD operation
+static uint32_t op_of(jbod_cmd_t cmd, int disk_num, int block_num) {
+  return (uint32_t) cmd << 26 | (uint32_t) disk_num << 22 | (uint32_t) block_num;
+}
+
+// Helper function-2: sign_chunk() - has the JBOD sign the blocks of a chunk, in one batch; returns
+// 0 on success and -1 on failure
+static int sign_chunk(verify_run_t *run, jbod_conn_t *conn, int chunk) {
+
+  jbod_request_t reqs[VERIFY_CHUNK];
+  uint8_t blocks[VERIFY_CHUNK][JBOD_BLOCK_SIZE];
+  int first = chunk * VERIFY_CHUNK;
+
+  for (int k = 0; k < VERIFY_CHUNK; k++)
+      reqs[k] = (jbod_request_t) { .op = op_of(JBOD_SIGN_BLOCK, (first + k) / JBOD_NUM_BLOCKS_PER_DISK,
+                                               (first + k) % JBOD_NUM_BLOCKS_PER_DISK), .block = blocks[k] };
+
+  if (jbod_conn_batch(conn, reqs, VERIFY_CHUNK) != 0)
+      return -1;
+
+  for (int k = 0; k < VERIFY_CHUNK; k++)
+      snprintf(run->sigs[first + k], VERIFY_SIG_LEN, "%.*s",
+               (int) strnlen((char *) blocks[k], JBOD_BLOCK_SIZE), (char *) blocks[k]);
+
+  return 0;
+}
+
+// Helper function-3: hash_chunk() - reads the blocks of a chunk the cache does not hold, in one
+// batch, and signs them all here; returns 0 on success and -1 on failure
+static int hash_chunk(verify_run_t *run, jbod_conn_t *conn, int chunk) {
+
+  jbod_request_t reqs[2 * VERIFY_CHUNK + 1];
+  uint8_t blocks[VERIFY_CHUNK][JBOD_BLOCK_SIZE];
+  char sig[SHA1_SIG_LEN];
+  int first = chunk * VERIFY_CHUNK;
+  int disk_num = first / JBOD_NUM_BLOCKS_PER_DISK;
+  int first_block = first % JBOD_NUM_BLOCKS_PER_DISK;
+  int num_reqs = 0, head = -1;
+
+  for (int k = 0; k < VERIFY_CHUNK; k++) {
+
+      int block_num = first_block + k;
+
+      if (cache_peek_in(run->config->cache, disk_num, block_num, blocks[k]) == 1)
+          continue;
+
+      // A run of blocks to read takes a seek to its first one, the head then moving on by itself
+      if (num_reqs == 0)
+          reqs[num_reqs++] = (jbod_request_t) { .op = op_of(JBOD_SEEK_TO_DISK, disk_num, 0) };
+      if (head != block_num)
+          reqs[num_reqs++] = (jbod_request_t) { .op = op_of(JBOD_SEEK_TO_BLOCK, 0, block_num) };
+      reqs[num_reqs++] = (jbod_request_t) { .op = op_of(JBOD_READ_BLOCK, 0, 0), .block = blocks[k] };
+      head = block_num + 1;
+  }
+
+  if ((num_reqs > 0) && (jbod_conn_batch(conn, reqs, num_reqs) != 0))
+      return -1;
+
+  for (int k = 0; k < VERIFY_CHUNK; k++)
+      snprintf(run->sigs[first + k], VERIFY_SIG_LEN, "SIG(disk,block) %2d %3d : %s\n", disk_num,
+               first_block + k, sha1_sig_r(blocks[k], JBOD_BLOCK_SIZE, sig));
+
+  return 0;
+}
+
+// Helper function-4: served_alongside() - whether the server answers a connection of its own while
+// the others stay open; returns 1 if it does, 0 if it did not within PROBE_WAIT_MS, and -1 on failure
+static int served_alongside(const verify_config_t *config) {
+
+  jbod_conn_t *conn = jbod_conn_open_backend(config->backend, config->ip, config->port);
+  int rc = (conn != NULL) ? jbod_conn_probe(conn, PROBE_WAIT_MS) : -1;
+
+  jbod_conn_close(conn);
+  return rc;
+}
+
+// Helper function-5: verify_thread() - signs the chunks it claims until there is none left
+static void *verify_thread(void *arg) {
+
+  verify_run_t *run = arg;
+  const verify_config_t *config = run->config;
+  jbod_conn_t *conn = __atomic_exchange_n(&run->shared, NULL, __ATOMIC_RELAXED);
+  bool own = (conn == NULL), mounted = false;
+
+  // One thread signs on the caller's connection, the others on connections of their own
+  if (own == true)
+      conn = jbod_conn_open_backend(config->backend, config->ip, config->port);
+
+  // Reading needs the JBOD mounted; it may be already, through another connection
+  if ((conn != NULL) && (config->mode == VERIFY_LOCAL))
+      mounted = (jbod_conn_operation(conn, op_of(JBOD_MOUNT, 0, 0), NULL) == 0);
+
+  while (true) {
+
+      int chunk = __atomic_fetch_add(&run->next_chunk, 1, __ATOMIC_RELAXED);
+      if (chunk >= NUM_CHUNKS)
+          break;
+
+      int rc = -1;
+      if (conn != NULL)
+          rc = (config->mode == VERIFY_LOCAL) ? hash_chunk(run, conn, chunk) : sign_chunk(run, conn, chunk);
+
+      pthread_mutex_lock(&run->lock);
+      run->chunk_state[chunk] = (rc == 0) ? 1 : -1;
+      pthread_cond_broadcast(&run->chunk_done);
+      pthread_mutex_unlock(&run->lock);
+  }
+
+  if (mounted == true)
+      jbod_conn_operation(conn, op_of(JBOD_UNMOUNT, 0, 0), NULL);
+  if ((own == true) && (conn != NULL))
+      jbod_conn_close(conn);
+
+  return NULL;
+}
+
+// Helper function-6: line_length() - length of a line, without its line break nor trailing spaces
+static int line_length(const char *line) {
+
+  int len = (int) strcspn(line, "\n");
+
+  while ((len > 0) && (line[len - 1] == ' '))
+      len--;
+  return len;
+}
+
+// Helper function-7: digest_of() - the signature part of a SIGNALL line, or the whole line
+static const char *digest_of(const char *line) {
+
+  const char *digest = strstr(line, " : ");
+  return (digest != NULL) ? digest + 3 : line;
+}
+
+// Helper function-8: compare_block() - compares the signature of a block with the next expected
+// line, and reports a mismatch; returns 1 if they differ and 0 otherwise
+static int compare_block(const char *sig, int block, FILE *expected, FILE *out) {
+
+  char line[256];
+  int disk_num = block / JBOD_NUM_BLOCKS_PER_DISK;
+  int block_num = block % JBOD_NUM_BLOCKS_PER_DISK;
+
+  if (fgets(line, sizeof(line), expected) == NULL) {
+      fprintf(out, "MISMATCH(disk,block) %2d %3d : no expected signature, got %.*s\n", disk_num, block_num,
+              line_length(digest_of(sig)), digest_of(sig));
+      return 1;
+  }
+
+  if ((line_length(line) == line_length(sig)) && (strncmp(line, sig, line_length(sig)) == 0))
+      return 0;
+
+  fprintf(out, "MISMATCH(disk,block) %2d %3d : expected %.*s, got %.*s\n", disk_num, block_num,
+          line_length(digest_of(line)), digest_of(line), line_length(digest_of(sig)), digest_of(sig));
+  return 1;
+}
+
+
+//// Verification Functions
+
+const char *verify_mode_name(verify_mode_t mode) {
+  return ((mode >= 0) && (mode < VERIFY_NUM_MODES)) ? mode_names[mode] : NULL;
+}
+
+int verify_parse_spec(const char *text, verify_config_t *config) {
+
+  // This function to return 1 on Success and -1 on Failure
+
+  const char *colon = (text != NULL) ? strchr(text, ':') : NULL;
+  const char *threads = text;
+  char *end;
+
+  if (text == NULL)
+      return -1;
+
+  config->mode = VERIFY_REMOTE;
+  if (colon != NULL) {
+      for (config->mode = 0; config->mode < VERIFY_NUM_MODES; config->mode++)
+          if ((strlen(mode_names[config->mode]) == (size_t) (colon - text)) &&
+              (strncmp(text, mode_names[config->mode], colon - text) == 0))
+              break;
+      if (config->mode == VERIFY_NUM_MODES)
+          return -1;
+      threads = colon + 1;
+  }
+
+  config->num_threads = (int) strtol(threads, &end, 0);
+
+  return ((*threads != '\0') && (*end == '\0') && (config->num_threads > 0)) ? 1 : -1;
+}
+
+long verify_volume(const verify_config_t *config, FILE *expected, FILE *out) {
+
+  // This function to return the number of mismatching blocks on Success and -1 on Failure
+
+  if ((config == NULL) || (config->mode < 0) || (config->mode >= VERIFY_NUM_MODES) || (config->num_threads < 1))
+      return -1;
+
+  // More threads than chunks would have nothing to do
+  int num_threads = (config->num_threads < NUM_CHUNKS) ? config->num_threads : NUM_CHUNKS;
+
+  // Signing needs no head of its own, so a remote verification can use the caller's connection;
+  // a local one moves the heads, and only uses connections of its own
+  jbod_conn_t *shared = (config->mode == VERIFY_REMOTE) ? config->conn : NULL;
+  int num_shared = (shared != NULL) ? 1 : 0;
+
+  verify_run_t *run = calloc(1, sizeof(verify_run_t));
+  pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  int started = 0;
+  long mismatches = 0;
+  bool failed = false;
+
+  if ((run == NULL) || (threads == NULL) || ((run->sigs = malloc(NUM_BLOCKS * VERIFY_SIG_LEN)) == NULL)) {
+      if (run != NULL)
+          free(run->sigs);
+      free(run);
+      free(threads);
+      return -1;
+  }
+
+  run->config = config;
+  run->shared = shared;
+  pthread_mutex_init(&run->lock, NULL);
+  pthread_cond_init(&run->chunk_done, NULL);
+
+  // The thread on the caller's connection starts first, and signs while the server is probed
+  if ((num_shared == 1) && (pthread_create(&threads[0], NULL, verify_thread, run) == 0))
+      started++;
+
+  // A server that does not answer a new connection while the others are open (serving one at a
+  // time) would leave the threads on their own connections waiting for ever
+  if ((num_threads > num_shared) && (config->backend == JBOD_BACKEND_NET) && (served_alongside(config) != 1))
+      num_threads = started;
+
+  while ((started < num_threads) && (pthread_create(&threads[started], NULL, verify_thread, run) == 0))
+      started++;
+
+  // The chunks are compared in order as they complete, while the threads sign the next ones
+  for (int chunk = 0; (chunk < NUM_CHUNKS) && (started > 0); chunk++) {
+
+      pthread_mutex_lock(&run->lock);
+      while (run->chunk_state[chunk] == 0)
+          pthread_cond_wait(&run->chunk_done, &run->lock);
+      pthread_mutex_unlock(&run->lock);
+
+      if (run->chunk_state[chunk] == -1) {
+          failed = true;
+          break;
+      }
+
+      for (int block = chunk * VERIFY_CHUNK; block < (chunk + 1) * VERIFY_CHUNK; block++) {
+          if (expected == NULL)
+              fputs(run->sigs[block], out);
+          else
+              mismatches += compare_block(run->sigs[block], block, expected, out);
+      }
+  }
+
+  // On failure, the threads stop at their next chunk
+  __atomic_store_n(&run->next_chunk, NUM_CHUNKS, __ATOMIC_RELAXED);
+  for (int i = 0; i < started; i++)
+      pthread_join(threads[i], NULL);
+
+  // Lines past the last block have no block to match
+  if ((expected != NULL) && (started > 0) && (failed == false)) {
+      char line[256];
+      while (fgets(line, sizeof(line), expected) != NULL) {
+          fprintf(out, "MISMATCH past the last block : %.*s\n", line_length(line), line);
+          mismatches++;
+      }
+  }
+  fflush(out);
+
+  pthread_cond_destroy(&run->chunk_done);
+  pthread_mutex_destroy(&run->lock);
+  free(run->sigs);
+  free(run);
+  free(threads);
+
+  return ((started == 0) || (failed == true)) ? -1 : mismatches;
+}
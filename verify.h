@@ -0,0 +1,61 @@
+#ifndef VERIFY_H_
+#define VERIFY_H_
+
+#include <stdio.h>
+
+#include "cache.h"
+#include "net.h"
+
+/* Longest signature line of a block, as JBOD_SIGN_BLOCK returns it:
+ * "SIG(disk,block) %2d %3d : <sha1_sig of the block>\n". */
+#define VERIFY_SIG_LEN 128
+
+/* Blocks signed by one batch of requests. */
+#define VERIFY_CHUNK JBOD_BATCH_MAX
+
+/* Where the signatures of the blocks come from. */
+typedef enum {
+  VERIFY_REMOTE,  /* JBOD_SIGN_BLOCK, from the JBOD */
+  VERIFY_LOCAL,   /* sha1_sig of the blocks, read from the JBOD (or taken from
+                   * |cache| when it holds them) and hashed here */
+  VERIFY_NUM_MODES,
+} verify_mode_t;
+
+/* How to verify the volume: |num_threads| threads, each with a connection of
+ * its own to |backend| (at |ip| and |port| for the network one), sign the
+ * volume a chunk of VERIFY_CHUNK blocks at a time. A local verification
+ * moves the heads of its connections, so it needs a server keeping a head per
+ * connection, or the local backend, when mdadm uses the JBOD meanwhile.
+ * A remote verification signs on |conn|, when there is one, from one of the
+ * threads. The others open connections of their own only once the server
+ * answered a new connection meanwhile: a server serving one connection at a
+ * time (as jbod_server does) leaves the remote verification on |conn| alone,
+ * and fails a local one. */
+typedef struct {
+  verify_mode_t mode;
+  int num_threads;
+  jbod_backend_t backend;
+  const char *ip;
+  uint16_t port;
+  cache_t *cache;     /* VERIFY_LOCAL: blocks it holds are not read (may be NULL) */
+  jbod_conn_t *conn;  /* the caller's connection to the server (may be NULL) */
+} verify_config_t;
+
+/* Returns the short name of |mode| ("remote", "local"), or NULL. */
+const char *verify_mode_name(verify_mode_t mode);
+
+/* Parses a verification given as "[mode:]threads" (remote by default) into
+ * the mode and number of threads of |config|. Returns 1 on success and -1 on
+ * failure. */
+int verify_parse_spec(const char *text, verify_config_t *config);
+
+/* Signs every block of the volume, as configured by |config|, and compares
+ * the signatures with the lines of |expected| (a SIGNALL output) as the
+ * chunks complete, in block order. Each block whose signature differs, or
+ * has no line, is reported on |out|, as are lines past the last block.
+ * When |expected| is NULL, every signature is printed on |out| instead.
+ * Returns the number of mismatching blocks (0 when |expected| is NULL), or
+ * -1 on failure. */
+long verify_volume(const verify_config_t *config, FILE *expected, FILE *out);
+
+#endif